@@ -0,0 +1,227 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/video.h>
+#include <grub/bitmap.h>
+#include <grub/types.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/command.h>
+#include <grub/i18n.h>
+#include <grub/env.h>
+#include <grub/time.h>
+#include <grub/term.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Size of the bitmaps tiled over the screen.  */
+#define BENCH_TILE 256
+/* Minimum run time of every test, in ms.  */
+#define BENCH_TIME 1000
+/* Default number and length of the lines printed by textbench.  */
+#define BENCH_LINES 1000
+#define BENCH_LINE_LENGTH 72
+
+/* Each test redraws the whole screen before swapping, so every frame also
+   copies all of it.  */
+enum
+  {
+    BENCH_FILL,
+    BENCH_REPLACE,
+    BENCH_BLEND,
+    BENCH_COUNT
+  };
+
+static const char *bench_names[BENCH_COUNT] =
+  {
+    [BENCH_FILL] = "fill",
+    [BENCH_REPLACE] = "replace",
+    [BENCH_BLEND] = "blend"
+  };
+
+/* Fill an RGBA8888 bitmap with a colour gradient.  If TRANSLUCENT, alpha
+   runs from 0 to 255 across every row, covering the transparent, opaque
+   and blended paths of the blitters.  */
+static void
+fill_bitmap (struct grub_video_bitmap *bitmap, int translucent)
+{
+  grub_uint32_t *data = grub_video_bitmap_get_data (bitmap);
+  unsigned x, y;
+
+  for (y = 0; y < BENCH_TILE; y++)
+    for (x = 0; x < BENCH_TILE; x++)
+      {
+	grub_uint32_t a = translucent ? x * 255 / (BENCH_TILE - 1) : 255;
+	*data++ = (x | (y << 8) | (((x + y) / 2) << 16) | (a << 24));
+      }
+}
+
+static grub_err_t
+grub_cmd_videobench (grub_command_t cmd __attribute__ ((unused)),
+		     int argc, char **args)
+{
+  grub_err_t err;
+  struct grub_video_mode_info mode_info;
+  struct grub_video_bitmap *opaque = NULL, *translucent = NULL;
+  grub_uint64_t elapsed[BENCH_COUNT];
+  unsigned frames[BENCH_COUNT];
+  unsigned int x, y, width, height;
+  const char *mode = NULL;
+  int test;
+
+  mode = grub_env_get ("gfxmode");
+  if (argc)
+    mode = args[0];
+  if (!mode)
+    mode = "auto";
+
+  if (grub_video_bitmap_create (&opaque, BENCH_TILE, BENCH_TILE,
+				GRUB_VIDEO_BLIT_FORMAT_RGBA_8888)
+      || grub_video_bitmap_create (&translucent, BENCH_TILE, BENCH_TILE,
+				   GRUB_VIDEO_BLIT_FORMAT_RGBA_8888))
+    goto fail;
+  fill_bitmap (opaque, 0);
+  fill_bitmap (translucent, 1);
+
+  err = grub_video_set_mode (mode, GRUB_VIDEO_MODE_TYPE_PURE_TEXT, 0);
+  if (err)
+    goto fail;
+
+  grub_video_get_info (&mode_info);
+  grub_video_get_viewport (&x, &y, &width, &height);
+
+  for (test = 0; test < BENCH_COUNT; test++)
+    {
+      grub_uint64_t start = grub_get_time_ms ();
+
+      frames[test] = 0;
+      do
+	{
+	  unsigned int tx, ty;
+
+	  for (ty = 0; test >= BENCH_REPLACE && ty < height; ty += BENCH_TILE)
+	    for (tx = 0; tx < width; tx += BENCH_TILE)
+	      grub_video_blit_bitmap (test == BENCH_REPLACE ? opaque
+				      : translucent,
+				      test == BENCH_REPLACE
+				      ? GRUB_VIDEO_BLIT_REPLACE
+				      : GRUB_VIDEO_BLIT_BLEND,
+				      tx, ty, 0, 0, BENCH_TILE, BENCH_TILE);
+	  if (test == BENCH_FILL)
+	    grub_video_fill_rect (grub_video_map_rgb (frames[test] & 0xff,
+						      0x40, 0x80),
+				  0, 0, width, height);
+	  grub_video_swap_buffers ();
+	  frames[test]++;
+	  elapsed[test] = grub_get_time_ms () - start;
+	}
+      while (elapsed[test] < BENCH_TIME);
+    }
+
+  grub_video_restore ();
+
+  grub_printf_ (N_("Mode: %ux%u, %u bpp\n"), mode_info.width,
+		mode_info.height, mode_info.bpp);
+  for (test = 0; test < BENCH_COUNT; test++)
+    {
+      /* In units of 0.01 Mpixel/s.  */
+      grub_uint64_t rate;
+
+      rate = grub_divmod64 ((grub_uint64_t) frames[test] * width * height,
+			    elapsed[test] * 10, 0);
+      grub_printf_ (N_("%-8s %u frames in %u ms, %u.%02u frames/s, "
+		       "%u.%02u Mpixel/s\n"),
+		    bench_names[test], frames[test],
+		    (unsigned) elapsed[test],
+		    (unsigned) grub_divmod64 (frames[test] * 1000ULL,
+					      elapsed[test], 0),
+		    (unsigned) (grub_divmod64 (frames[test] * 100000ULL,
+					       elapsed[test], 0) % 100),
+		    (unsigned) (rate / 100), (unsigned) (rate % 100));
+    }
+
+  grub_errno = GRUB_ERR_NONE;
+
+ fail:
+  if (opaque)
+    grub_video_bitmap_destroy (opaque);
+  if (translucent)
+    grub_video_bitmap_destroy (translucent);
+  return grub_errno;
+}
+
+static grub_err_t
+grub_cmd_textbench (grub_command_t cmd __attribute__ ((unused)),
+		    int argc, char **args)
+{
+  char line[BENCH_LINE_LENGTH + 1];
+  grub_uint64_t start, elapsed;
+  unsigned int lines = BENCH_LINES;
+  unsigned int i, j;
+
+  if (argc)
+    {
+      lines = grub_strtoul (args[0], 0, 0);
+      if (grub_errno)
+	return grub_errno;
+    }
+
+  start = grub_get_time_ms ();
+  for (i = 0; i < lines; i++)
+    {
+      /* Cycle through the printable ASCII characters.  */
+      for (j = 0; j < BENCH_LINE_LENGTH; j++)
+	line[j] = '!' + (i + j) % ('~' - '!' + 1);
+      line[BENCH_LINE_LENGTH] = 0;
+      grub_printf ("%s\n", line);
+    }
+  grub_refresh ();
+  elapsed = grub_get_time_ms () - start;
+  if (!elapsed)
+    elapsed = 1;
+
+  grub_printf_ (N_("%u lines in %u ms, %u lines/s, %u characters/s\n"),
+		lines, (unsigned) elapsed,
+		(unsigned) grub_divmod64 (lines * 1000ULL, elapsed, 0),
+		(unsigned) grub_divmod64 (lines * 1000ULL
+					  * (BENCH_LINE_LENGTH + 1),
+					  elapsed, 0));
+  return GRUB_ERR_NONE;
+}
+
+static grub_command_t cmd, cmd_text;
+
+GRUB_MOD_INIT(videobench)
+{
+  cmd_text = grub_register_command ("textbench", grub_cmd_textbench,
+				    N_("[LINES]"),
+				    N_("Measure terminal output speed."));
+  cmd = grub_register_command ("videobench", grub_cmd_videobench,
+			       /* TRANSLATORS: "x" has to be entered in,
+				  like an identifier, so please don't
+				  use better Unicode codepoints.  */
+			       N_("[WxH]"),
+			       N_("Measure drawing speed in mode WxH."));
+}
+
+GRUB_MOD_FINI(videobench)
+{
+  grub_unregister_command (cmd);
+  grub_unregister_command (cmd_text);
+}
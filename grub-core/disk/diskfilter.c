@@ -575,9 +575,58 @@ validate_segment (struct grub_diskfilter_segment *seg)
 
 }
 
+/* Find the member disk DISKNR and the parity disk P holding array sector
+   SECTOR of a RAID4/5/6 segment.  Return the start of the stripe on the
+   member disk and store the offset into the stripe in B.  */
+static grub_disk_addr_t
+raid456_locate (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+		grub_uint64_t *b, grub_uint64_t *disknr, grub_uint64_t *p)
+{
+  grub_disk_addr_t read_sector;
+  grub_uint64_t n;
+
+  /* n = 1 for level 4 and 5, 2 for level 6.  */
+  n = seg->type / 3;
+
+  read_sector = grub_divmod64 (sector, seg->stripe_size, b);
+  read_sector = grub_divmod64 (read_sector, seg->node_count - n, disknr);
+  if (seg->type >= 5)
+    {
+      grub_divmod64 (read_sector, seg->node_count, p);
+
+      if (! (seg->layout & GRUB_RAID_LAYOUT_RIGHT_MASK))
+	*p = seg->node_count - 1 - *p;
+
+      if (seg->layout & GRUB_RAID_LAYOUT_SYMMETRIC_MASK)
+	{
+	  *disknr += *p + n;
+	}
+      else
+	{
+	  grub_uint32_t q;
+
+	  q = *p + (n - 1);
+	  if (q >= seg->node_count)
+	    q -= seg->node_count;
+
+	  if (*disknr >= *p)
+	    *disknr += n;
+	  else if (*disknr >= q)
+	    *disknr += q + 1;
+	}
+
+      if (*disknr >= seg->node_count)
+	*disknr -= seg->node_count;
+    }
+  else
+    *p = seg->node_count - n;
+
+  return read_sector * seg->stripe_size;
+}
+
 static grub_err_t
-read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
-	      grub_size_t size, char *buf)
+read_segment_chunks (struct grub_diskfilter_segment *seg,
+		     grub_disk_addr_t sector, grub_size_t size, char *buf)
 {
   grub_err_t err;
   switch (seg->type)
@@ -699,40 +748,7 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	n = seg->type / 3;
 
 	/* Find the first sector to read. */
-	read_sector = grub_divmod64 (sector, seg->stripe_size, &b);
-	read_sector = grub_divmod64 (read_sector, seg->node_count - n,
-				     &disknr);
-	if (seg->type >= 5)
-	  {
-	    grub_divmod64 (read_sector, seg->node_count, &p);
-
-	    if (! (seg->layout & GRUB_RAID_LAYOUT_RIGHT_MASK))
-	      p = seg->node_count - 1 - p;
-
-	    if (seg->layout & GRUB_RAID_LAYOUT_SYMMETRIC_MASK)
-	      {
-		disknr += p + n;
-	      }
-	    else
-	      {
-		grub_uint32_t q;
-
-		q = p + (n - 1);
-		if (q >= seg->node_count)
-		  q -= seg->node_count;
-
-		if (disknr >= p)
-		  disknr += n;
-		else if (disknr >= q)
-		  disknr += q + 1;
-	      }
-
-	    if (disknr >= seg->node_count)
-	      disknr -= seg->node_count;
-	  }
-	else
-	  p = seg->node_count - n;
-	read_sector *= seg->stripe_size;
+	read_sector = raid456_locate (seg, sector, &b, &disknr, &p);
 
 	while (1)
 	  {
@@ -811,37 +827,11 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 		next_level = (disknr >= seg->node_count);
 	      }
 
+	    /* Locate the next row afresh rather than rotating the parity
+	       by hand, which misplaced the first data disk of some rows
+	       in the asymmetric RAID6 layouts.  */
 	    if (next_level)
-	      {
-		read_sector += seg->stripe_size;
-
-		if (seg->type >= 5)
-		  {
-		    if (seg->layout & GRUB_RAID_LAYOUT_RIGHT_MASK)
-		      p = (p == seg->node_count - 1) ? 0 : p + 1;
-		    else
-		      p = (p == 0) ? seg->node_count - 1 : p - 1;
-
-		    if (seg->layout & GRUB_RAID_LAYOUT_SYMMETRIC_MASK)
-		      {
-			disknr = p + n;
-			if (disknr >= seg->node_count)
-			  disknr -= seg->node_count;
-		      }
-		    else
-		      {
-			disknr -= seg->node_count;
-			if ((disknr >= p && disknr < p + n)
-			    || (disknr + seg->node_count >= p
-				&& disknr + seg->node_count < p + n))
-			  disknr = p + n;
-			if (disknr >= seg->node_count)
-			  disknr -= seg->node_count;
-		      }
-		  }
-		else
-		  disknr = 0;
-	      }
+	      read_sector = raid456_locate (seg, sector, &b, &disknr, &p);
 	  }
       }   
       return GRUB_ERR_NONE;
@@ -851,6 +841,177 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
     }
 }
 
+/* Longest contiguous run read from one member disk at once, in sectors.  */
+#define RUN_MAX_SECTORS (1 << (20 - GRUB_DISK_SECTOR_BITS))
+
+static int
+runs_supported (struct grub_diskfilter_segment *seg)
+{
+  switch (seg->type)
+    {
+    case GRUB_DISKFILTER_STRIPED:
+      return seg->node_count > 1;
+    case GRUB_DISKFILTER_RAID10:
+      /* The offset layout interleaves the far copies with the data.  */
+      return (seg->layout >> 16) == 0;
+    case GRUB_DISKFILTER_RAID4:
+    case GRUB_DISKFILTER_RAID5:
+    case GRUB_DISKFILTER_RAID6:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+/* Find the member disk DISKNR and the sector MEMBER_SECTOR on it holding
+   array sector SECTOR, ignoring redundancy.  Return the number of sectors
+   left in that stripe.  */
+static grub_size_t
+locate_chunk (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	      unsigned int *disknr, grub_disk_addr_t *member_sector)
+{
+  grub_uint64_t b, d, p;
+
+  switch (seg->type)
+    {
+    case GRUB_DISKFILTER_STRIPED:
+    case GRUB_DISKFILTER_RAID10:
+      {
+	grub_uint64_t near = 1, row;
+
+	if (seg->type == GRUB_DISKFILTER_RAID10)
+	  near = seg->layout & 0xFF;
+	row = grub_divmod64 (sector, seg->stripe_size, &b);
+	row = grub_divmod64 (row * near, seg->node_count, &d);
+	*member_sector = row * seg->stripe_size + b;
+	break;
+      }
+
+    default:
+      *member_sector = raid456_locate (seg, sector, &b, &d, &p) + b;
+      break;
+    }
+
+  *disknr = d;
+  return seg->stripe_size - b;
+}
+
+/* Read a request spanning many stripes with a single request per member
+   disk and batch, instead of one request per stripe.  A batch which hits
+   a missing or failing member is read again chunk by chunk, so that
+   mirror failover and parity recovery still apply.  */
+static grub_err_t
+read_segment_runs (struct grub_diskfilter_segment *seg,
+		   grub_disk_addr_t sector, grub_size_t size, char *buf)
+{
+  grub_disk_addr_t *run_start, *run_end;
+  grub_size_t bounce_size;
+  char *bounce;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  bounce_size = RUN_MAX_SECTORS;
+  if (bounce_size < seg->stripe_size)
+    bounce_size = seg->stripe_size;
+
+  run_start = grub_malloc (2 * seg->node_count * sizeof (run_start[0]));
+  bounce = grub_malloc (bounce_size << GRUB_DISK_SECTOR_BITS);
+  if (!run_start || !bounce)
+    {
+      grub_free (run_start);
+      grub_free (bounce);
+      grub_errno = GRUB_ERR_NONE;
+      return read_segment_chunks (seg, sector, size, buf);
+    }
+  run_end = run_start + seg->node_count;
+
+  while (size)
+    {
+      grub_size_t batch, done, len;
+      grub_disk_addr_t member, start, end;
+      unsigned int disknr, d;
+
+      /* An empty run has its end at 0.  */
+      for (disknr = 0; disknr < seg->node_count; disknr++)
+	run_end[disknr] = 0;
+
+      /* Extend the batch while every member run fits the bounce buffer.
+	 The first chunk always fits.  */
+      for (batch = 0; batch < size; batch += len)
+	{
+	  len = locate_chunk (seg, sector + batch, &disknr, &member);
+	  if (len > size - batch)
+	    len = size - batch;
+
+	  start = member;
+	  end = member + len;
+	  if (run_end[disknr])
+	    {
+	      if (run_start[disknr] < start)
+		start = run_start[disknr];
+	      if (run_end[disknr] > end)
+		end = run_end[disknr];
+	    }
+	  if (end - start > bounce_size)
+	    break;
+
+	  run_start[disknr] = start;
+	  run_end[disknr] = end;
+	}
+
+      for (disknr = 0; disknr < seg->node_count; disknr++)
+	{
+	  if (!run_end[disknr])
+	    continue;
+
+	  err = grub_diskfilter_read_node (&seg->nodes[disknr],
+					   run_start[disknr],
+					   run_end[disknr] - run_start[disknr],
+					   bounce);
+	  if (err)
+	    break;
+
+	  for (done = 0; done < batch; done += len)
+	    {
+	      len = locate_chunk (seg, sector + done, &d, &member);
+	      if (len > batch - done)
+		len = batch - done;
+	      if (d != disknr)
+		continue;
+	      grub_memcpy (buf + (done << GRUB_DISK_SECTOR_BITS),
+			   bounce + ((member - run_start[disknr])
+				     << GRUB_DISK_SECTOR_BITS),
+			   len << GRUB_DISK_SECTOR_BITS);
+	    }
+	}
+
+      if (err == GRUB_ERR_READ_ERROR || err == GRUB_ERR_UNKNOWN_DEVICE)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  err = read_segment_chunks (seg, sector, batch, buf);
+	}
+      if (err)
+	break;
+
+      buf += batch << GRUB_DISK_SECTOR_BITS;
+      size -= batch;
+      sector += batch;
+    }
+
+  grub_free (run_start);
+  grub_free (bounce);
+  return err;
+}
+
+static grub_err_t
+read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	      grub_size_t size, char *buf)
+{
+  /* Only worth it when some member holds more than one chunk.  */
+  if (runs_supported (seg) && size > seg->stripe_size * seg->node_count)
+    return read_segment_runs (seg, sector, size, buf);
+  return read_segment_chunks (seg, sector, size, buf);
+}
+
 static grub_err_t
 read_lv (struct grub_diskfilter_lv *lv, grub_disk_addr_t sector,
 	 grub_size_t size, char *buf)
@@ -46,11 +46,61 @@ struct char_index_entry
   grub_uint32_t code;
   grub_uint8_t storage_flags;
   grub_uint32_t offset;
+};
+
+/* Number of character index entries read from the font file at once.  */
+#define FONT_INDEX_PAGE_SIZE 128
+/* Number of character index pages kept in memory for every font.  */
+#define FONT_INDEX_PAGES 8
+/* Number of glyphs kept in memory for every font.  Glyph pointers
+   returned by this module stay valid until this many other glyphs of the
+   same font have been looked up.  */
+#define FONT_GLYPH_CACHE_SIZE 1024
+#define FONT_GLYPH_HASH_SIZE 256
+
+/* Marks the first code point of index pages which haven't been read.  */
+#define FONT_INDEX_CODE_UNKNOWN 0xffffffff
+
+struct font_index_page
+{
+  /* Number of this page in the character index.  */
+  grub_uint32_t page;
+  grub_uint32_t last_used;
+  unsigned count;
+  struct char_index_entry entries[FONT_INDEX_PAGE_SIZE];
+};
 
-  /* Glyph if loaded, or NULL otherwise.  */
+struct font_glyph_entry
+{
+  struct font_glyph_entry *hash_next;
+  struct font_glyph_entry *lru_prev;
+  struct font_glyph_entry *lru_next;
+  grub_uint32_t code;
+  /* NULL if the font has no glyph for CODE.  */
   struct grub_font_glyph *glyph;
 };
 
+struct font_index
+{
+  /* Position of the character index (CHIX) contents in the font file.  */
+  grub_off_t offset;
+
+  /* First code point of every index page, to find the page holding a code
+     point without reading the index.  */
+  grub_uint32_t num_pages;
+  grub_uint32_t *first_code;
+
+  /* Recently used index pages.  */
+  struct font_index_page *pages[FONT_INDEX_PAGES];
+  grub_uint32_t clock;
+
+  /* Loaded glyphs, most recently used first.  */
+  struct font_glyph_entry *hash[FONT_GLYPH_HASH_SIZE];
+  struct font_glyph_entry *lru_first;
+  struct font_glyph_entry *lru_last;
+  unsigned num_glyphs;
+};
+
 #define FONT_WEIGHT_NORMAL 100
 #define FONT_WEIGHT_BOLD 200
 #define ASCII_BITMAP_SIZE 16
@@ -204,8 +254,7 @@ font_init (grub_font_t font)
   font->ascent = 0;
   font->descent = 0;
   font->num_chars = 0;
-  font->char_index = 0;
-  font->bmp_idx = 0;
+  font->index = 0;
 }
 
 /* Open the next section in the file.
@@ -263,17 +312,17 @@ open_section (grub_file_t file, struct font_file_section *section)
    entry in the font file.  */
 #define FONT_CHAR_INDEX_ENTRY_SIZE (4 + 1 + 4)
 
-/* Load the character index (CHIX) section contents from the font file.  This
-   presumes that the position of FILE is positioned immediately after the
-   section length for the CHIX section (i.e., at the start of the section
-   contents).  Returns 0 upon success, nonzero for failure (in which case
-   grub_errno is set appropriately).  */
+/* Set up the character index (CHIX) of the font.  This presumes that the
+   position of FILE is positioned immediately after the section length for
+   the CHIX section (i.e., at the start of the section contents).  The index
+   itself is read in pages when glyphs are looked up, so only its position
+   is recorded here.  Returns 0 upon success, nonzero for failure (in which
+   case grub_errno is set appropriately).  */
 static int
 load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 		 grub_font *font)
 {
-  unsigned i;
-  grub_uint32_t last_code;
+  struct font_index *index;
 
 #if FONT_DEBUG >= 2
   grub_dprintf ("font", "load_font_index(sect_length=%d)\n", sect_length);
@@ -292,65 +341,28 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
   /* Calculate the number of characters.  */
   font->num_chars = sect_length / FONT_CHAR_INDEX_ENTRY_SIZE;
 
-  /* Allocate the character index array.  */
-  font->char_index = grub_malloc (font->num_chars
-				  * sizeof (struct char_index_entry));
-  if (!font->char_index)
-    return 1;
-  font->bmp_idx = grub_malloc (0x10000 * sizeof (grub_uint16_t));
-  if (!font->bmp_idx)
-    return 1;
-  grub_memset (font->bmp_idx, 0xff, 0x10000 * sizeof (grub_uint16_t));
-
-
 #if FONT_DEBUG >= 2
   grub_dprintf ("font", "num_chars=%d)\n", font->num_chars);
 #endif
 
-  last_code = 0;
-
-  /* Load the character index data from the file.  */
-  for (i = 0; i < font->num_chars; i++)
-    {
-      struct char_index_entry *entry = &font->char_index[i];
-
-      /* Read code point value; convert to native byte order.  */
-      if (grub_file_read (file, &entry->code, 4) != 4)
-	return 1;
-      entry->code = grub_be_to_cpu32 (entry->code);
-
-      /* Verify that characters are in ascending order.  */
-      if (i != 0 && entry->code <= last_code)
-	{
-	  grub_error (GRUB_ERR_BAD_FONT,
-		      "font characters not in ascending order: %u <= %u",
-		      entry->code, last_code);
-	  return 1;
-	}
-
-      if (entry->code < 0x10000)
-	font->bmp_idx[entry->code] = i;
-
-      last_code = entry->code;
-
-      /* Read storage flags byte.  */
-      if (grub_file_read (file, &entry->storage_flags, 1) != 1)
-	return 1;
-
-      /* Read glyph data offset; convert to native byte order.  */
-      if (grub_file_read (file, &entry->offset, 4) != 4)
-	return 1;
-      entry->offset = grub_be_to_cpu32 (entry->offset);
-
-      /* No glyph loaded.  Will be loaded on demand and cached thereafter.  */
-      entry->glyph = 0;
+  index = grub_zalloc (sizeof (*index));
+  if (!index)
+    return 1;
+  font->index = index;
+
+  index->offset = grub_file_tell (file);
+  index->num_pages = ((font->num_chars + FONT_INDEX_PAGE_SIZE - 1)
+		      / FONT_INDEX_PAGE_SIZE);
+  index->first_code = grub_malloc (index->num_pages
+				   * sizeof (index->first_code[0]));
+  if (!index->first_code)
+    return 1;
+  grub_memset (index->first_code, 0xff,
+	       index->num_pages * sizeof (index->first_code[0]));
 
-#if FONT_DEBUG >= 5
-      /* Print the 1st 10 characters.  */
-      if (i < 10)
-	grub_dprintf ("font", "c=%d o=%d\n", entry->code, entry->offset);
-#endif
-    }
+  /* Skip the index contents.  */
+  if ((int) grub_file_seek (file, index->offset + sect_length) == -1)
+    return 1;
 
   return 0;
 }
@@ -629,7 +641,7 @@ grub_font_load (const char *filename)
   if (font->max_char_width == 0
       || font->max_char_height == 0
       || font->num_chars == 0
-      || font->char_index == 0 || font->ascent == 0 || font->descent == 0)
+      || font->index == 0 || font->ascent == 0 || font->descent == 0)
     {
       grub_error (GRUB_ERR_BAD_FONT,
 		  "invalid font file: missing some required data");
@@ -671,127 +683,326 @@ read_be_int16 (grub_file_t file, grub_int16_t * value)
   return read_be_uint16 (file, (grub_uint16_t *) value);
 }
 
-/* Return a pointer to the character index entry for the glyph corresponding to
-   the codepoint CODE in the font FONT.  If not found, return zero.  */
-static inline struct char_index_entry *
-find_glyph (const grub_font_t font, grub_uint32_t code)
+/* Read the first code point of index page PAGE of FONT.
+   Returns 0 upon success, nonzero upon failure.  */
+static int
+read_page_first_code (grub_font_t font, grub_uint32_t page,
+		      grub_uint32_t *code)
+{
+  struct font_index *index = font->index;
+
+  if (index->first_code[page] == FONT_INDEX_CODE_UNKNOWN)
+    {
+      grub_uint32_t raw_code;
+
+      grub_file_seek (font->file, index->offset + (grub_off_t) page
+		      * FONT_INDEX_PAGE_SIZE * FONT_CHAR_INDEX_ENTRY_SIZE);
+      if (grub_file_read (font->file, &raw_code, 4) != 4)
+	return 1;
+      index->first_code[page] = grub_be_to_cpu32 (raw_code);
+    }
+
+  *code = index->first_code[page];
+  return 0;
+}
+
+/* Return index page PAGE of FONT, reading it from the font file in place of
+   the least recently used page if it isn't loaded.  Returns 0 on failure.  */
+static struct font_index_page *
+load_index_page (grub_font_t font, grub_uint32_t page)
 {
-  struct char_index_entry *table;
-  grub_size_t lo;
-  grub_size_t hi;
-  grub_size_t mid;
+  struct font_index *index = font->index;
+  struct font_index_page *p;
+  grub_uint8_t raw[FONT_INDEX_PAGE_SIZE * FONT_CHAR_INDEX_ENTRY_SIZE];
+  grub_uint8_t *ptr;
+  unsigned i, slot = 0;
 
-  table = font->char_index;
+  for (i = 0; i < FONT_INDEX_PAGES; i++)
+    {
+      p = index->pages[i];
+      if (!p)
+	{
+	  slot = i;
+	  break;
+	}
+      if (p->page == page)
+	{
+	  p->last_used = ++index->clock;
+	  return p;
+	}
+      if (p->last_used < index->pages[slot]->last_used)
+	slot = i;
+    }
 
-  /* Use BMP index if possible.  */
-  if (code < 0x10000 && font->bmp_idx)
+  p = index->pages[slot];
+  if (!p)
     {
-      if (font->bmp_idx[code] == 0xffff)
+      p = grub_malloc (sizeof (*p));
+      if (!p)
 	return 0;
-      return &table[font->bmp_idx[code]];
+      index->pages[slot] = p;
     }
+  /* Invalid until read completely.  */
+  p->page = index->num_pages;
+  p->last_used = ++index->clock;
+
+  p->count = font->num_chars - page * FONT_INDEX_PAGE_SIZE;
+  if (p->count > FONT_INDEX_PAGE_SIZE)
+    p->count = FONT_INDEX_PAGE_SIZE;
+
+  grub_file_seek (font->file, index->offset + (grub_off_t) page
+		  * FONT_INDEX_PAGE_SIZE * FONT_CHAR_INDEX_ENTRY_SIZE);
+  if (grub_file_read (font->file, raw, p->count * FONT_CHAR_INDEX_ENTRY_SIZE)
+      != (grub_ssize_t) (p->count * FONT_CHAR_INDEX_ENTRY_SIZE))
+    return 0;
 
-  /* Do a binary search in `char_index', which is ordered by code point.  */
-  lo = 0;
-  hi = font->num_chars - 1;
+  for (i = 0, ptr = raw; i < p->count; i++, ptr += FONT_CHAR_INDEX_ENTRY_SIZE)
+    {
+      struct char_index_entry *entry = &p->entries[i];
+
+      entry->code = grub_be_to_cpu32 (grub_get_unaligned32 (ptr));
+      entry->storage_flags = ptr[4];
+      entry->offset = grub_be_to_cpu32 (grub_get_unaligned32 (ptr + 5));
+
+      /* Verify that characters are in ascending order.  */
+      if (i != 0 && entry->code <= p->entries[i - 1].code)
+	{
+	  grub_error (GRUB_ERR_BAD_FONT,
+		      "font characters not in ascending order: %u <= %u",
+		      entry->code, p->entries[i - 1].code);
+	  return 0;
+	}
+    }
+
+  index->first_code[page] = p->entries[0].code;
+  p->page = page;
+  return p;
+}
+
+/* Find the character index entry for the glyph corresponding to the
+   codepoint CODE in the font FONT and store it in *ENTRY.  Returns 1 if
+   found, 0 if not found and -1 on read errors.  */
+static int
+find_glyph (const grub_font_t font, grub_uint32_t code,
+	    struct char_index_entry *entry)
+{
+  struct font_index_page *page;
+  grub_uint32_t first;
+  grub_size_t lo;
+  grub_size_t hi;
+  grub_size_t mid;
 
-  if (!table)
+  if (read_page_first_code (font, 0, &first))
+    return -1;
+  if (code < first)
     return 0;
 
-  while (lo <= hi)
+  /* Do a binary search for the last page starting at or below CODE.  Only
+     the first code point of the pages visited is read.  */
+  lo = 0;
+  hi = font->index->num_pages;
+  while (hi - lo > 1)
     {
       mid = lo + (hi - lo) / 2;
-      if (code < table[mid].code)
-	hi = mid - 1;
-      else if (code > table[mid].code)
+      if (read_page_first_code (font, mid, &first))
+	return -1;
+      if (code < first)
+	hi = mid;
+      else
+	lo = mid;
+    }
+
+  page = load_index_page (font, lo);
+  if (!page)
+    return -1;
+
+  /* Do a binary search in the page, which is ordered by code point.  */
+  lo = 0;
+  hi = page->count;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (code < page->entries[mid].code)
+	hi = mid;
+      else if (code > page->entries[mid].code)
 	lo = mid + 1;
       else
-	return &table[mid];
+	{
+	  *entry = page->entries[mid];
+	  return 1;
+	}
     }
 
   return 0;
 }
 
+static inline unsigned
+glyph_hash (grub_uint32_t code)
+{
+  return (code ^ (code >> 8)) % FONT_GLYPH_HASH_SIZE;
+}
+
+/* Move E to the front of the glyph LRU list of INDEX.  */
+static void
+glyph_cache_touch (struct font_index *index, struct font_glyph_entry *e)
+{
+  if (e == index->lru_first)
+    return;
+
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else if (e->lru_prev)
+    index->lru_last = e->lru_prev;
+
+  e->lru_prev = 0;
+  e->lru_next = index->lru_first;
+  if (index->lru_first)
+    index->lru_first->lru_prev = e;
+  index->lru_first = e;
+  if (!index->lru_last)
+    index->lru_last = e;
+}
+
+/* Return a glyph cache entry for CODE in INDEX, evicting the least recently
+   used glyph if the cache is full.  Returns 0 if out of memory.  */
+static struct font_glyph_entry *
+glyph_cache_new (struct font_index *index, grub_uint32_t code)
+{
+  struct font_glyph_entry *e, **prev;
+
+  if (index->num_glyphs < FONT_GLYPH_CACHE_SIZE)
+    {
+      e = grub_zalloc (sizeof (*e));
+      if (!e)
+	return 0;
+      index->num_glyphs++;
+    }
+  else
+    {
+      e = index->lru_last;
+      prev = &index->hash[glyph_hash (e->code)];
+      while (*prev != e)
+	prev = &(*prev)->hash_next;
+      *prev = e->hash_next;
+      grub_free (e->glyph);
+    }
+
+  e->code = code;
+  e->glyph = 0;
+  e->hash_next = index->hash[glyph_hash (code)];
+  index->hash[glyph_hash (code)] = e;
+  glyph_cache_touch (index, e);
+
+  return e;
+}
+
 /* Get a glyph for the Unicode character CODE in FONT.  The glyph is loaded
-   from the font file if has not been loaded yet.
+   from the font file if it is not in the font's glyph cache.
    Returns a pointer to the glyph if found, or 0 if it is not found.  */
 static struct grub_font_glyph *
 grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
 {
-  struct char_index_entry *index_entry;
+  struct font_index *index = font->index;
+  struct font_glyph_entry *cached;
+  struct char_index_entry index_entry;
+  struct grub_font_glyph *glyph = 0;
+  grub_uint16_t width;
+  grub_uint16_t height;
+  grub_int16_t xoff;
+  grub_int16_t yoff;
+  grub_int16_t dwidth;
+  int len;
+  int found;
+
+  if (!index)
+    return 0;
 
-  index_entry = find_glyph (font, code);
-  if (index_entry)
-    {
-      struct grub_font_glyph *glyph = 0;
-      grub_uint16_t width;
-      grub_uint16_t height;
-      grub_int16_t xoff;
-      grub_int16_t yoff;
-      grub_int16_t dwidth;
-      int len;
-
-      if (index_entry->glyph)
+  for (cached = index->hash[glyph_hash (code)]; cached;
+       cached = cached->hash_next)
+    if (cached->code == code)
+      {
 	/* Return cached glyph.  */
-	return index_entry->glyph;
+	glyph_cache_touch (index, cached);
+	return cached->glyph;
+      }
 
-      if (!font->file)
-	/* No open file, can't load any glyphs.  */
-	return 0;
+  if (!font->file)
+    /* No open file, can't load any glyphs.  */
+    return 0;
 
-      /* Make sure we can find glyphs for error messages.  Push active
-         error message to error stack and reset error message.  */
-      grub_error_push ();
+  /* Make sure we can find glyphs for error messages.  Push active
+     error message to error stack and reset error message.  */
+  grub_error_push ();
 
-      grub_file_seek (font->file, index_entry->offset);
+  found = find_glyph (font, code, &index_entry);
+  if (found < 0)
+    {
+      remove_font (font);
+      return 0;
+    }
 
-      /* Read the glyph width, height, and baseline.  */
-      if (read_be_uint16 (font->file, &width) != 0
-	  || read_be_uint16 (font->file, &height) != 0
-	  || read_be_int16 (font->file, &xoff) != 0
-	  || read_be_int16 (font->file, &yoff) != 0
-	  || read_be_int16 (font->file, &dwidth) != 0)
-	{
-	  remove_font (font);
-	  return 0;
-	}
+  cached = glyph_cache_new (index, code);
+  if (!cached)
+    {
+      grub_error_pop ();
+      return 0;
+    }
 
-      len = (width * height + 7) / 8;
-      glyph = grub_malloc (sizeof (struct grub_font_glyph) + len);
-      if (!glyph)
-	{
-	  remove_font (font);
-	  return 0;
-	}
+  if (!found)
+    {
+      /* Remember that the font has no such glyph.  */
+      grub_error_pop ();
+      return 0;
+    }
 
-      glyph->font = font;
-      glyph->width = width;
-      glyph->height = height;
-      glyph->offset_x = xoff;
-      glyph->offset_y = yoff;
-      glyph->device_width = dwidth;
+  grub_file_seek (font->file, index_entry.offset);
 
-      /* Don't try to read empty bitmaps (e.g., space characters).  */
-      if (len != 0)
-	{
-	  if (grub_file_read (font->file, glyph->bitmap, len) != len)
-	    {
-	      remove_font (font);
-	      grub_free (glyph);
-	      return 0;
-	    }
-	}
+  /* Read the glyph width, height, and baseline.  */
+  if (read_be_uint16 (font->file, &width) != 0
+      || read_be_uint16 (font->file, &height) != 0
+      || read_be_int16 (font->file, &xoff) != 0
+      || read_be_int16 (font->file, &yoff) != 0
+      || read_be_int16 (font->file, &dwidth) != 0)
+    {
+      remove_font (font);
+      return 0;
+    }
 
-      /* Restore old error message.  */
-      grub_error_pop ();
+  len = (width * height + 7) / 8;
+  glyph = grub_malloc (sizeof (struct grub_font_glyph) + len);
+  if (!glyph)
+    {
+      remove_font (font);
+      return 0;
+    }
 
-      /* Cache the glyph.  */
-      index_entry->glyph = glyph;
+  glyph->font = font;
+  glyph->width = width;
+  glyph->height = height;
+  glyph->offset_x = xoff;
+  glyph->offset_y = yoff;
+  glyph->device_width = dwidth;
 
-      return glyph;
+  /* Don't try to read empty bitmaps (e.g., space characters).  */
+  if (len != 0)
+    {
+      if (grub_file_read (font->file, glyph->bitmap, len) != len)
+	{
+	  remove_font (font);
+	  grub_free (glyph);
+	  return 0;
+	}
     }
 
-  return 0;
+  /* Restore old error message.  */
+  grub_error_pop ();
+
+  /* Cache the glyph.  */
+  cached->glyph = glyph;
+
+  return glyph;
 }
 
 /* Free the memory used by FONT.
@@ -807,8 +1018,22 @@ free_font (grub_font_t font)
 	grub_file_close (font->file);
       grub_free (font->name);
       grub_free (font->family);
-      grub_free (font->char_index);
-      grub_free (font->bmp_idx);
+      if (font->index)
+	{
+	  struct font_glyph_entry *e, *next;
+	  unsigned i;
+
+	  for (e = font->index->lru_first; e; e = next)
+	    {
+	      next = e->lru_next;
+	      grub_free (e->glyph);
+	      grub_free (e);
+	    }
+	  for (i = 0; i < FONT_INDEX_PAGES; i++)
+	    grub_free (font->index->pages[i]);
+	  grub_free (font->index->first_code);
+	  grub_free (font->index);
+	}
       grub_free (font);
     }
 }
@@ -182,6 +182,21 @@ struct grub_fat_data
   grub_uint32_t num_clusters;
 
   grub_uint32_t uuid;
+
+  /* Cluster chain last read, decoded lazily into runs of contiguous
+     clusters sorted by logical cluster.  */
+  grub_uint32_t chain_first;
+  int chain_complete;
+  struct grub_fat_extent *extents;
+  unsigned num_extents;
+  unsigned alloc_extents;
+};
+
+struct grub_fat_extent
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t count;
 };
 
 struct grub_fshelp_node {
@@ -191,8 +206,6 @@ struct grub_fshelp_node {
   grub_uint8_t attr;
   grub_ssize_t file_size;
   grub_uint32_t file_cluster;
-  grub_uint32_t cur_cluster_num;
-  grub_uint32_t cur_cluster;
 
 #ifdef MODE_EXFAT
   int is_contiguous;
@@ -230,7 +243,7 @@ grub_fat_mount (grub_disk_t disk)
   if (! disk)
     goto fail;
 
-  data = (struct grub_fat_data *) grub_malloc (sizeof (*data));
+  data = (struct grub_fat_data *) grub_zalloc (sizeof (*data));
   if (! data)
     goto fail;
 
@@ -444,6 +457,156 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+/* Append the cluster following logical cluster LOGICAL to the chain.  */
+static grub_err_t
+grub_fat_add_cluster (struct grub_fat_data *data, grub_uint32_t logical,
+		      grub_uint32_t cluster)
+{
+  struct grub_fat_extent *ext;
+
+  if (data->num_extents)
+    {
+      ext = &data->extents[data->num_extents - 1];
+      if (ext->cluster + ext->count == cluster)
+	{
+	  ext->count++;
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  if (data->num_extents == data->alloc_extents)
+    {
+      unsigned alloc = data->alloc_extents ? 2 * data->alloc_extents : 16;
+
+      ext = grub_realloc (data->extents, alloc * sizeof (*ext));
+      if (!ext)
+	return grub_errno;
+      data->extents = ext;
+      data->alloc_extents = alloc;
+    }
+
+  ext = &data->extents[data->num_extents++];
+  ext->logical = logical;
+  ext->cluster = cluster;
+  ext->count = 1;
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the cluster chain of NODE up to logical cluster LAST, or until
+   its end.  */
+static grub_err_t
+grub_fat_decode_chain (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_uint32_t last)
+{
+  struct grub_fat_data *data = node->data;
+  struct grub_fat_extent *ext;
+  grub_uint32_t cur_cluster, logical;
+
+  if (!data->num_extents || data->chain_first != node->file_cluster)
+    {
+      data->num_extents = 0;
+      data->chain_first = node->file_cluster;
+      data->chain_complete = 0;
+      if (grub_fat_add_cluster (data, 0, node->file_cluster))
+	return grub_errno;
+    }
+
+  ext = &data->extents[data->num_extents - 1];
+  logical = ext->logical + ext->count;
+  cur_cluster = ext->cluster + ext->count - 1;
+
+  while (!data->chain_complete && logical <= last)
+    {
+      /* Find next cluster.  */
+      grub_uint32_t next_cluster;
+      grub_uint32_t fat_offset;
+
+      switch (data->fat_size)
+	{
+	case 32:
+	  fat_offset = cur_cluster << 2;
+	  break;
+	case 16:
+	  fat_offset = cur_cluster << 1;
+	  break;
+	default:
+	  /* case 12: */
+	  fat_offset = cur_cluster + (cur_cluster >> 1);
+	  break;
+	}
+
+      /* Read the FAT.  */
+      if (grub_disk_read (disk, data->fat_sector, fat_offset,
+			  (data->fat_size + 7) >> 3,
+			  (char *) &next_cluster))
+	return grub_errno;
+
+      next_cluster = grub_le_to_cpu32 (next_cluster);
+      switch (data->fat_size)
+	{
+	case 16:
+	  next_cluster &= 0xFFFF;
+	  break;
+	case 12:
+	  if (cur_cluster & 1)
+	    next_cluster >>= 4;
+
+	  next_cluster &= 0x0FFF;
+	  break;
+	}
+
+      grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
+		    data->fat_size, next_cluster);
+
+      /* Check the end.  */
+      if (next_cluster >= data->cluster_eof_mark)
+	{
+	  data->chain_complete = 1;
+	  break;
+	}
+
+      if (next_cluster < 2 || next_cluster >= data->num_clusters)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+			   next_cluster);
+
+      if (grub_fat_add_cluster (data, logical, next_cluster))
+	return grub_errno;
+      cur_cluster = next_cluster;
+      logical++;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Find the decoded run containing logical cluster LOGICAL.  */
+static struct grub_fat_extent *
+grub_fat_find_extent (struct grub_fat_data *data, grub_uint32_t logical)
+{
+  unsigned lo = 0, hi = data->num_extents;
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+      struct grub_fat_extent *ext = &data->extents[mid];
+
+      if (logical < ext->logical)
+	hi = mid;
+      else if (logical - ext->logical >= ext->count)
+	lo = mid + 1;
+      else
+	return ext;
+    }
+  return NULL;
+}
+
+static void
+grub_fat_unmount (struct grub_fat_data *data)
+{
+  if (data)
+    grub_free (data->extents);
+  grub_free (data);
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
@@ -451,9 +614,10 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 {
   grub_size_t size;
   grub_uint32_t logical_cluster;
+  grub_uint64_t last_cluster;
   unsigned logical_cluster_bits;
   grub_ssize_t ret = 0;
-  unsigned long sector;
+  grub_disk_addr_t sector;
 
 #ifndef MODE_EXFAT
   /* This is a special case. FAT12 and FAT16 doesn't have the root directory
@@ -497,79 +661,34 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
   logical_cluster = offset >> logical_cluster_bits;
   offset &= (1ULL << logical_cluster_bits) - 1;
 
-  if (logical_cluster < node->cur_cluster_num)
-    {
-      node->cur_cluster_num = 0;
-      node->cur_cluster = node->file_cluster;
-    }
+  if (len == 0)
+    return 0;
+
+  /* Decode the chain as far as this read reaches.  */
+  last_cluster = ((offset + len - 1) >> logical_cluster_bits) + logical_cluster;
+  if (last_cluster > 0xffffffff)
+    last_cluster = 0xffffffff;
+  if (grub_fat_decode_chain (disk, node, last_cluster))
+    return -1;
 
   while (len)
     {
-      while (logical_cluster > node->cur_cluster_num)
-	{
-	  /* Find next cluster.  */
-	  grub_uint32_t next_cluster;
-	  grub_uint32_t fat_offset;
-
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
+      struct grub_fat_extent *ext;
+      grub_uint32_t skip;
+      grub_uint64_t run;
 
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
-			      (node->data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
-	    return -1;
+      ext = grub_fat_find_extent (node->data, logical_cluster);
+      if (!ext)
+	return ret;
 
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
-	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
-			node->data->fat_size, next_cluster);
-
-	  /* Check the end.  */
-	  if (next_cluster >= node->data->cluster_eof_mark)
-	    return ret;
-
-	  if (next_cluster < 2 || next_cluster >= node->data->num_clusters)
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
-			  next_cluster);
-	      return -1;
-	    }
-
-	  node->cur_cluster = next_cluster;
-	  node->cur_cluster_num++;
-	}
-
-      /* Read the data here.  */
+      /* Read the rest of this run of contiguous clusters at once.  */
+      skip = logical_cluster - ext->logical;
       sector = (node->data->cluster_sector
-		+ ((node->cur_cluster - 2)
+		+ ((grub_disk_addr_t) (ext->cluster + skip - 2)
 		   << node->data->cluster_bits));
-      size = (1 << logical_cluster_bits) - offset;
-      if (size > len)
-	size = len;
+      run = ((grub_uint64_t) (ext->count - skip) << logical_cluster_bits)
+	- offset;
+      size = run > len ? len : run;
 
       disk->read_hook = read_hook;
       disk->read_hook_data = read_hook_data;
@@ -581,7 +700,7 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
       len -= size;
       buf += size;
       ret += size;
-      logical_cluster++;
+      logical_cluster = ext->logical + ext->count;
       offset = 0;
     }
 
@@ -895,7 +1014,6 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	  if (!(*foundnode)->file_cluster)
 	    (*foundnode)->file_cluster = node->data->root_cluster;
 #endif
-	  (*foundnode)->cur_cluster_num = ~0U;
 	  (*foundnode)->data = node->data;
 	  (*foundnode)->disk = node->disk;
 
@@ -936,8 +1054,6 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
     .file_cluster = data->root_cluster,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
 #ifdef MODE_EXFAT
     .is_contiguous = 0,
 #endif
@@ -977,7 +1093,7 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (found != &root)
     grub_free (found);
 
-  grub_free (data);
+  grub_fat_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1004,8 +1120,6 @@ grub_fat_open (grub_file_t file, const char *name)
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
     .file_cluster = data->root_cluster,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
 #ifdef MODE_EXFAT
     .is_contiguous = 0,
 #endif
@@ -1025,7 +1139,7 @@ grub_fat_open (grub_file_t file, const char *name)
   if (found != &root)
     grub_free (found);
 
-  grub_free (data);
+  grub_fat_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1045,7 +1159,7 @@ grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
-  grub_free (node->data);
+  grub_fat_unmount (node->data);
   grub_free (node);
 
   grub_dl_unref (my_mod);
@@ -1064,8 +1178,6 @@ grub_fat_label (grub_device_t device, char **label)
     .disk = disk,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
     .is_contiguous = 0,
   };
 
@@ -1101,7 +1213,7 @@ grub_fat_label (grub_device_t device, char **label)
 				* GRUB_MAX_UTF8_PER_UTF16 + 1);
 	  if (!*label)
 	    {
-	      grub_free (root.data);
+	      grub_fat_unmount (root.data);
 	      return grub_errno;
 	    }
 	  chc = dir.type_specific.volume_label.character_count;
@@ -1113,7 +1225,7 @@ grub_fat_label (grub_device_t device, char **label)
 	}
     }
 
-  grub_free (root.data);
+  grub_fat_unmount (root.data);
   return grub_errno;
 }
 
@@ -1129,8 +1241,6 @@ grub_fat_label (grub_device_t device, char **label)
     .disk = disk,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
   };
 
   *label = 0;
@@ -1160,7 +1270,7 @@ grub_fat_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (root.data);
+  grub_fat_unmount (root.data);
 
   return grub_errno;
 }
@@ -1190,7 +1300,7 @@ grub_fat_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_fat_unmount (data);
 
   return grub_errno;
 }
@@ -1213,7 +1323,7 @@ grub_disk_addr_t
 
   *sec_per_lcn = 1ULL << data->cluster_bits;
 
-  grub_free (data);
+  grub_fat_unmount (data);
   return ret;
 }
 #endif
@@ -241,6 +241,9 @@ struct grub_zfs_data
   grub_uint64_t dnode_end;
   grub_zfs_endian_t dnode_endian;
 
+  /* cache for the last fat ZAP looked up */
+  struct zap_cache *zap_cache;
+
   dnode_end_t mos;
   dnode_end_t dnode;
   struct subvolume subvol;
@@ -253,6 +256,10 @@ struct grub_zfs_data
   uberblock_t current_uberblock;
 
   grub_uint64_t guid;
+
+  /* alternative copy read_dva currently reads, see read_device */
+  unsigned read_attempt;
+  unsigned read_alternatives;
 };
 
 /* Context for grub_zfs_dir.  */
@@ -1449,9 +1456,20 @@ recovery (grub_uint8_t *bufs[4], grub_size_t s, const int nbufs,
     }      
 }
 
+/* Mirror reads rotate between children every 1 << MIRROR_BALANCE_SHIFT
+   bytes of offset.  */
+#define MIRROR_BALANCE_SHIFT 20
+
+/*
+ * Read len bytes at offset of desc.  Attempt selects an alternative way of
+ * getting the same data: the mirror child to try first, or the RAID-Z data
+ * column to rebuild from parity instead of reading it.  The number of
+ * alternatives is raised into *alternatives when not NULL.
+ */
 static grub_err_t
 read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
-	     grub_size_t len, void *buf)
+	     grub_size_t len, void *buf, unsigned attempt,
+	     unsigned *alternatives)
 {
   switch (desc->type)
     {
@@ -1471,14 +1489,23 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
     case DEVICE_MIRROR:
       {
 	grub_err_t err = GRUB_ERR_NONE;
-	unsigned i;
+	grub_uint64_t rem;
+	unsigned first, i;
 	if (desc->n_children <= 0)
 	  return grub_error (GRUB_ERR_BAD_FS,
 			     "non-positive number of mirror children");
+	if (alternatives && *alternatives < desc->n_children)
+	  *alternatives = desc->n_children;
+
+	/* Spread reads over all children, failing over to the next.  */
+	grub_divmod64 ((offset >> MIRROR_BALANCE_SHIFT) + attempt,
+		       desc->n_children, &rem);
+	first = rem;
 	for (i = 0; i < desc->n_children; i++)
 	  {
-	    err = read_device (offset, &desc->children[i],
-			       len, buf);
+	    err = read_device (offset,
+			       &desc->children[(first + i) % desc->n_children],
+			       len, buf, attempt, alternatives);
 	    if (!err)
 	      break;
 	    grub_errno = GRUB_ERR_NONE;
@@ -1525,6 +1552,8 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 	else
 	  idx = ((len + (1 << desc->ashift) - 1) >> desc->ashift) - 1;
 	orig_idx = idx;
+	if (alternatives && *alternatives < (unsigned) orig_idx + 2)
+	  *alternatives = orig_idx + 2;
 	while (len > 0)
 	  {
 	    grub_size_t csize;
@@ -1549,10 +1578,13 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 			  PRIxGRUB_UINT64_T ")\n",
 			  offset >> desc->ashift, c, len, bsize, high,
 			  devn);
-	    err = read_device ((high << desc->ashift)
-			       | (offset & ((1 << desc->ashift) - 1)),
-			       &desc->children[devn],
-			       csize, buf);
+	    if (attempt && orig_idx - idx == (int) attempt - 1)
+	      err = GRUB_ERR_READ_ERROR;
+	    else
+	      err = read_device ((high << desc->ashift)
+				 | (offset & ((1 << desc->ashift) - 1)),
+				 &desc->children[devn],
+				 csize, buf, 0, NULL);
 	    if (err && failed_devices < desc->nparity)
 	      {
 		recovery_buf[failed_devices] = buf;
@@ -1610,7 +1642,7 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 				   | (offset & ((1 << desc->ashift) - 1)),
 				   &desc->children[devn],
 				   recovery_len[n_redundancy],
-				   recovery_buf[n_redundancy]);
+				   recovery_buf[n_redundancy], 0, NULL);
 		/* Ignore error if we may still have enough devices.  */
 		if (err && n_redundancy + desc->nparity - cur_redundancy_pow - 1
 		    >= failed_devices)
@@ -1694,7 +1726,8 @@ read_dva (const dva_t *dva,
       for (i = 0; i < data->n_devices_attached; i++)
 	if (data->devices_attached[i].id == DVA_GET_VDEV (dva))
 	  {
-	    err = read_device (offset, &data->devices_attached[i], len, buf);
+	    err = read_device (offset, &data->devices_attached[i], len, buf,
+			       data->read_attempt, &data->read_alternatives);
 	    if (!err)
 	      return GRUB_ERR_NONE;
 	    break;
@@ -1838,6 +1871,160 @@ decode_embedded_bp_compressed(const blkptr_t *bp, void *buf)
   return GRUB_ERR_NONE;
 }
 
+/*
+ * Cache of decompressed metadata blocks (dnodes, indirect blocks, ZAPs),
+ * shared by all mounts.  Blocks are never modified in place, so the pool
+ * guid, the block properties and the checksum identify the contents.
+ * Entries are kept in LRU order and evicted once the cache holds more
+ * than ZFS_BLOCK_CACHE_SIZE bytes.
+ */
+#define ZFS_BLOCK_CACHE_SIZE	(2 << 20)
+#define ZFS_BLOCK_CACHE_BUCKETS	64
+
+struct zfs_block_cache_entry
+{
+  struct zfs_block_cache_entry *hash_next;
+  struct zfs_block_cache_entry *lru_next;
+  struct zfs_block_cache_entry *lru_prev;
+  grub_uint64_t guid;
+  grub_uint64_t prop;
+  zio_cksum_t cksum;
+  grub_size_t size;
+  void *data;
+};
+
+static struct zfs_block_cache_entry *block_cache[ZFS_BLOCK_CACHE_BUCKETS];
+static struct zfs_block_cache_entry *block_cache_mru, *block_cache_lru;
+static grub_size_t block_cache_used;
+
+static unsigned
+block_cache_index (const zio_cksum_t *zc)
+{
+  return (zc->zc_word[0] ^ zc->zc_word[1] ^ zc->zc_word[2]
+	  ^ zc->zc_word[3]) % ZFS_BLOCK_CACHE_BUCKETS;
+}
+
+static void
+block_cache_lru_unlink (struct zfs_block_cache_entry *e)
+{
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    block_cache_mru = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    block_cache_lru = e->lru_prev;
+}
+
+static void
+block_cache_lru_push (struct zfs_block_cache_entry *e)
+{
+  e->lru_prev = NULL;
+  e->lru_next = block_cache_mru;
+  if (block_cache_mru)
+    block_cache_mru->lru_prev = e;
+  else
+    block_cache_lru = e;
+  block_cache_mru = e;
+}
+
+static void
+block_cache_evict (struct zfs_block_cache_entry *e)
+{
+  struct zfs_block_cache_entry **p;
+
+  for (p = &block_cache[block_cache_index (&e->cksum)]; *p;
+       p = &(*p)->hash_next)
+    if (*p == e)
+      {
+	*p = e->hash_next;
+	break;
+      }
+  block_cache_lru_unlink (e);
+  block_cache_used -= e->size;
+  grub_free (e->data);
+  grub_free (e);
+}
+
+static void
+block_cache_flush (void)
+{
+  while (block_cache_lru)
+    block_cache_evict (block_cache_lru);
+}
+
+static struct zfs_block_cache_entry *
+block_cache_lookup (grub_uint64_t guid, grub_uint64_t prop,
+		    const zio_cksum_t *zc)
+{
+  struct zfs_block_cache_entry *e;
+
+  for (e = block_cache[block_cache_index (zc)]; e; e = e->hash_next)
+    if (e->guid == guid && e->prop == prop
+	&& ZIO_CHECKSUM_EQUAL (e->cksum, *zc))
+      {
+	block_cache_lru_unlink (e);
+	block_cache_lru_push (e);
+	return e;
+      }
+  return NULL;
+}
+
+static void
+block_cache_insert (grub_uint64_t guid, grub_uint64_t prop,
+		    const zio_cksum_t *zc, const void *buf, grub_size_t size)
+{
+  struct zfs_block_cache_entry *e;
+  unsigned idx;
+
+  e = grub_malloc (sizeof (*e));
+  if (!e)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  e->data = grub_malloc (size);
+  if (!e->data)
+    {
+      grub_free (e);
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_memcpy (e->data, buf, size);
+  e->guid = guid;
+  e->prop = prop;
+  e->cksum = *zc;
+  e->size = size;
+
+  while (block_cache_lru && block_cache_used + size > ZFS_BLOCK_CACHE_SIZE)
+    block_cache_evict (block_cache_lru);
+
+  idx = block_cache_index (zc);
+  e->hash_next = block_cache[idx];
+  block_cache[idx] = e;
+  block_cache_lru_push (e);
+  block_cache_used += size;
+}
+
+/*
+ * Only cache metadata blocks whose block pointer carries a real checksum.
+ * File contents are read once and would just push metadata out.
+ */
+static int
+block_cacheable (grub_uint64_t prop, grub_uint32_t checksum,
+		 grub_size_t lsize)
+{
+  unsigned level = (prop >> 56) & 0x1f;
+  unsigned type = (prop >> 48) & 0xff;
+
+  if (checksum < ZIO_CHECKSUM_FLETCHER_2 || checksum == ZIO_CHECKSUM_ZILOG2)
+    return 0;
+  if (level == 0 && type == DMU_OT_PLAIN_FILE_CONTENTS)
+    return 0;
+  return lsize <= ZFS_BLOCK_CACHE_SIZE / 4;
+}
+
 /*
  * Read in a block of data, verify its checksum, decompress if needed,
  * and put the uncompressed data in buf.
@@ -1851,10 +2038,14 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   char *compbuf = NULL;
   grub_err_t err;
   zio_cksum_t zc = bp->blk_cksum;
+  zio_cksum_t key;
   grub_uint32_t checksum;
+  grub_uint64_t prop;
+  int cacheable = 0;
 
   *buf = NULL;
 
+  prop = grub_zfs_to_cpu64 (bp->blk_prop, endian);
   checksum = (grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 40) & 0xff;
   comp = (grub_zfs_to_cpu64((bp)->blk_prop, endian)>>32) & 0x7f;
   encrypted = ((grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 60) & 3);
@@ -1888,6 +2079,29 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
     return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		       "compression algorithm %s not supported\n", decomp_table[comp].name);
 
+  if (!BP_IS_EMBEDDED(bp) && !encrypted)
+    {
+      int i;
+
+      for (i = 0; i < 4; i++)
+	key.zc_word[i] = grub_zfs_to_cpu64 (zc.zc_word[i], endian);
+      cacheable = block_cacheable (prop, checksum, lsize);
+    }
+  if (cacheable)
+    {
+      struct zfs_block_cache_entry *e;
+
+      e = block_cache_lookup (data->guid, prop, &key);
+      if (e)
+	{
+	  *buf = grub_malloc (lsize);
+	  if (!*buf)
+	    return grub_errno;
+	  grub_memcpy (*buf, e->data, lsize);
+	  return GRUB_ERR_NONE;
+	}
+    }
+
   if (comp != ZIO_COMPRESS_OFF)
     /* It's not really necessary to align to 16, just for safety.  */
     compbuf = grub_malloc (ALIGN_UP (psize, 16));
@@ -1901,7 +2115,28 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
     err = decode_embedded_bp_compressed(bp, compbuf);
   else
     {
-      err = zio_read_data (bp, endian, compbuf, data);
+      unsigned attempt;
+
+      /* On a checksum mismatch try the other mirror children and RAID-Z
+	 reconstructions before giving up.  */
+      for (attempt = 0; ; attempt++)
+	{
+	  data->read_attempt = attempt;
+	  data->read_alternatives = 1;
+	  err = zio_read_data (bp, endian, compbuf, data);
+	  if (!err)
+	    {
+	      err = zio_checksum_verify (zc, checksum, endian,
+					 compbuf, psize);
+	      if (err)
+		grub_dprintf ("zfs", "incorrect checksum\n");
+	    }
+	  if (!err || attempt + 1 >= data->read_alternatives)
+	    break;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+      data->read_attempt = 0;
+
       /* FIXME is it really necessary? */
       if (comp != ZIO_COMPRESS_OFF)
 	grub_memset (compbuf + psize, 0, ALIGN_UP (psize, 16) - psize);
@@ -1913,19 +2148,6 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
       return err;
     }
 
-  if (!BP_IS_EMBEDDED(bp))
-    {
-      err = zio_checksum_verify (zc, checksum, endian,
-			         compbuf, psize);
-      if (err)
-        {
-          grub_dprintf ("zfs", "incorrect checksum\n");
-          grub_free (compbuf);
-          *buf = NULL;
-          return err;
-        }
-    }
-
   if (encrypted)
     {
       if (!grub_zfs_decrypt)
@@ -1992,6 +2214,9 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
 	}
     }
 
+  if (cacheable)
+    block_cache_insert (data->guid, prop, &key, *buf, lsize);
+
   return GRUB_ERR_NONE;
 }
 
@@ -2315,53 +2540,247 @@ zap_verify (zap_phys_t *zap, grub_zfs_endian_t endian)
   return GRUB_ERR_NONE;
 }
 
+/* Number of leaf blocks kept in a struct zap_cache.  */
+#define ZAP_CACHE_LEAVES 8
+
+struct zap_cache_block
+{
+  grub_uint64_t blkid;
+  void *buf;
+  grub_zfs_endian_t endian;
+};
+
+/*
+ * Header, pointer table and recently used leaves of a fat ZAP, so that
+ * repeated lookups in one directory only have to hash the name and search
+ * a leaf which is already in memory.
+ */
+struct zap_cache
+{
+  dnode_end_t dn;
+  zap_phys_t *zap;
+  grub_zfs_endian_t endian;
+  int blksft;
+  grub_uint64_t salt;
+  unsigned ptrtbl_shift;
+  /* External pointer table, read block by block as needed.  */
+  grub_uint64_t ptrtbl_blk;
+  grub_uint64_t ptrtbl_nblks;
+  struct zap_cache_block *ptrtbl;
+  struct zap_cache_block leaves[ZAP_CACHE_LEAVES];
+  unsigned next_leaf;
+};
+
+static void
+zap_cache_free (struct zap_cache *zc)
+{
+  unsigned i;
+
+  if (!zc)
+    return;
+  if (zc->ptrtbl)
+    for (i = 0; i < zc->ptrtbl_nblks; i++)
+      grub_free (zc->ptrtbl[i].buf);
+  grub_free (zc->ptrtbl);
+  for (i = 0; i < ZAP_CACHE_LEAVES; i++)
+    grub_free (zc->leaves[i].buf);
+  grub_free (zc->zap);
+  grub_free (zc);
+}
+
+/*
+ * Set up the cache of fat ZAP zap_dnode from its header block zap, which
+ * the cache takes ownership of.
+ */
+static struct zap_cache *
+zap_cache_new (dnode_end_t * zap_dnode, zap_phys_t * zap,
+	       grub_zfs_endian_t endian)
+{
+  struct zap_cache *zc;
+  int blksft = zfs_log2 (grub_zfs_to_cpu16 (zap_dnode->dn.dn_datablkszsec,
+					    zap_dnode->endian) << DNODE_SHIFT);
+  grub_uint64_t shift, nblks;
+
+  if (zap_verify (zap, endian))
+    {
+      grub_free (zap);
+      return NULL;
+    }
+  if ((1U << blksft) < sizeof (zap_leaf_phys_t))
+    {
+      grub_free (zap);
+      grub_error (GRUB_ERR_BAD_FS, "ZAP leaf is too small");
+      return NULL;
+    }
+
+  shift = grub_zfs_to_cpu64 (zap->zap_ptrtbl.zt_shift, endian);
+  nblks = grub_zfs_to_cpu64 (zap->zap_ptrtbl.zt_numblks, endian);
+  if (nblks == 0)
+    {
+      /* The table is embedded in the second half of the header.  */
+      if (shift > (grub_uint64_t) blksft - 3 - 1)
+	{
+	  grub_free (zap);
+	  grub_error (GRUB_ERR_BAD_FS, "invalid ZAP pointer table");
+	  return NULL;
+	}
+    }
+  else
+    {
+      grub_uint64_t need;
+
+      need = shift > 32 ? 0 : (((1ULL << shift) + (1ULL << (blksft - 3)) - 1)
+			       >> (blksft - 3));
+      if (need == 0 || need > nblks)
+	{
+	  grub_free (zap);
+	  grub_error (GRUB_ERR_BAD_FS, "invalid ZAP pointer table");
+	  return NULL;
+	}
+      nblks = need;
+    }
+
+  zc = grub_zalloc (sizeof (*zc));
+  if (!zc)
+    {
+      grub_free (zap);
+      return NULL;
+    }
+  if (nblks != 0)
+    {
+      zc->ptrtbl = grub_zalloc (nblks * sizeof (zc->ptrtbl[0]));
+      if (!zc->ptrtbl)
+	{
+	  grub_free (zc);
+	  grub_free (zap);
+	  return NULL;
+	}
+    }
+
+  zc->dn = *zap_dnode;
+  zc->zap = zap;
+  zc->endian = endian;
+  zc->blksft = blksft;
+  zc->salt = grub_zfs_to_cpu64 (zap->zap_salt, endian);
+  zc->ptrtbl_shift = shift;
+  zc->ptrtbl_blk = grub_zfs_to_cpu64 (zap->zap_ptrtbl.zt_blk, endian);
+  zc->ptrtbl_nblks = nblks;
+  return zc;
+}
+
+static struct zap_cache *
+zap_cache_get (dnode_end_t * zap_dnode, struct grub_zfs_data *data)
+{
+  struct zap_cache *zc = data->zap_cache;
+
+  if (zc && zc->dn.endian == zap_dnode->endian
+      && grub_memcmp (&zc->dn.dn, &zap_dnode->dn, sizeof (zc->dn.dn)) == 0)
+    return zc;
+  return NULL;
+}
+
+/* Get the leaf block number stored at index idx of the pointer table.  */
+static grub_err_t
+zap_cache_ptr (struct zap_cache *zc, grub_uint64_t idx, grub_uint64_t *blkid,
+	       struct grub_zfs_data *data)
+{
+  struct zap_cache_block *b;
+  int epbs = zc->blksft - 3;
+  grub_err_t err;
+
+  if (zc->ptrtbl_nblks == 0)
+    {
+      *blkid = grub_zfs_to_cpu64 (((grub_uint64_t *) zc->zap)[idx + (1 << (epbs - 1))],
+				  zc->endian);
+      return GRUB_ERR_NONE;
+    }
+
+  b = &zc->ptrtbl[idx >> epbs];
+  if (!b->buf)
+    {
+      err = dmu_read (&zc->dn, zc->ptrtbl_blk + (idx >> epbs), &b->buf,
+		      &b->endian, data);
+      if (err)
+	return err;
+    }
+  *blkid = grub_zfs_to_cpu64 (((grub_uint64_t *) b->buf)[idx & ((1 << epbs) - 1)],
+			      b->endian);
+  return GRUB_ERR_NONE;
+}
+
+/*
+ * Get leaf block blkid.  It stays valid until ZAP_CACHE_LEAVES other
+ * leaves have been read through the same cache.
+ */
+static grub_err_t
+zap_cache_leaf (struct zap_cache *zc, grub_uint64_t blkid,
+		zap_leaf_phys_t **l, grub_zfs_endian_t *endian,
+		struct grub_zfs_data *data)
+{
+  struct zap_cache_block *b;
+  unsigned i;
+  grub_err_t err;
+
+  for (i = 0; i < ZAP_CACHE_LEAVES; i++)
+    if (zc->leaves[i].buf && zc->leaves[i].blkid == blkid)
+      break;
+
+  if (i == ZAP_CACHE_LEAVES)
+    {
+      b = &zc->leaves[zc->next_leaf];
+      zc->next_leaf = (zc->next_leaf + 1) % ZAP_CACHE_LEAVES;
+      grub_free (b->buf);
+      b->buf = NULL;
+      err = dmu_read (&zc->dn, blkid, &b->buf, &b->endian, data);
+      if (err)
+	return err;
+      b->blkid = blkid;
+    }
+  else
+    b = &zc->leaves[i];
+
+  *l = b->buf;
+  *endian = b->endian;
+  return GRUB_ERR_NONE;
+}
+
 /*
  * Fat ZAP lookup
  *
  */
-/* XXX */
 static grub_err_t
-fzap_lookup (dnode_end_t * zap_dnode, zap_phys_t * zap,
-	     const char *name, grub_uint64_t * value,
+fzap_lookup (struct zap_cache *zc, const char *name, grub_uint64_t * value,
 	     struct grub_zfs_data *data, int case_insensitive)
 {
-  void *l;
+  zap_leaf_phys_t *l;
   grub_uint64_t hash, idx, blkid;
-  int blksft = zfs_log2 (grub_zfs_to_cpu16 (zap_dnode->dn.dn_datablkszsec, 
-					    zap_dnode->endian) << DNODE_SHIFT);
   grub_err_t err;
   grub_zfs_endian_t leafendian;
 
-  err = zap_verify (zap, zap_dnode->endian);
-  if (err)
-    return err;
-
-  hash = zap_hash (zap->zap_salt, name, case_insensitive);
+  hash = zap_hash (zc->salt, name, case_insensitive);
 
   /* get block id from index */
-  if (zap->zap_ptrtbl.zt_numblks != 0)
-    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, 
-		       "external pointer tables not supported");
-  idx = ZAP_HASH_IDX (hash, zap->zap_ptrtbl.zt_shift);
-  blkid = grub_zfs_to_cpu64 (((grub_uint64_t *) zap)[idx + (1 << (blksft - 3 - 1))], zap_dnode->endian);
+  idx = ZAP_HASH_IDX (hash, zc->ptrtbl_shift);
+  err = zap_cache_ptr (zc, idx, &blkid, data);
+  if (err)
+    return err;
 
   /* Get the leaf block */
-  if ((1U << blksft) < sizeof (zap_leaf_phys_t))
-    return grub_error (GRUB_ERR_BAD_FS, "ZAP leaf is too small");
-  err = dmu_read (zap_dnode, blkid, &l, &leafendian, data);
+  err = zap_cache_leaf (zc, blkid, &l, &leafendian, data);
   if (err)
     return err;
 
-  err = zap_leaf_lookup (l, leafendian, blksft, hash, name, value,
-			 case_insensitive);
-  grub_free (l);
-  return err;
+  return zap_leaf_lookup (l, leafendian, zc->blksft, hash, name, value,
+			  case_insensitive);
 }
 
-/* XXX */
+/*
+ * Walk every leaf of a fat ZAP once.  A leaf covers a contiguous range of
+ * the pointer table, so it is enough to skip entries repeating the
+ * previous one.
+ */
 static int
-fzap_iterate (dnode_end_t * zap_dnode, zap_phys_t * zap,
-	      grub_size_t name_elem_length,
+fzap_iterate (struct zap_cache *zc, grub_size_t name_elem_length,
 	      int (*hook) (const void *name, grub_size_t name_length,
 			   const void *val_in,
 			   grub_size_t nelem, grub_size_t elemsize,
@@ -2369,44 +2788,23 @@ fzap_iterate (dnode_end_t * zap_dnode, zap_phys_t * zap,
 	      void *hook_data, struct grub_zfs_data *data)
 {
   zap_leaf_phys_t *l;
-  void *l_in;
-  grub_uint64_t idx, idx2, blkid;
+  grub_uint64_t idx, blkid, prev_blkid = 0;
   grub_uint16_t chunk;
-  int blksft = zfs_log2 (grub_zfs_to_cpu16 (zap_dnode->dn.dn_datablkszsec, 
-					    zap_dnode->endian) << DNODE_SHIFT);
+  int blksft = zc->blksft;
   grub_err_t err;
   grub_zfs_endian_t endian;
 
-  if (zap_verify (zap, zap_dnode->endian))
-    return 0;
-
-  /* get block id from index */
-  if (zap->zap_ptrtbl.zt_numblks != 0)
-    {
-      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, 
-		  "external pointer tables not supported");
-      return 0;
-    }
-  /* Get the leaf block */
-  if ((1U << blksft) < sizeof (zap_leaf_phys_t))
-    {
-      grub_error (GRUB_ERR_BAD_FS, "ZAP leaf is too small");
-      return 0;
-    }
-  for (idx = 0; idx < (1ULL << zap->zap_ptrtbl.zt_shift); idx++)
+  for (idx = 0; idx < (1ULL << zc->ptrtbl_shift); idx++)
     {
-      blkid = grub_zfs_to_cpu64 (((grub_uint64_t *) zap)[idx + (1 << (blksft - 3 - 1))],
-				 zap_dnode->endian);
+      err = zap_cache_ptr (zc, idx, &blkid, data);
+      if (err)
+	return 0;
 
-      for (idx2 = 0; idx2 < idx; idx2++)
-	if (blkid == grub_zfs_to_cpu64 (((grub_uint64_t *) zap)[idx2 + (1 << (blksft - 3 - 1))],
-					zap_dnode->endian))
-	  break;
-      if (idx2 != idx)
+      if (idx != 0 && blkid == prev_blkid)
 	continue;
+      prev_blkid = blkid;
 
-      err = dmu_read (zap_dnode, blkid, &l_in, &endian, data);
-      l = l_in;
+      err = zap_cache_leaf (zc, blkid, &l, &endian, data);
       if (err)
 	{
 	  grub_errno = GRUB_ERR_NONE;
@@ -2415,15 +2813,9 @@ fzap_iterate (dnode_end_t * zap_dnode, zap_phys_t * zap,
 
       /* Verify if this is a valid leaf block */
       if (grub_zfs_to_cpu64 (l->l_hdr.lh_block_type, endian) != ZBT_LEAF)
-	{
-	  grub_free (l);
-	  continue;
-	}
+	continue;
       if (grub_zfs_to_cpu32 (l->l_hdr.lh_magic, endian) != ZAP_LEAF_MAGIC)
-	{
-	  grub_free (l);
-	  continue;
-	}
+	continue;
 
       for (chunk = 0; chunk < ZAP_LEAF_NUMCHUNKS (blksft); chunk++)
 	{
@@ -2467,17 +2859,48 @@ fzap_iterate (dnode_end_t * zap_dnode, zap_phys_t * zap,
 	  if (hook (buf, le->le_name_length,
 		    val, le->le_value_length, le->le_int_size, hook_data))
 	    {
-	      grub_free (l);
+	      grub_free (buf);
+	      grub_free (val);
 	      return 1;
 	    }
 	  grub_free (buf);
 	  grub_free (val);
 	}
-      grub_free (l);
     }
   return 0;
 }
 
+/*
+ * Get the cache of fat ZAP zap_dnode for iterating over it.  With zap
+ * NULL only the cache held in data is returned, if it matches.  The cache
+ * is detached from data meanwhile, since the iteration hook may look up
+ * other ZAPs.
+ */
+static struct zap_cache *
+zap_cache_take (dnode_end_t * zap_dnode, zap_phys_t * zap,
+		grub_zfs_endian_t endian, struct grub_zfs_data *data)
+{
+  struct zap_cache *zc;
+
+  if (zap)
+    return zap_cache_new (zap_dnode, zap, endian);
+
+  zc = zap_cache_get (zap_dnode, data);
+  if (zc)
+    data->zap_cache = NULL;
+  return zc;
+}
+
+/* Give back a cache obtained with zap_cache_take.  */
+static void
+zap_cache_put (struct zap_cache *zc, struct grub_zfs_data *data)
+{
+  if (!data->zap_cache)
+    data->zap_cache = zc;
+  else
+    zap_cache_free (zc);
+}
+
 /*
  * Read in the data of a zap object and find the value for a matching
  * property name.
@@ -2492,9 +2915,14 @@ zap_lookup (dnode_end_t * zap_dnode, const char *name, grub_uint64_t *val,
   void *zapbuf;
   grub_err_t err;
   grub_zfs_endian_t endian;
+  struct zap_cache *zc;
 
   grub_dprintf ("zfs", "looking for '%s'\n", name);
 
+  zc = zap_cache_get (zap_dnode, data);
+  if (zc)
+    return fzap_lookup (zc, name, val, data, case_insensitive);
+
   /* Read in the first block of the zap object data. */
   size = (grub_uint32_t) grub_zfs_to_cpu16 (zap_dnode->dn.dn_datablkszsec,
 			    zap_dnode->endian) << SPA_MINBLOCKSHIFT;
@@ -2510,7 +2938,7 @@ zap_lookup (dnode_end_t * zap_dnode, const char *name, grub_uint64_t *val,
       grub_dprintf ("zfs", "micro zap\n");
       err = mzap_lookup (zapbuf, endian, size, name, val,
 			 case_insensitive);
-      grub_dprintf ("zfs", "returned %d\n", err);      
+      grub_dprintf ("zfs", "returned %d\n", err);
       grub_free (zapbuf);
       return err;
     }
@@ -2518,13 +2946,17 @@ zap_lookup (dnode_end_t * zap_dnode, const char *name, grub_uint64_t *val,
     {
       grub_dprintf ("zfs", "fat zap\n");
       /* this is a fat zap */
-      err = fzap_lookup (zap_dnode, zapbuf, name, val, data,
-			 case_insensitive);
-      grub_dprintf ("zfs", "returned %d\n", err);      
-      grub_free (zapbuf);
+      zc = zap_cache_new (zap_dnode, zapbuf, endian);
+      if (!zc)
+	return grub_errno;
+      zap_cache_free (data->zap_cache);
+      data->zap_cache = zc;
+      err = fzap_lookup (zc, name, val, data, case_insensitive);
+      grub_dprintf ("zfs", "returned %d\n", err);
       return err;
     }
 
+  grub_free (zapbuf);
   return grub_error (GRUB_ERR_BAD_FS, "unknown ZAP type");
 }
 
@@ -2564,39 +2996,49 @@ zap_iterate_u64 (dnode_end_t * zap_dnode,
   grub_err_t err;
   int ret;
   grub_zfs_endian_t endian;
+  struct zap_cache *zc;
+  struct zap_iterate_u64_ctx transform_ctx = {
+    .hook = hook,
+    .dir_ctx = ctx
+  };
 
-  /* Read in the first block of the zap object data. */
-  size = grub_zfs_to_cpu16 (zap_dnode->dn.dn_datablkszsec, zap_dnode->endian) << SPA_MINBLOCKSHIFT;
-  err = dmu_read (zap_dnode, 0, &zapbuf, &endian, data);
-  if (err)
-    return 0;
-  block_type = grub_zfs_to_cpu64 (*((grub_uint64_t *) zapbuf), endian);
+  zc = zap_cache_take (zap_dnode, NULL, 0, data);
+  if (!zc)
+    {
+      /* Read in the first block of the zap object data. */
+      size = grub_zfs_to_cpu16 (zap_dnode->dn.dn_datablkszsec, zap_dnode->endian) << SPA_MINBLOCKSHIFT;
+      err = dmu_read (zap_dnode, 0, &zapbuf, &endian, data);
+      if (err)
+	return 0;
+      block_type = grub_zfs_to_cpu64 (*((grub_uint64_t *) zapbuf), endian);
 
-  grub_dprintf ("zfs", "zap iterate\n");
+      grub_dprintf ("zfs", "zap iterate\n");
 
-  if (block_type == ZBT_MICRO)
-    {
-      grub_dprintf ("zfs", "micro zap\n");
-      ret = mzap_iterate (zapbuf, endian, size, hook, ctx);
-      grub_free (zapbuf);
-      return ret;
-    }
-  else if (block_type == ZBT_HEADER)
-    {
-      struct zap_iterate_u64_ctx transform_ctx = {
-	.hook = hook,
-	.dir_ctx = ctx
-      };
+      if (block_type == ZBT_MICRO)
+	{
+	  grub_dprintf ("zfs", "micro zap\n");
+	  ret = mzap_iterate (zapbuf, endian, size, hook, ctx);
+	  grub_free (zapbuf);
+	  return ret;
+	}
+      if (block_type != ZBT_HEADER)
+	{
+	  grub_free (zapbuf);
+	  grub_error (GRUB_ERR_BAD_FS, "unknown ZAP type");
+	  return 0;
+	}
 
       grub_dprintf ("zfs", "fat zap\n");
       /* this is a fat zap */
-      ret = fzap_iterate (zap_dnode, zapbuf, 1,
-			  zap_iterate_u64_transform, &transform_ctx, data);
-      grub_free (zapbuf);
-      return ret;
+      zc = zap_cache_take (zap_dnode, zapbuf, endian, data);
+      if (!zc)
+	return 0;
     }
-  grub_error (GRUB_ERR_BAD_FS, "unknown ZAP type");
-  return 0;
+
+  ret = fzap_iterate (zc, 1, zap_iterate_u64_transform, &transform_ctx,
+		      data);
+  zap_cache_put (zc, data);
+  return ret;
 }
 
 static int
@@ -2613,31 +3055,42 @@ zap_iterate (dnode_end_t * zap_dnode,
   grub_err_t err;
   int ret;
   grub_zfs_endian_t endian;
+  struct zap_cache *zc;
 
-  /* Read in the first block of the zap object data. */
-  err = dmu_read (zap_dnode, 0, &zapbuf, &endian, data);
-  if (err)
-    return 0;
-  block_type = grub_zfs_to_cpu64 (*((grub_uint64_t *) zapbuf), endian);
+  zc = zap_cache_take (zap_dnode, NULL, 0, data);
+  if (!zc)
+    {
+      /* Read in the first block of the zap object data. */
+      err = dmu_read (zap_dnode, 0, &zapbuf, &endian, data);
+      if (err)
+	return 0;
+      block_type = grub_zfs_to_cpu64 (*((grub_uint64_t *) zapbuf), endian);
 
-  grub_dprintf ("zfs", "zap iterate\n");
+      grub_dprintf ("zfs", "zap iterate\n");
+
+      if (block_type == ZBT_MICRO)
+	{
+	  grub_free (zapbuf);
+	  grub_error (GRUB_ERR_BAD_FS, "micro ZAP where FAT ZAP expected");
+	  return 0;
+	}
+      if (block_type != ZBT_HEADER)
+	{
+	  grub_free (zapbuf);
+	  grub_error (GRUB_ERR_BAD_FS, "unknown ZAP type");
+	  return 0;
+	}
 
-  if (block_type == ZBT_MICRO)
-    {
-      grub_error (GRUB_ERR_BAD_FS, "micro ZAP where FAT ZAP expected");
-      return 0;
-    }
-  if (block_type == ZBT_HEADER)
-    {
       grub_dprintf ("zfs", "fat zap\n");
       /* this is a fat zap */
-      ret = fzap_iterate (zap_dnode, zapbuf, nameelemlen, hook, hook_data,
-			  data);
-      grub_free (zapbuf);
-      return ret;
+      zc = zap_cache_take (zap_dnode, zapbuf, endian, data);
+      if (!zc)
+	return 0;
     }
-  grub_error (GRUB_ERR_BAD_FS, "unknown ZAP type");
-  return 0;
+
+  ret = fzap_iterate (zc, nameelemlen, hook, hook_data, data);
+  zap_cache_put (zc, data);
+  return ret;
 }
 
 
@@ -3597,6 +4050,7 @@ zfs_unmount (struct grub_zfs_data *data)
   grub_free (data->dnode_buf);
   grub_free (data->dnode_mdn);
   grub_free (data->file_buf);
+  zap_cache_free (data->zap_cache);
   for (i = 0; i < data->subvol.nkeys; i++)
     grub_crypto_cipher_close (data->subvol.keyring[i].cipher);
   grub_free (data->subvol.keyring);
@@ -4375,4 +4829,5 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  block_cache_flush ();
 }
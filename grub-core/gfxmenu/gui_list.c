@@ -69,6 +69,12 @@ struct grub_gui_list_impl
 
   int first_shown_index;
 
+  /* State of the list when it was last painted.  */
+  int painted;
+  int painted_first_shown_index;
+  int painted_selected;
+  int painted_size;
+
   int need_to_recreate_boxes;
   char *theme_dir;
   char *menu_box_pattern;
@@ -248,6 +254,37 @@ make_selected_item_visible (list_impl_t self)
     self->first_shown_index = selected_index - (num_shown_items - 1);
 }
 
+/* Get the bounds of the row showing the VISIBLE_INDEXth shown item, relative
+   to the parent of the list.  */
+static void
+get_item_bounds (list_impl_t self, int visible_index, grub_video_rect_t *r)
+{
+  grub_gfxmenu_box_t box = self->menu_box;
+  grub_gfxmenu_box_t itembox = self->item_box;
+  grub_gfxmenu_box_t selbox = self->selected_item_box;
+  int max_top_pad = grub_max (itembox->get_top_pad (itembox),
+                              selbox->get_top_pad (selbox));
+  int max_bottom_pad = grub_max (itembox->get_bottom_pad (itembox),
+                                 selbox->get_bottom_pad (selbox));
+  int icon_overhang = 0;
+  int top, bottom;
+
+  /* Icons taller than the text are centered on it and stick out.  */
+  if (self->icon_height > self->item_height)
+    icon_overhang = (self->icon_height - self->item_height + 1) / 2;
+
+  top = (box->get_top_pad (box) + self->item_padding
+         + visible_index * (self->item_height + self->item_spacing));
+  bottom = top + max_top_pad + self->item_height + max_bottom_pad;
+  top = grub_max (top - icon_overhang, 0);
+  bottom = grub_min (bottom + icon_overhang, (int) self->bounds.height);
+
+  r->x = self->bounds.x;
+  r->y = self->bounds.y + top;
+  r->width = self->bounds.width;
+  r->height = bottom > top ? bottom - top : 0;
+}
+
 /* Draw a scrollbar on the menu.  */
 static void
 draw_scrollbar (list_impl_t self,
@@ -314,9 +351,10 @@ draw_scrollbar (list_impl_t self,
   thumb->draw (thumb, thumbx, thumby);
 }
 
-/* Draw the list of items.  */
+/* Draw the items of the list whose rows intersect REGION.  */
 static void
-draw_menu (list_impl_t self, int num_shown_items)
+draw_menu (list_impl_t self, int num_shown_items,
+           const grub_video_rect_t *region)
 {
   if (! self->menu_box || ! self->selected_item_box || ! self->item_box)
     return;
@@ -401,6 +439,14 @@ draw_menu (list_impl_t self, int num_shown_items)
       int top_pad;
       int icon_top_offset;
       int viewport_width;
+      grub_video_rect_t item_bounds;
+
+      get_item_bounds (self, visible_index, &item_bounds);
+      if (!grub_video_have_common_points (region, &item_bounds))
+        {
+          item_top += text_box_height + item_vspace;
+          continue;
+        }
 
       if (is_selected)
         {
@@ -507,9 +553,14 @@ list_paint (void *vself, const grub_video_rect_t *region)
       }
 
     grub_gui_set_viewport (&content_rect, &vpsave2);
-    draw_menu (self, num_shown_items);
+    draw_menu (self, num_shown_items, region);
     grub_gui_restore_viewport (&vpsave2);
 
+    self->painted = 1;
+    self->painted_first_shown_index = self->first_shown_index;
+    self->painted_selected = self->view->selected;
+    self->painted_size = self->view->menu->size;
+
     if (drawing_scrollbar)
       {
         content_rect.y += self->scrollbar_top_pad;
@@ -860,6 +911,52 @@ list_refresh_info (void *vself,
   list_impl_t self = vself;
   if (view->nested)
     self->first_shown_index = 0;
+  self->painted = 0;
+}
+
+/* Report the rows whose selection state changed, or the whole list if it
+   scrolled or was never painted.  */
+static int
+list_get_damage (void *vself, grub_video_rect_t *damage)
+{
+  list_impl_t self = vself;
+  int num_shown_items;
+  int indexes[2];
+  int i, n = 0;
+
+  if (! self->visible)
+    return 0;
+
+  if (! self->painted || ! check_boxes (self)
+      || self->painted_size != self->view->menu->size)
+    {
+      damage[0] = self->bounds;
+      return 1;
+    }
+
+  make_selected_item_visible (self);
+  if (self->first_shown_index != self->painted_first_shown_index)
+    {
+      damage[0] = self->bounds;
+      return 1;
+    }
+
+  if (self->painted_selected == self->view->selected)
+    return 0;
+
+  num_shown_items = get_num_shown_items (self);
+  indexes[0] = self->painted_selected;
+  indexes[1] = self->view->selected;
+  for (i = 0; i < 2; i++)
+    {
+      int visible_index = indexes[i] - self->first_shown_index;
+
+      if (indexes[i] < 0 || indexes[i] >= self->view->menu->size
+          || visible_index < 0 || visible_index >= num_shown_items)
+        continue;
+      get_item_bounds (self, visible_index, &damage[n++]);
+    }
+  return n;
 }
 
 static struct grub_gui_component_ops list_comp_ops =
@@ -879,7 +976,8 @@ static struct grub_gui_component_ops list_comp_ops =
 static struct grub_gui_list_ops list_ops =
 {
   .set_view_info = list_set_view_info,
-  .refresh_list = list_refresh_info
+  .refresh_list = list_refresh_info,
+  .get_damage = list_get_damage
 };
 
 grub_gui_component_t
@@ -86,6 +86,9 @@ grub_gfxmenu_view_new (const char *theme_path,
   default_bg_color = grub_video_rgba_color_rgb (255, 255, 255);
 
   view->canvas = 0;
+  view->background = 0;
+  view->background_valid = 0;
+  view->static_layers = 0;
 
   view->title_font = default_font;
   view->message_font = default_font;
@@ -144,6 +147,7 @@ grub_gfxmenu_view_destroy (grub_gfxmenu_view_t view)
   grub_free (view->theme_path);
   if (view->canvas)
     view->canvas->component.ops->destroy (view->canvas);
+  grub_video_delete_render_target (view->background);
   grub_free (view);
 }
 
@@ -168,6 +172,135 @@ redraw_background (grub_gfxmenu_view_t view,
     }
 }
 
+static void
+find_dynamic_visit (grub_gui_component_t component, void *userdata)
+{
+  int *dynamic = userdata;
+  struct grub_gfxmenu_timeout_notify *cur;
+
+  if (component->ops->is_instance (component, "list"))
+    *dynamic = 1;
+  for (cur = grub_gfxmenu_timeout_notifications; cur; cur = cur->next)
+    if (cur->self == component)
+      *dynamic = 1;
+}
+
+struct count_static_state
+{
+  int count;
+  int done;
+};
+
+static void
+count_static_visit (grub_gui_component_t component, void *userdata)
+{
+  struct count_static_state *state = userdata;
+  int dynamic = 0;
+
+  if (state->done)
+    return;
+  grub_gui_iterate_recursively (component, find_dynamic_visit, &dynamic);
+  if (dynamic)
+    state->done = 1;
+  else
+    state->count++;
+}
+
+struct paint_layers_state
+{
+  const grub_video_rect_t *region;
+  grub_video_area_status_t area_status;
+  int index;
+  int first;
+  int end;
+};
+
+static void
+paint_layer_visit (grub_gui_component_t component, void *userdata)
+{
+  struct paint_layers_state *state = userdata;
+  grub_video_rect_t bounds;
+  int index = state->index++;
+
+  if (index < state->first || (state->end >= 0 && index >= state->end))
+    return;
+
+  component->ops->get_bounds (component, &bounds);
+  if (!grub_video_have_common_points (state->region, &bounds))
+    return;
+
+  if (state->area_status == GRUB_VIDEO_AREA_ENABLED
+      && grub_video_bounds_inside_region (&bounds, state->region))
+    grub_video_set_area_status (GRUB_VIDEO_AREA_DISABLED);
+  component->ops->paint (component, state->region);
+  if (state->area_status == GRUB_VIDEO_AREA_ENABLED)
+    grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
+}
+
+/* Paint the top-level components of the canvas from FIRST up to, but not
+   including, END (all of the remaining ones if END is negative).  Their
+   bounds must have been laid out by painting the whole canvas before.  */
+static void
+paint_layers (grub_gfxmenu_view_t view, const grub_video_rect_t *region,
+	      int first, int end)
+{
+  struct paint_layers_state state;
+  grub_video_rect_t bounds, vpsave;
+
+  state.region = region;
+  state.index = 0;
+  state.first = first;
+  state.end = end;
+  grub_video_get_area_status (&state.area_status);
+
+  view->canvas->component.ops->get_bounds (view->canvas, &bounds);
+  grub_gui_set_viewport (&bounds, &vpsave);
+  view->canvas->ops->iterate_children (view->canvas, paint_layer_visit,
+				       &state);
+  grub_gui_restore_viewport (&vpsave);
+}
+
+/* Compose the desktop and the components below the first one showing the
+   menu or the timeout into VIEW->BACKGROUND, so that redrawing a part of
+   the screen only has to copy it and paint the components on top.  */
+static void
+update_background (grub_gfxmenu_view_t view)
+{
+  struct count_static_state state;
+
+  view->background_valid = 0;
+  if (! view->canvas)
+    return;
+
+  state.count = 0;
+  state.done = 0;
+  view->canvas->ops->iterate_children (view->canvas, count_static_visit,
+				       &state);
+  view->static_layers = state.count;
+
+  /* Without such components the desktop image is all there is to cache.  */
+  if (view->static_layers == 0)
+    return;
+
+  if (! view->background
+      && grub_video_create_render_target (&view->background,
+					  view->screen.width,
+					  view->screen.height,
+					  GRUB_VIDEO_MODE_TYPE_RGB))
+    {
+      /* Not fatal, everything is painted directly then.  */
+      view->background = 0;
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  grub_video_set_active_render_target (view->background);
+  redraw_background (view, &view->screen);
+  paint_layers (view, &view->screen, 0, view->static_layers);
+  grub_video_set_active_render_target (GRUB_VIDEO_RENDER_TARGET_DISPLAY);
+  view->background_valid = 1;
+}
+
 static void
 draw_title (grub_gfxmenu_view_t view)
 {
@@ -328,9 +461,22 @@ grub_gfxmenu_view_redraw (grub_gfxmenu_view_t view,
     grub_video_set_region (region->x, region->y,
                            region->width, region->height);
 
-  redraw_background (view, region);
-  if (view->canvas)
-    view->canvas->component.ops->paint (view->canvas, region);
+  if (view->background_valid)
+    {
+      grub_video_blit_render_target (view->background,
+				     GRUB_VIDEO_BLIT_REPLACE,
+				     region->x, region->y,
+				     region->x - view->screen.x,
+				     region->y - view->screen.y,
+				     region->width, region->height);
+      paint_layers (view, region, view->static_layers, -1);
+    }
+  else
+    {
+      redraw_background (view, region);
+      if (view->canvas)
+	view->canvas->component.ops->paint (view->canvas, region);
+    }
   draw_title (view);
   if (grub_video_have_common_points (&view->progress_message_frame, region))
     draw_message (view);
@@ -359,9 +505,12 @@ grub_gfxmenu_view_draw (grub_gfxmenu_view_t view)
   refresh_menu_components (view);
   update_menu_components (view);
 
+  /* The first full redraw lays out the components for update_background.  */
+  view->background_valid = 0;
   grub_video_set_area_status (GRUB_VIDEO_AREA_DISABLED);
   grub_gfxmenu_view_redraw (view, &view->screen);
   grub_video_swap_buffers ();
+  update_background (view);
   if (view->double_repaint)
     {
       grub_video_set_area_status (GRUB_VIDEO_AREA_DISABLED);
@@ -370,35 +519,78 @@ grub_gfxmenu_view_draw (grub_gfxmenu_view_t view)
 
 }
 
+#define MAX_MENU_DAMAGE 8
+
+struct menu_damage
+{
+  grub_video_rect_t rects[MAX_MENU_DAMAGE];
+  int count;
+};
+
 static void
-redraw_menu_visit (grub_gui_component_t component,
+damage_menu_visit (grub_gui_component_t component,
                    void *userdata)
 {
-  grub_gfxmenu_view_t view;
-  view = userdata;
-  if (component->ops->is_instance (component, "list"))
+  struct menu_damage *damage = userdata;
+  grub_video_rect_t rects[GRUB_GUI_LIST_MAX_DAMAGE];
+  int i, n;
+
+  if (! component->ops->is_instance (component, "list"))
+    return;
+
+  n = ((grub_gui_list_t) component)->ops->get_damage (component, rects);
+  for (i = 0; i < n; i++)
     {
-      grub_video_rect_t bounds;
+      grub_video_rect_t *last;
+      unsigned right, bottom;
+
+      if (damage->count < MAX_MENU_DAMAGE)
+	{
+	  damage->rects[damage->count++] = rects[i];
+	  continue;
+	}
+
+      /* Out of room, merge into the last rectangle.  */
+      last = &damage->rects[MAX_MENU_DAMAGE - 1];
+      right = grub_max (last->x + last->width, rects[i].x + rects[i].width);
+      bottom = grub_max (last->y + last->height,
+			 rects[i].y + rects[i].height);
+      last->x = grub_min (last->x, rects[i].x);
+      last->y = grub_min (last->y, rects[i].y);
+      last->width = right - last->x;
+      last->height = bottom - last->y;
+    }
+}
 
-      component->ops->get_bounds (component, &bounds);
+static void
+redraw_menu_damage (grub_gfxmenu_view_t view,
+		    const struct menu_damage *damage)
+{
+  int i;
+
+  for (i = 0; i < damage->count; i++)
+    {
       grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
-      grub_gfxmenu_view_redraw (view, &bounds);
+      grub_gfxmenu_view_redraw (view, &damage->rects[i]);
     }
 }
 
+/* Redraw the parts of the menu lists which changed, usually the rows of
+   the previously and the newly selected entry.  */
 void
 grub_gfxmenu_redraw_menu (grub_gfxmenu_view_t view)
 {
+  struct menu_damage damage;
+
   update_menu_components (view);
 
+  damage.count = 0;
   grub_gui_iterate_recursively ((grub_gui_component_t) view->canvas,
-                                redraw_menu_visit, view);
+                                damage_menu_visit, &damage);
+  redraw_menu_damage (view, &damage);
   grub_video_swap_buffers ();
   if (view->double_repaint)
-    {
-      grub_gui_iterate_recursively ((grub_gui_component_t) view->canvas,
-				    redraw_menu_visit, view);
-    }
+    redraw_menu_damage (view, &damage);
 }
 
 void 
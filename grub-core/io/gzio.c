@@ -100,6 +100,8 @@ struct grub_gzio
   int bd;
   /* The original offset value.  */
   grub_off_t saved_offset;
+  /* The read position of grub_zlib_stream_read.  */
+  grub_off_t stream_offset;
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -503,6 +505,7 @@ huft_build (unsigned *b,	/* code lengths in bits (all assumed <= BMAX) */
 	v[x[j]++] = i;
     }
   while (++i < n);
+  n = x[g];			/* set n to length of v */
 
   /* Generate the Huffman codes and for each, make the table entries */
   x[0] = i = 0;			/* first Huffman code is zero */
@@ -819,6 +822,7 @@ init_fixed_block (grub_gzio_t gzio)
   gzio->bl = 7;
   if (huft_build (l, 288, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
     {
+      gzio->tl = 0;
       if (grub_errno == GRUB_ERR_NONE)
 	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		    "failed in building a Huffman code table");
@@ -836,6 +840,7 @@ init_fixed_block (grub_gzio_t gzio)
 		    "failed in building a Huffman code table");
       huft_free (gzio->tl);
       gzio->tl = 0;
+      gzio->td = 0;
       return;
     }
 
@@ -859,6 +864,7 @@ init_dynamic_block (grub_gzio_t gzio)
   unsigned nl;			/* number of literal/length codes */
   unsigned nd;			/* number of distance codes */
   unsigned ll[286 + 30];	/* literal/length and distance code lengths */
+  struct huft *td;		/* bit length code table entry */
   register ulg b;		/* bit buffer */
   register unsigned k;		/* number of bits in bit buffer */
 
@@ -894,8 +900,14 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* build decoding table for trees--single level, 7 bit lookup */
   gzio->bl = 7;
-  if (huft_build (ll, 19, 19, NULL, NULL, &gzio->tl, &gzio->bl) != 0)
+  i = huft_build (ll, 19, 19, NULL, NULL, &gzio->tl, &gzio->bl);
+  if (i != 0)
     {
+      /* An incomplete table is still allocated, otherwise the pointer may
+	 be stale.  */
+      if (i == 1)
+	huft_free (gzio->tl);
+      gzio->tl = 0;
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
@@ -908,9 +920,9 @@ init_dynamic_block (grub_gzio_t gzio)
   while ((unsigned) i < n)
     {
       NEEDBITS ((unsigned) gzio->bl);
-      j = (gzio->td = gzio->tl + ((unsigned) b & m))->b;
+      j = (td = gzio->tl + ((unsigned) b & m))->b;
       DUMPBITS (j);
-      j = gzio->td->v.n;
+      j = td->v.n;
       if (j < 16)		/* length of code in bits (0..15) */
 	ll[i++] = l = j;	/* save last length in l */
       else if (j == 16)		/* repeat last length 3 to 6 times */
@@ -959,7 +971,6 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* free decoding table for trees */
   huft_free (gzio->tl);
-  gzio->td = 0;
   gzio->tl = 0;
 
   /* restore the global bit buffer */
@@ -968,17 +979,25 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* build the decoding tables for literal/length and distance codes */
   gzio->bl = lbits;
-  if (huft_build (ll, nl, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  i = huft_build (ll, nl, 257, cplens, cplext, &gzio->tl, &gzio->bl);
+  if (i != 0)
     {
+      if (i == 1)
+	huft_free (gzio->tl);
+      gzio->tl = 0;
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
     }
   gzio->bd = dbits;
-  if (huft_build (ll + nl, nd, 0, cpdist, cpdext, &gzio->td, &gzio->bd) != 0)
+  i = huft_build (ll + nl, nd, 0, cpdist, cpdext, &gzio->td, &gzio->bd);
+  if (i != 0)
     {
+      if (i == 1)
+	huft_free (gzio->td);
       huft_free (gzio->tl);
       gzio->tl = 0;
+      gzio->td = 0;
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
@@ -1345,6 +1364,48 @@ grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+struct grub_gzio *
+grub_zlib_stream_open (char *inbuf, grub_size_t insize)
+{
+  grub_gzio_t gzio = 0;
+
+  gzio = grub_zalloc (sizeof (*gzio));
+  if (! gzio)
+    return 0;
+  gzio->mem_input = (grub_uint8_t *) inbuf;
+  gzio->mem_input_size = insize;
+  gzio->mem_input_off = 0;
+
+  if (!test_zlib_header (gzio))
+    {
+      grub_free (gzio);
+      return 0;
+    }
+
+  return gzio;
+}
+
+grub_ssize_t
+grub_zlib_stream_read (struct grub_gzio *gzio, char *outbuf,
+		       grub_size_t outsize)
+{
+  grub_ssize_t ret;
+
+  ret = grub_gzio_read_real (gzio, gzio->stream_offset, outbuf, outsize);
+  if (ret > 0)
+    gzio->stream_offset += ret;
+
+  return ret;
+}
+
+void
+grub_zlib_stream_close (struct grub_gzio *gzio)
+{
+  huft_free (gzio->tl);
+  huft_free (gzio->td);
+  grub_free (gzio);
+}
+
 
 
 static struct grub_fs grub_gzio_fs =
@@ -62,3 +62,10 @@ grub_realloc (void *ptr, grub_size_t size)
     grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
   return ret;
 }
+
+/* The host's malloc can always ask for more.  */
+grub_size_t
+grub_mm_free_size (void)
+{
+  return GRUB_SIZE_MAX;
+}
@@ -22,25 +22,35 @@
 #include <grub/i18n.h>
 #include <grub/err.h>
 #include <grub/time.h>
+#include <grub/env.h>
 
 struct dns_cache_element
 {
   char *name;
+  /* 0 if the name is known not to resolve.  */
   grub_size_t naddresses;
   struct grub_net_network_level_address *addresses;
   grub_uint64_t limit_time;
 };
 
-#define DNS_CACHE_SIZE 1021
+#define DNS_DEFAULT_CACHE_SIZE 1021
+#define DNS_MAX_CACHE_SIZE 65521
 #define DNS_HASH_BASE 423
 
+/* Time between retransmissions of unanswered queries, in ms.  */
+#define DNS_RETRANSMIT 200
+/* How long to wait for the preferred address family after the other one
+   has answered, in ms (the "resolution delay" of RFC 8305).  */
+#define DNS_RESOLUTION_DELAY 50
+
 typedef enum grub_dns_qtype_id
   {
     GRUB_DNS_QTYPE_A = 1,
     GRUB_DNS_QTYPE_AAAA = 28
   } grub_dns_qtype_id_t;
 
-static struct dns_cache_element dns_cache[DNS_CACHE_SIZE];
+static struct dns_cache_element *dns_cache;
+static grub_size_t dns_cache_size;
 static struct grub_net_network_level_address *dns_servers;
 static grub_size_t dns_nservers, dns_servers_alloc;
 
@@ -97,7 +107,8 @@ enum
 
 enum
   {
-    ERRCODE_MASK = 0x0f
+    ERRCODE_MASK = 0x0f,
+    ERRCODE_NXDOMAIN = 3
   };
 
 enum
@@ -105,19 +116,36 @@ enum
     DNS_PORT = 53
   };
 
-struct recv_data
+/* A and AAAA are asked for at the same time, each under its own id.  */
+enum
+  {
+    DNS_QUERY_A,
+    DNS_QUERY_AAAA,
+    DNS_NQUERIES
+  };
+
+struct dns_query
 {
-  grub_size_t *naddresses;
-  struct grub_net_network_level_address **addresses;
-  int cache;
   grub_uint16_t id;
-  int dns_err;
-  char *name;
+  int sent;
+  int done;
+  /* The server answered with an error other than NXDOMAIN.  */
+  int failed;
+  grub_size_t naddresses;
+  struct grub_net_network_level_address *addresses;
+  /* How long the answer, or the absence of one, may be cached, in
+     seconds.  */
+  grub_uint32_t ttl;
+};
+
+struct recv_data
+{
+  struct dns_query queries[DNS_NQUERIES];
   const char *oname;
   int stop;
 };
 
-static inline int
+static inline grub_size_t
 hash (const char *str)
 {
   unsigned v = 0, xn = 1;
@@ -125,12 +153,107 @@ hash (const char *str)
   for (ptr = str; *ptr; )
     {
       v = (v + xn * *ptr);
-      xn = (DNS_HASH_BASE * xn) % DNS_CACHE_SIZE;
+      xn = (DNS_HASH_BASE * xn) % dns_cache_size;
       ptr++;
       if (((ptr - str) & 0x3ff) == 0)
-	v %= DNS_CACHE_SIZE;
+	v %= dns_cache_size;
+    }
+  return v % dns_cache_size;
+}
+
+static void
+dns_cache_flush (void)
+{
+  grub_size_t i;
+
+  for (i = 0; i < dns_cache_size; i++)
+    {
+      grub_free (dns_cache[i].name);
+      grub_free (dns_cache[i].addresses);
     }
-  return v % DNS_CACHE_SIZE;
+  grub_free (dns_cache);
+  dns_cache = NULL;
+  dns_cache_size = 0;
+}
+
+/* Make the cache match net_dns_cache_size.  Changing the size drops all
+   entries; 0 disables the cache.  */
+static void
+dns_cache_setup (void)
+{
+  const char *val;
+  unsigned long size = DNS_DEFAULT_CACHE_SIZE;
+  char *end;
+
+  val = grub_env_get ("net_dns_cache_size");
+  if (val)
+    {
+      size = grub_strtoul (val, &end, 0);
+      if (grub_errno || *end)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  size = DNS_DEFAULT_CACHE_SIZE;
+	}
+      if (size > DNS_MAX_CACHE_SIZE)
+	size = DNS_MAX_CACHE_SIZE;
+    }
+
+  if (size == dns_cache_size)
+    return;
+  dns_cache_flush ();
+  if (!size)
+    return;
+  dns_cache = grub_zalloc (size * sizeof (dns_cache[0]));
+  if (!dns_cache)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  dns_cache_size = size;
+}
+
+static void
+dns_cache_store (const char *name,
+		 const struct grub_net_network_level_address *addresses,
+		 grub_size_t naddresses, grub_uint32_t ttl)
+{
+  struct dns_cache_element *e;
+
+  if (!dns_cache_size || !ttl)
+    return;
+  grub_dprintf ("dns", "caching %s for %d seconds\n",
+		naddresses ? "answer" : "negative answer", ttl);
+  e = &dns_cache[hash (name)];
+  grub_free (e->name);
+  grub_free (e->addresses);
+  e->name = grub_strdup (name);
+  e->addresses = NULL;
+  e->naddresses = naddresses;
+  if (naddresses)
+    e->addresses = grub_malloc (naddresses * sizeof (e->addresses[0]));
+  if (!e->name || (naddresses && !e->addresses))
+    {
+      grub_free (e->name);
+      e->name = NULL;
+      grub_free (e->addresses);
+      e->addresses = NULL;
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  if (naddresses)
+    grub_memcpy (e->addresses, addresses,
+		 naddresses * sizeof (e->addresses[0]));
+  e->limit_time = grub_get_time_ms () + 1000 * (grub_uint64_t) ttl;
+}
+
+static const grub_uint8_t *
+skip_name (const grub_uint8_t *ptr, const grub_uint8_t *tail)
+{
+  while (ptr < tail && !((*ptr & 0xc0) || *ptr == 0))
+    ptr += *ptr + 1;
+  if (ptr < tail && (*ptr & 0xc0))
+    ptr++;
+  return ptr + 1;
 }
 
 static int
@@ -222,9 +345,44 @@ enum
   {
     DNS_CLASS_A = 1,
     DNS_CLASS_CNAME = 5,
+    DNS_CLASS_SOA = 6,
     DNS_CLASS_AAAA = 28
   };
 
+/* A negative answer may be cached for the smaller of the TTL and the
+   MINIMUM field of the SOA record in the authority section (RFC 2308).
+   Without an SOA it isn't cached at all.  */
+static grub_uint32_t
+negative_ttl (const grub_uint8_t *ptr, const struct dns_header *head,
+	      const grub_uint8_t *tail)
+{
+  int i;
+
+  for (i = 0; i < grub_be_to_cpu16 (head->nscount); i++)
+    {
+      grub_uint16_t class, length;
+      grub_uint32_t ttl, minimum;
+
+      ptr = skip_name (ptr, tail);
+      if (ptr + 10 > tail)
+	return 0;
+      class = (ptr[0] << 8) | ptr[1];
+      ttl = grub_be_to_cpu32 (grub_get_unaligned32 (ptr + 4));
+      length = (ptr[8] << 8) | ptr[9];
+      ptr += 10;
+      if (ptr + length > tail)
+	return 0;
+      /* MINIMUM is the last field of the record.  */
+      if (class == DNS_CLASS_SOA && length >= 22)
+	{
+	  minimum = grub_be_to_cpu32 (grub_get_unaligned32 (ptr + length - 4));
+	  return ttl < minimum ? ttl : minimum;
+	}
+      ptr += length;
+    }
+  return 0;
+}
+
 static grub_err_t 
 recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	   struct grub_net_buff *nb,
@@ -232,66 +390,58 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
 {
   struct dns_header *head;
   struct recv_data *data = data_;
+  struct dns_query *q = NULL;
   int i, j;
-  grub_uint8_t *ptr, *reparse_ptr;
+  const grub_uint8_t *ptr, *reparse_ptr;
   int redirect_cnt = 0;
-  char *redirect_save = NULL;
+  char *name = NULL, *redirect_save = NULL;
+  struct grub_net_network_level_address *addresses = NULL;
+  grub_size_t naddresses = 0;
   grub_uint32_t ttl_all = ~0U;
 
-  /* Code apparently assumed that only one packet is received as response.
-     We may get multiple responses due to network condition, so check here
-     and quit early. */
-  if (*data->addresses)
-    {
-      grub_netbuff_free (nb);
-      return GRUB_ERR_NONE;
-    }
-
   head = (struct dns_header *) nb->data;
   ptr = (grub_uint8_t *) (head + 1);
   if (ptr >= nb->tail)
-    {
-      grub_netbuff_free (nb);
-      return GRUB_ERR_NONE;
-    }
-  
-  if (head->id != data->id)
-    {
-      grub_netbuff_free (nb);
-      return GRUB_ERR_NONE;
-    }
+    goto out;
+
+  for (i = 0; i < DNS_NQUERIES; i++)
+    if (data->queries[i].sent && head->id == data->queries[i].id)
+      q = &data->queries[i];
+
+  /* We may get multiple responses due to network condition or several
+     servers answering, only the first one counts.  */
+  if (!q || q->done)
+    goto out;
   if (!(head->flags & FLAGS_RESPONSE) || (head->flags & FLAGS_OPCODE))
+    goto out;
+  if ((head->ra_z_r_code & ERRCODE_MASK)
+      && (head->ra_z_r_code & ERRCODE_MASK) != ERRCODE_NXDOMAIN)
     {
-      grub_netbuff_free (nb);
-      return GRUB_ERR_NONE;
-    }
-  if (head->ra_z_r_code & ERRCODE_MASK)
-    {
-      data->dns_err = 1;
-      grub_netbuff_free (nb);
-      return GRUB_ERR_NONE;
+      q->failed = 1;
+      goto done;
     }
   for (i = 0; i < grub_be_to_cpu16 (head->qdcount); i++)
     {
       if (ptr >= nb->tail)
+	goto out;
+      ptr = skip_name (ptr, nb->tail);
+      ptr += 4;
+    }
+  if (head->ancount)
+    {
+      addresses = grub_malloc (sizeof (addresses[0])
+			       * grub_be_to_cpu16 (head->ancount));
+      if (!addresses)
 	{
-	  grub_netbuff_free (nb);
-	  return GRUB_ERR_NONE;
+	  grub_errno = GRUB_ERR_NONE;
+	  goto out;
 	}
-      while (ptr < nb->tail && !((*ptr & 0xc0) || *ptr == 0))
-	ptr += *ptr + 1;
-      if (ptr < nb->tail && (*ptr & 0xc0))
-	ptr++;
-      ptr++;
-      ptr += 4;
     }
-  *data->addresses = grub_malloc (sizeof ((*data->addresses)[0])
-				 * grub_be_to_cpu16 (head->ancount));
-  if (!*data->addresses)
+  name = grub_strdup (data->oname);
+  if (!name)
     {
       grub_errno = GRUB_ERR_NONE;
-      grub_netbuff_free (nb);
-      return GRUB_ERR_NONE;
+      goto out;
     }
   reparse_ptr = ptr;
  reparse:
@@ -302,24 +452,11 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
       grub_uint32_t ttl = 0;
       grub_uint16_t length;
       if (ptr >= nb->tail)
-	{
-	  if (!*data->naddresses)
-	    grub_free (*data->addresses);
-	  return GRUB_ERR_NONE;
-	}
-      ignored = !check_name (ptr, nb->data, nb->tail, data->name);
-      while (ptr < nb->tail && !((*ptr & 0xc0) || *ptr == 0))
-	ptr += *ptr + 1;
-      if (ptr < nb->tail && (*ptr & 0xc0))
-	ptr++;
-      ptr++;
+	goto out;
+      ignored = !check_name (ptr, nb->data, nb->tail, name);
+      ptr = skip_name (ptr, nb->tail);
       if (ptr + 10 >= nb->tail)
-	{
-	  if (!*data->naddresses)
-	    grub_free (*data->addresses);
-	  grub_netbuff_free (nb);
-	  return GRUB_ERR_NONE;
-	}
+	goto out;
       if (*ptr++ != 0)
 	ignored = 1;
       class = *ptr++;
@@ -335,12 +472,7 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
       length = *ptr++ << 8;
       length |= *ptr++;
       if (ptr + length > nb->tail)
-	{
-	  if (!*data->naddresses)
-	    grub_free (*data->addresses);
-	  grub_netbuff_free (nb);
-	  return GRUB_ERR_NONE;
-	}
+	goto out;
       if (!ignored)
 	{
 	  if (ttl_all > ttl)
@@ -350,81 +482,76 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	    case DNS_CLASS_A:
 	      if (length != 4)
 		break;
-	      (*data->addresses)[*data->naddresses].type
+	      addresses[naddresses].type
 		= GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
-	      grub_memcpy (&(*data->addresses)[*data->naddresses].ipv4,
-			   ptr, 4);
-	      (*data->naddresses)++;
-	      data->stop = 1;
+	      grub_memcpy (&addresses[naddresses].ipv4, ptr, 4);
+	      naddresses++;
 	      break;
 	    case DNS_CLASS_AAAA:
 	      if (length != 16)
 		break;
-	      (*data->addresses)[*data->naddresses].type
+	      addresses[naddresses].type
 		= GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6;
-	      grub_memcpy (&(*data->addresses)[*data->naddresses].ipv6,
-			   ptr, 16);
-	      (*data->naddresses)++;
-	      data->stop = 1;
+	      grub_memcpy (&addresses[naddresses].ipv6, ptr, 16);
+	      naddresses++;
 	      break;
 	    case DNS_CLASS_CNAME:
 	      if (!(redirect_cnt & (redirect_cnt - 1)))
 		{
 		  grub_free (redirect_save);
-		  redirect_save = data->name;
+		  redirect_save = name;
 		}
 	      else
-		grub_free (data->name);
+		grub_free (name);
 	      redirect_cnt++;
-	      data->name = get_name (ptr, nb->data, nb->tail);
-	      if (!data->name)
+	      name = get_name (ptr, nb->data, nb->tail);
+	      if (!name)
 		{
-		  data->dns_err = 1;
-		  grub_errno = 0;
-		  return GRUB_ERR_NONE;
+		  grub_errno = GRUB_ERR_NONE;
+		  q->failed = 1;
+		  goto done;
 		}
-	      grub_dprintf ("dns", "CNAME %s\n", data->name);
-	      if (grub_strcmp (redirect_save, data->name) == 0)
+	      grub_dprintf ("dns", "CNAME %s\n", name);
+	      if (grub_strcmp (redirect_save, name) == 0)
 		{
-		  data->dns_err = 1;
-		  grub_free (redirect_save);
-		  return GRUB_ERR_NONE;
+		  q->failed = 1;
+		  goto done;
 		}
 	      goto reparse;
 	    }
 	}
       ptr += length;
     }
-  if (ttl_all && *data->naddresses && data->cache)
+
+  if (naddresses)
     {
-      int h;
-      grub_dprintf ("dns", "caching for %d seconds\n", ttl_all);
-      h = hash (data->oname);
-      grub_free (dns_cache[h].name);
-      dns_cache[h].name = 0;
-      grub_free (dns_cache[h].addresses);
-      dns_cache[h].addresses = 0;
-      dns_cache[h].name = grub_strdup (data->oname);
-      dns_cache[h].naddresses = *data->naddresses;
-      dns_cache[h].addresses = grub_malloc (*data->naddresses
-					    * sizeof (dns_cache[h].addresses[0]));
-      dns_cache[h].limit_time = grub_get_time_ms () + 1000 * ttl_all;
-      if (!dns_cache[h].addresses || !dns_cache[h].name)
-	{
-	  grub_free (dns_cache[h].name);
-	  dns_cache[h].name = 0;
-	  grub_free (dns_cache[h].addresses);
-	  dns_cache[h].addresses = 0;
-	}
-      grub_memcpy (dns_cache[h].addresses, *data->addresses,
-		   *data->naddresses
-		   * sizeof (dns_cache[h].addresses[0]));
+      q->addresses = addresses;
+      q->naddresses = naddresses;
+      q->ttl = ttl_all;
+      addresses = NULL;
     }
-  grub_netbuff_free (nb);
+  else
+    q->ttl = negative_ttl (ptr, head, nb->tail);
+
+ done:
+  q->done = 1;
+  data->stop = 1;
+ out:
+  grub_free (addresses);
+  grub_free (name);
   grub_free (redirect_save);
+  grub_netbuff_free (nb);
   return GRUB_ERR_NONE;
 }
 
+static int
+server_asks (const struct grub_net_network_level_address *server, int query)
+{
+  if (query == DNS_QUERY_A)
+    return server->option != DNS_OPTION_IPV6;
+  return server->option != DNS_OPTION_IPV4;
+}
+
 grub_err_t
 grub_net_dns_lookup (const char *name,
 		     const struct grub_net_network_level_address *servers,
@@ -435,6 +562,7 @@ grub_net_dns_lookup (const char *name,
 {
   grub_size_t send_servers = 0;
   grub_size_t i, j;
+  int k;
   struct grub_net_buff *nb;
   grub_net_udp_socket_t *sockets;
   grub_uint8_t *optr;
@@ -443,10 +571,13 @@ grub_net_dns_lookup (const char *name,
   static grub_uint16_t id = 1;
   grub_uint8_t *qtypeptr;
   grub_err_t err = GRUB_ERR_NONE;
-  struct recv_data data = {naddresses, addresses, cache,
-			   grub_cpu_to_be16 (id++), 0, 0, name, 0};
+  struct recv_data data;
+  struct dns_query *pref, *other;
   grub_uint8_t *nbd;
   grub_size_t try_server = 0;
+  grub_uint64_t answered = 0;
+  grub_uint32_t ttl;
+  int complete;
 
   if (!servers)
     {
@@ -459,36 +590,55 @@ grub_net_dns_lookup (const char *name,
 		       N_("no DNS servers configured"));
 
   *naddresses = 0;
+  *addresses = NULL;
   if (cache)
     {
-      int h;
-      h = hash (name);
-      if (dns_cache[h].name && grub_strcmp (dns_cache[h].name, name) == 0
-	  && grub_get_time_ms () < dns_cache[h].limit_time)
+      dns_cache_setup ();
+      if (dns_cache_size)
 	{
-	  grub_dprintf ("dns", "retrieved from cache\n");
-	  *addresses = grub_malloc (dns_cache[h].naddresses
-				    * sizeof ((*addresses)[0]));
-	  if (!*addresses)
-	    return grub_errno;
-	  *naddresses = dns_cache[h].naddresses;
-	  grub_memcpy (*addresses, dns_cache[h].addresses,
-		       dns_cache[h].naddresses
-		       * sizeof ((*addresses)[0]));
-	  return GRUB_ERR_NONE;
+	  struct dns_cache_element *e = &dns_cache[hash (name)];
+	  if (e->name && grub_strcmp (e->name, name) == 0
+	      && grub_get_time_ms () < e->limit_time)
+	    {
+	      grub_dprintf ("dns", "retrieved from cache\n");
+	      if (!e->naddresses)
+		return grub_error (GRUB_ERR_NET_NO_DOMAIN,
+				   N_("no DNS record found"));
+	      *addresses = grub_malloc (e->naddresses
+					* sizeof ((*addresses)[0]));
+	      if (!*addresses)
+		return grub_errno;
+	      *naddresses = e->naddresses;
+	      grub_memcpy (*addresses, e->addresses,
+			   e->naddresses * sizeof ((*addresses)[0]));
+	      return GRUB_ERR_NONE;
+	    }
 	}
     }
 
-  sockets = grub_malloc (sizeof (sockets[0]) * n_servers);
-  if (!sockets)
-    return grub_errno;
+  grub_memset (&data, 0, sizeof (data));
+  data.oname = name;
+  for (k = 0; k < DNS_NQUERIES; k++)
+    data.queries[k].id = grub_cpu_to_be16 (id++);
 
-  data.name = grub_strdup (name);
-  if (!data.name)
+  /* The first server's option decides which family is preferred.  Its
+     answer settles the lookup, the other one is only waited for a short
+     while.  */
+  if (servers[0].option == DNS_OPTION_IPV6
+      || servers[0].option == DNS_OPTION_PREFER_IPV6)
     {
-      grub_free (sockets);
-      return grub_errno;
+      pref = &data.queries[DNS_QUERY_AAAA];
+      other = &data.queries[DNS_QUERY_A];
     }
+  else
+    {
+      pref = &data.queries[DNS_QUERY_A];
+      other = &data.queries[DNS_QUERY_AAAA];
+    }
+
+  sockets = grub_malloc (sizeof (sockets[0]) * n_servers);
+  if (!sockets)
+    return grub_errno;
 
   nb = grub_netbuff_alloc (GRUB_NET_OUR_MAX_IP_HEADER_SIZE
 			   + GRUB_NET_MAX_LINK_HEADER_SIZE
@@ -498,7 +648,6 @@ grub_net_dns_lookup (const char *name,
   if (!nb)
     {
       grub_free (sockets);
-      grub_free (data.name);
       return grub_errno;
     }
   grub_netbuff_reserve (nb, GRUB_NET_OUR_MAX_IP_HEADER_SIZE
@@ -517,7 +666,7 @@ grub_net_dns_lookup (const char *name,
       if ((dot - iptr) >= 64)
 	{
 	  grub_free (sockets);
-	  grub_free (data.name);
+	  grub_netbuff_free (nb);
 	  return grub_error (GRUB_ERR_BAD_ARGUMENT,
 			     N_("domain name component is too long"));
 	}
@@ -539,7 +688,6 @@ grub_net_dns_lookup (const char *name,
   *optr++ = 0;
   *optr++ = 1;
 
-  head->id = data.id;
   head->flags = FLAGS_RD;
   head->ra_z_r_code = 0;
   head->qdcount = grub_cpu_to_be16_compile_time (1);
@@ -551,6 +699,8 @@ grub_net_dns_lookup (const char *name,
 
   for (i = 0; i < n_servers * 4; i++)
     {
+      grub_uint64_t now, deadline;
+
       /* Connect to a next server.  */
       while (!(i & 1) && try_server < n_servers)
 	{
@@ -571,59 +721,115 @@ grub_net_dns_lookup (const char *name,
 	}
       if (!send_servers)
 	goto out;
-      if (*data.naddresses)
-	goto out;
+
+      /* Send both queries back to back rather than waiting for one
+	 before asking the other.  */
       for (j = 0; j < send_servers; j++)
+	for (k = 0; k < DNS_NQUERIES; k++)
+	  {
+	    grub_err_t err2;
+
+	    if (data.queries[k].done || !server_asks (&servers[j], k))
+	      continue;
+	    nb->data = nbd;
+	    head->id = data.queries[k].id;
+	    *qtypeptr = (k == DNS_QUERY_A) ? GRUB_DNS_QTYPE_A
+	      : GRUB_DNS_QTYPE_AAAA;
+
+	    grub_dprintf ("dns", "QTYPE: %u QNAME: %s\n", *qtypeptr, name);
+
+	    data.queries[k].sent = 1;
+	    err2 = grub_net_send_udp_packet (sockets[j], nb);
+	    if (err2)
+	      {
+		grub_errno = GRUB_ERR_NONE;
+		err = err2;
+	      }
+	  }
+
+      deadline = grub_get_time_ms () + DNS_RETRANSMIT;
+      while (1)
 	{
-          grub_err_t err2;
-
-          grub_size_t t = 0;
-          do
-            {
-              nb->data = nbd;
-              if (servers[j].option == DNS_OPTION_IPV4 ||
-                 ((servers[j].option == DNS_OPTION_PREFER_IPV4) && (t++ == 0)) ||
-                 ((servers[j].option == DNS_OPTION_PREFER_IPV6) && (t++ == 1)))
-                *qtypeptr = GRUB_DNS_QTYPE_A;
-              else
-                *qtypeptr = GRUB_DNS_QTYPE_AAAA;
-
-              grub_dprintf ("dns", "QTYPE: %u QNAME: %s\n", *qtypeptr, name);
-
-              err2 = grub_net_send_udp_packet (sockets[j], nb);
-              if (err2)
-                {
-                  grub_errno = GRUB_ERR_NONE;
-                  err = err2;
-                }
-              if (*data.naddresses)
-                goto out;
-            }
-          while (t == 1);
+	  now = grub_get_time_ms ();
+	  if ((!pref->sent || pref->done) && (!other->sent || other->done))
+	    goto out;
+	  if (pref->naddresses)
+	    goto out;
+	  if (other->naddresses)
+	    {
+	      if (!answered)
+		answered = now;
+	      if (now >= answered + DNS_RESOLUTION_DELAY)
+		goto out;
+	      if (deadline > answered + DNS_RESOLUTION_DELAY)
+		deadline = answered + DNS_RESOLUTION_DELAY;
+	    }
+	  if (now >= deadline)
+	    break;
+	  data.stop = 0;
+	  grub_net_poll_cards (deadline - now, &data.stop);
 	}
-      grub_net_poll_cards (200, &data.stop);
     }
  out:
-  grub_free (data.name);
   grub_netbuff_free (nb);
   for (j = 0; j < send_servers; j++)
     grub_net_udp_close (sockets[j]);
   
   grub_free (sockets);
 
-  if (*data.naddresses)
-    return GRUB_ERR_NONE;
-  if (data.dns_err)
-    return grub_error (GRUB_ERR_NET_NO_DOMAIN,
-		       N_("no DNS record found"));
-    
-  if (err)
+  if (pref->naddresses || other->naddresses)
+    {
+      *addresses = grub_malloc ((pref->naddresses + other->naddresses)
+				* sizeof ((*addresses)[0]));
+      if (!*addresses)
+	{
+	  err = grub_errno;
+	  goto fail;
+	}
+      grub_memcpy (*addresses, pref->addresses,
+		   pref->naddresses * sizeof ((*addresses)[0]));
+      grub_memcpy (*addresses + pref->naddresses, other->addresses,
+		   other->naddresses * sizeof ((*addresses)[0]));
+      *naddresses = pref->naddresses + other->naddresses;
+      if (cache)
+	{
+	  ttl = ~0U;
+	  for (k = 0; k < DNS_NQUERIES; k++)
+	    if (data.queries[k].naddresses && ttl > data.queries[k].ttl)
+	      ttl = data.queries[k].ttl;
+	  dns_cache_store (name, *addresses, *naddresses, ttl);
+	}
+      err = GRUB_ERR_NONE;
+      goto fail;
+    }
+
+  /* Remember that the name doesn't resolve only if every server asked
+     said so.  */
+  complete = 1;
+  ttl = ~0U;
+  for (k = 0; k < DNS_NQUERIES; k++)
+    if (data.queries[k].sent)
+      {
+	if (!data.queries[k].done || data.queries[k].failed)
+	  complete = 0;
+	else if (ttl > data.queries[k].ttl)
+	  ttl = data.queries[k].ttl;
+      }
+  if (pref->done || other->done)
     {
-      grub_errno = err;
-      return err;
+      if (cache && complete)
+	dns_cache_store (name, NULL, 0, ttl);
+      err = grub_error (GRUB_ERR_NET_NO_DOMAIN, N_("no DNS record found"));
     }
-  return grub_error (GRUB_ERR_TIMEOUT,
-		     N_("no DNS reply received"));
+  else if (err)
+    grub_errno = err;
+  else
+    err = grub_error (GRUB_ERR_TIMEOUT, N_("no DNS reply received"));
+
+ fail:
+  for (k = 0; k < DNS_NQUERIES; k++)
+    grub_free (data.queries[k].addresses);
+  return err;
 }
 
 static grub_err_t
@@ -651,8 +857,9 @@ grub_cmd_nslookup (struct grub_command *cmd __attribute__ ((unused)),
       nservers = dns_nservers;
     }
 
+  /* Only an explicitly given server is asked past the cache.  */
   grub_net_dns_lookup (args[0], servers, nservers, &naddresses,
-                       &addresses, 0);
+                       &addresses, argc == 1);
 
   for (i = 0; i < naddresses; i++)
     {
@@ -775,4 +982,5 @@ grub_dns_fini (void)
   grub_unregister_command (cmd_add);
   grub_unregister_command (cmd_del);
   grub_unregister_command (cmd_list);
+  dns_cache_flush ();
 }
@@ -65,12 +65,12 @@ send_card_buffer (struct grub_net_card *dev __attribute__ ((unused)),
 }
 
 static struct grub_net_buff *
-get_card_packet (struct grub_net_card *dev __attribute__ ((unused)))
+get_card_packet (struct grub_net_card *dev)
 {
   grub_ssize_t actual;
   struct grub_net_buff *nb;
 
-  nb = grub_netbuff_alloc (emucard.mtu + 36 + 2);
+  nb = grub_net_card_rx_alloc (dev, emucard.mtu + 36 + 2);
   if (!nb)
     return NULL;
 
@@ -83,7 +83,8 @@ get_card_packet (struct grub_net_card *dev __attribute__ ((unused)))
       return NULL;
     }
 
-  actual = grub_emunet_receive (nb->data, emucard.mtu + 36);
+  actual = grub_emunet_receive (nb->data, emucard.mtu + 36,
+				&nb->checksum_valid);
   if (actual < 0)
     {
       grub_netbuff_free (nb);
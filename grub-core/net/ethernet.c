@@ -56,6 +56,7 @@ send_ethernet_packet (struct grub_net_network_level_interface *inf,
 {
   struct etherhdr *eth;
   grub_err_t err;
+  grub_size_t len;
 
   COMPILE_TIME_ASSERT (sizeof (*eth) < GRUB_NET_MAX_LINK_HEADER_SIZE);
 
@@ -76,7 +77,16 @@ send_ethernet_packet (struct grub_net_network_level_interface *inf,
 	return err;
       inf->card->opened = 1;
     }
-  return inf->card->driver->send (inf->card, nb);
+  len = nb->tail - nb->data;
+  err = inf->card->driver->send (inf->card, nb);
+  if (err)
+    inf->card->tx_errors++;
+  else
+    {
+      inf->card->tx_packets++;
+      inf->card->tx_bytes += len;
+    }
+  return err;
 }
 
 grub_err_t
@@ -26,14 +26,36 @@
 #include <grub/dl.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 enum
   {
-    HTTP_PORT = 80
+    HTTP_PORT = 80,
+    /* Connections used by one parallel read.  */
+    HTTP_MAX_RANGES = 8,
+    /* Smallest byte range worth its own connection.  */
+    HTTP_MIN_RANGE = 1024 * 1024,
+    /* Idle persistent connections kept around for later requests, enough
+       for all connections of a parallel read.  */
+    HTTP_MAX_IDLE = HTTP_MAX_RANGES
   };
 
+/* A TCP connection to a server.  It belongs either to an open file or,
+   while idle, to the pool.  */
+struct http_conn
+{
+  struct http_conn *next;
+  struct http_conn **prev;
+  char *server;
+  grub_net_tcp_socket_t sock;
+  grub_file_t file;
+  int dead;
+};
+
+static struct http_conn *idle_conns;
+static int num_idle_conns;
 
 typedef struct http_data
 {
@@ -42,6 +64,7 @@ typedef struct http_data
   int headers_recv;
   int first_line_recv;
   int size_recv;
+  struct http_conn *conn;
   grub_net_tcp_socket_t sock;
   char *filename;
   grub_err_t err;
@@ -49,6 +72,18 @@ typedef struct http_data
   int chunked;
   grub_size_t chunk_rem;
   int in_chunk_len;
+  int have_length;
+  grub_uint64_t content_length;
+  grub_uint64_t body_recv;
+  int conn_close;
+  /* The server answered with a partial response.  */
+  int partial;
+  /* End of the requested byte range, or 0 for the rest of the file.  */
+  grub_off_t range_end;
+  /* Set whenever data arrives or the connection is lost.  */
+  int *notify;
+  /* Reading over parallel ranges failed, use this connection only.  */
+  int no_ranges;
 } *http_data_t;
 
 static grub_off_t
@@ -113,7 +148,9 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
       switch (code)
 	{
 	case 200:
+	  break;
 	case 206:
+	  data->partial = 1;
 	  break;
 	case 404:
 	  data->err = GRUB_ERR_FILE_NOT_FOUND;
@@ -131,11 +168,22 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Content-Length: ", sizeof ("Content-Length: ") - 1)
-      == 0 && !data->size_recv)
+      == 0)
     {
       ptr += sizeof ("Content-Length: ") - 1;
-      file->size = grub_strtoull (ptr, &ptr, 10);
-      data->size_recv = 1;
+      data->content_length = grub_strtoull (ptr, &ptr, 10);
+      data->have_length = 1;
+      if (!data->size_recv)
+	{
+	  file->size = data->content_length;
+	  data->size_recv = 1;
+	}
+      return GRUB_ERR_NONE;
+    }
+  if (grub_strncasecmp (ptr, "Connection: close",
+			sizeof ("Connection: close") - 1) == 0)
+    {
+      data->conn_close = 1;
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Transfer-Encoding: chunked",
@@ -148,12 +196,25 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
   return GRUB_ERR_NONE;  
 }
 
+static void
+http_abort (http_data_t data)
+{
+  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+  data->sock = 0;
+}
+
 static void
 http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
-	  void *f)
+	  void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  grub_file_t file = conn->file;
+  http_data_t data;
+
+  conn->dead = 1;
+  if (!file)
+    return;
+  data = file->data;
 
   if (data->sock)
     grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
@@ -165,17 +226,29 @@ http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
   file->device->net->stall = 1;
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = have_ahead (file);
+  if (data->notify)
+    *data->notify = 1;
 }
 
 static grub_err_t
 http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
-	      void *f)
+	      void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  grub_file_t file = conn->file;
+  http_data_t data;
   grub_err_t err;
 
+  /* Nothing is expected on an idle connection.  */
+  if (!file)
+    {
+      conn->dead = 1;
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
+  data = file->data;
   if (!data->sock)
     {
       grub_netbuff_free (nb);
@@ -202,7 +275,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  if (!t)
 	    {
 	      grub_netbuff_free (nb);
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      http_abort (data);
 	      return grub_errno;
 	    }
 	      
@@ -222,7 +295,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  data->current_line_len = 0;
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      http_abort (data);
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
@@ -239,7 +312,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      if (!data->current_line)
 		{
 		  grub_netbuff_free (nb);
-		  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+		  http_abort (data);
 		  return grub_errno;
 		}
 	      data->current_line_len = (char *) nb->tail - ptr;
@@ -250,7 +323,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  err = parse_line (file, data, ptr, ptr2 - ptr);
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      http_abort (data);
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
@@ -265,13 +338,24 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
       err = grub_netbuff_pull (nb, ptr - (char *) nb->data);
       if (err)
 	{
-	  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	  http_abort (data);
 	  grub_netbuff_free (nb);
 	  return err;
 	}
       if (!(data->chunked && (grub_ssize_t) data->chunk_rem
 	    < nb->tail - nb->data))
 	{
+	  data->body_recv += nb->tail - nb->data;
+	  if (data->chunked)
+	    data->chunk_rem -= nb->tail - nb->data;
+	  if (data->notify)
+	    *data->notify = 1;
+	  if (grub_net_fill_reader (file->device->net, nb))
+	    {
+	      grub_netbuff_free (nb);
+	      return GRUB_ERR_NONE;
+	    }
+
 	  grub_net_put_packet (&file->device->net->packs, nb);
 	  if (file->device->net->packs.count >= 20)
 	    file->device->net->stall = 1;
@@ -279,8 +363,6 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  if (file->device->net->packs.count >= 100)
 	    grub_net_tcp_stall (data->sock);
 
-	  if (data->chunked)
-	    data->chunk_rem -= nb->tail - nb->data;
 	  return GRUB_ERR_NONE;
 	}
       if (data->chunk_rem)
@@ -304,12 +386,115 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
     }
 }
 
+/* Whether the connection is at the end of a response the server wants to
+   keep the connection open after.  */
+static int
+http_reusable (http_data_t data)
+{
+  return (data->sock && !data->conn->dead && data->headers_recv
+	  && !data->err && !data->errmsg && !data->conn_close
+	  && !data->chunked && data->have_length
+	  && data->body_recv == data->content_length);
+}
+
+/* Detach the connection from DATA, keeping it for later requests if
+   possible.  */
+static void
+http_conn_release (http_data_t data)
+{
+  struct http_conn *conn = data->conn;
+  int reusable;
+
+  if (!conn)
+    return;
+  reusable = http_reusable (data);
+  data->conn = 0;
+  conn->file = 0;
+
+  if (reusable && num_idle_conns < HTTP_MAX_IDLE)
+    {
+      grub_net_tcp_unstall (data->sock);
+      grub_list_push (GRUB_AS_LIST_P (&idle_conns), GRUB_AS_LIST (conn));
+      num_idle_conns++;
+      data->sock = 0;
+      return;
+    }
+
+  if (data->sock)
+    http_abort (data);
+  grub_free (conn->server);
+  grub_free (conn);
+}
+
+static void
+http_conn_destroy (struct http_conn *conn)
+{
+  grub_list_remove (GRUB_AS_LIST (conn));
+  num_idle_conns--;
+  grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+  grub_free (conn->server);
+  grub_free (conn);
+}
+
+/* Attach a connection to the server to FILE, preferably an idle one.  */
 static grub_err_t
-http_establish (struct grub_file *file, grub_off_t offset, int initial)
+http_conn_get (struct grub_file *file, int *reused)
+{
+  http_data_t data = file->data;
+  const char *server = file->device->net->server;
+  struct http_conn *conn, *next;
+
+  *reused = 0;
+  for (conn = idle_conns; conn; conn = next)
+    {
+      next = conn->next;
+      if (conn->dead)
+	{
+	  http_conn_destroy (conn);
+	  continue;
+	}
+      if (grub_strcmp (conn->server, server) != 0)
+	continue;
+      grub_list_remove (GRUB_AS_LIST (conn));
+      num_idle_conns--;
+      *reused = 1;
+      break;
+    }
+
+  if (!conn)
+    {
+      conn = grub_zalloc (sizeof (*conn));
+      if (!conn)
+	return grub_errno;
+      conn->server = grub_strdup (server);
+      if (!conn->server)
+	{
+	  grub_free (conn);
+	  return grub_errno;
+	}
+      conn->sock = grub_net_tcp_open (file->device->net->server,
+				      HTTP_PORT, http_receive,
+				      http_err, http_err,
+				      conn);
+      if (!conn->sock)
+	{
+	  grub_free (conn->server);
+	  grub_free (conn);
+	  return grub_errno;
+	}
+    }
+
+  conn->file = file;
+  data->conn = conn;
+  data->sock = conn->sock;
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_net_buff *
+http_request (struct grub_file *file, grub_off_t offset, int initial)
 {
   http_data_t data = file->data;
   grub_uint8_t *ptr;
-  int i;
   struct grub_net_buff *nb;
   grub_err_t err;
 
@@ -321,9 +506,9 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 			   + sizeof ("\r\nUser-Agent: " PACKAGE_STRING
 				     "\r\n") - 1
 			   + sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX"
-				     "-\r\n\r\n"));
+				     "-XXXXXXXXXXXXXXXXXXXX\r\n\r\n"));
   if (!nb)
-    return grub_errno;
+    return NULL;
 
   grub_netbuff_reserve (nb, GRUB_NET_TCP_RESERVE_SIZE);
   ptr = nb->tail;
@@ -331,7 +516,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, "GET ", sizeof ("GET ") - 1);
 
@@ -341,7 +526,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, data->filename, grub_strlen (data->filename));
 
@@ -350,7 +535,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, " HTTP/1.1\r\nHost: ",
 	       sizeof (" HTTP/1.1\r\nHost: ") - 1);
@@ -360,7 +545,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, file->device->net->server,
 	       grub_strlen (file->device->net->server));
@@ -372,11 +557,22 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, "\r\nUser-Agent: " PACKAGE_STRING "\r\n",
 	       sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n") - 1);
-  if (!initial)
+  if (!initial && data->range_end)
+    {
+      ptr = nb->tail;
+      grub_snprintf ((char *) ptr,
+		     sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
+			     "XXXXXXXXXXXXXXXXXXXX\r\n"),
+		     "Range: bytes=%" PRIuGRUB_UINT64_T "-%"
+		     PRIuGRUB_UINT64_T "\r\n",
+		     offset, data->range_end - 1);
+      grub_netbuff_put (nb, grub_strlen ((char *) ptr));
+    }
+  else if (!initial)
     {
       ptr = nb->tail;
       grub_snprintf ((char *) ptr,
@@ -390,45 +586,67 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   grub_netbuff_put (nb, 2);
   grub_memcpy (ptr, "\r\n", 2);
 
-  data->sock = grub_net_tcp_open (file->device->net->server,
-				  HTTP_PORT, http_receive,
-				  http_err, http_err,
-				  file);
-  if (!data->sock)
-    {
-      grub_netbuff_free (nb);
-      return grub_errno;
-    }
+  return nb;
+}
 
-  //  grub_net_poll_cards (5000);
+static grub_err_t
+http_establish (struct grub_file *file, grub_off_t offset, int initial)
+{
+  http_data_t data = file->data;
+  grub_off_t size = file->size;
+  struct grub_net_buff *nb;
+  grub_err_t err;
+  int i, reused;
 
-  err = grub_net_send_tcp_packet (data->sock, nb, 1);
-  if (err)
+  while (1)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-      return err;
-    }
+      nb = http_request (file, offset, initial);
+      if (!nb)
+	return grub_errno;
 
-  for (i = 0; !data->headers_recv && i < 100; i++)
-    {
-      grub_net_tcp_retransmit ();
-      grub_net_poll_cards (300, &data->headers_recv);
-    }
+      err = http_conn_get (file, &reused);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  return err;
+	}
 
-  if (!data->headers_recv)
-    {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-      if (data->err)
+      err = grub_net_send_tcp_packet (data->sock, nb, 1);
+      if (err)
 	{
-	  char *str = data->errmsg;
-	  err = grub_error (data->err, "%s", str);
-	  grub_free (str);
-	  data->errmsg = 0;
-	  return data->err;
+	  http_conn_release (data);
+	  return err;
 	}
-      return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), data->filename);
+
+      for (i = 0; !data->headers_recv && data->sock && i < 100; i++)
+	{
+	  grub_net_tcp_retransmit ();
+	  grub_net_poll_cards (300, &data->headers_recv);
+	}
+
+      if (data->headers_recv)
+	return GRUB_ERR_NONE;
+
+      /* The server may have closed an idle connection before seeing our
+	 request.  Try again on a new one.  */
+      if (!reused || data->sock || data->err || data->first_line_recv)
+	break;
+      http_conn_release (data);
+      file->size = size;
+      file->device->net->eof = 0;
+      file->device->net->stall = 0;
     }
-  return GRUB_ERR_NONE;
+
+  http_conn_release (data);
+  if (data->err)
+    {
+      char *str = data->errmsg;
+      err = grub_error (data->err, "%s", str);
+      grub_free (str);
+      data->errmsg = 0;
+      return data->err;
+    }
+  return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), data->filename);
 }
 
 static grub_err_t
@@ -437,10 +655,9 @@ http_seek (struct grub_file *file, grub_off_t off)
   struct http_data *old_data, *data;
   grub_err_t err;
   old_data = file->data;
-  /* FIXME: Reuse socket?  */
-  if (old_data->sock)
-    grub_net_tcp_close (old_data->sock, GRUB_NET_TCP_ABORT);
-  old_data->sock = 0;
+  http_conn_release (old_data);
+  if (old_data->current_line)
+    grub_free (old_data->current_line);
 
   while (file->device->net->packs.first)
     {
@@ -457,6 +674,7 @@ http_seek (struct grub_file *file, grub_off_t off)
     return grub_errno;
 
   data->size_recv = 1;
+  data->no_ranges = old_data->no_ranges;
   data->filename = old_data->filename;
   if (!data->filename)
     {
@@ -518,8 +736,7 @@ http_close (struct grub_file *file)
   if (!data)
     return GRUB_ERR_NONE;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+  http_conn_release (data);
   if (data->current_line)
     grub_free (data->current_line);
   grub_free (data->filename);
@@ -542,13 +759,276 @@ http_packets_pulled (struct grub_file *file)
   return 0;
 }
 
+/* A byte range of a file fetched over a connection of its own by
+   http_bulk_read.  */
+struct http_range
+{
+  struct grub_file file;
+  struct grub_device dev;
+  struct grub_net net;
+  grub_off_t pos;
+  grub_off_t end;
+  int tries;
+};
+
+static unsigned long
+parallel_connections (void)
+{
+  const char *val;
+  unsigned long n;
+  char *end;
+
+  val = grub_env_get ("net_http_connections");
+  if (!val)
+    return 1;
+  n = grub_strtoul (val, &end, 0);
+  if (grub_errno || *end)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 1;
+    }
+  if (n > HTTP_MAX_RANGES)
+    n = HTTP_MAX_RANGES;
+  return n;
+}
+
+static void
+http_range_close (struct http_range *range)
+{
+  http_data_t data = range->file.data;
+
+  if (!data)
+    return;
+  http_conn_release (data);
+  grub_free (data->current_line);
+  grub_free (data);
+  range->file.data = 0;
+
+  while (range->net.packs.first)
+    {
+      grub_netbuff_free (range->net.packs.first->nb);
+      grub_net_remove_packet (range->net.packs.first);
+    }
+}
+
+/* Request the rest of RANGE on a connection of its own.  */
+static grub_err_t
+http_range_open (struct grub_file *file, struct http_range *range,
+		 int *notify)
+{
+  http_data_t data;
+  grub_err_t err;
+
+  data = grub_zalloc (sizeof (*data));
+  if (!data)
+    return grub_errno;
+  data->size_recv = 1;
+  data->filename = ((http_data_t) file->data)->filename;
+  data->range_end = range->end;
+  data->notify = notify;
+
+  range->net = *file->device->net;
+  range->net.packs.first = 0;
+  range->net.packs.last = 0;
+  range->net.packs.count = 0;
+  range->net.offset = range->pos;
+  range->net.eof = 0;
+  range->net.stall = 0;
+  range->net.read_len = 0;
+  range->dev.disk = 0;
+  range->dev.net = &range->net;
+  range->file.device = &range->dev;
+  range->file.size = file->size;
+  range->file.data = data;
+
+  err = http_establish (&range->file, range->pos, 0);
+  if (err)
+    {
+      http_range_close (range);
+      return err;
+    }
+  if (!data->partial)
+    {
+      http_range_close (range);
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("server ignored range request for `%s'"),
+			 file->device->net->name);
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Move everything RANGE received into BUF, which holds the file from
+   offset BASE.  */
+static void
+http_range_pull (struct grub_file *file, struct http_range *range,
+		 char *buf, grub_off_t base)
+{
+  struct grub_net_buff *nb;
+  grub_size_t amount;
+
+  while (range->net.packs.first)
+    {
+      nb = range->net.packs.first->nb;
+      amount = nb->tail - nb->data;
+      if (amount > range->end - range->pos)
+	amount = range->end - range->pos;
+      grub_memcpy (buf + (range->pos - base), nb->data, amount);
+      range->pos += amount;
+      if (grub_file_progress_hook)
+	grub_file_progress_hook (0, 0, amount, file);
+      grub_netbuff_free (nb);
+      grub_net_remove_packet (range->net.packs.first);
+    }
+  range->net.offset = range->pos;
+  http_packets_pulled (&range->file);
+}
+
+/* Split large reads into byte ranges fetched over several connections at
+   once.  The file's own connection is dropped and reopened after the
+   data read.  */
+static grub_ssize_t
+http_bulk_read (struct grub_file *file, char *buf, grub_size_t len)
+{
+  grub_net_t net = file->device->net;
+  http_data_t data = file->data;
+  struct http_range ranges[HTTP_MAX_RANGES];
+  struct grub_net_buff *nb;
+  grub_off_t base = net->offset, start, end, chunk;
+  grub_size_t amount;
+  unsigned long n, i;
+  int notify = 0, pending, try = 0;
+  grub_err_t err;
+
+  n = parallel_connections ();
+  if (n < 2 || !data || !data->sock || data->no_ranges
+      || file->size == GRUB_FILE_SIZE_UNKNOWN)
+    return 0;
+
+  start = have_ahead (file);
+  end = base + len;
+  if (end > file->size)
+    end = file->size;
+  if (end <= start || end - start < 2 * HTTP_MIN_RANGE)
+    return 0;
+  if (n > (end - start) / HTTP_MIN_RANGE)
+    n = (end - start) / HTTP_MIN_RANGE;
+  chunk = (end - start) / n;
+
+  grub_memset (ranges, 0, sizeof (ranges));
+  for (i = 0; i < n; i++)
+    {
+      ranges[i].pos = start + i * chunk;
+      ranges[i].end = (i == n - 1) ? end : start + (i + 1) * chunk;
+    }
+
+  /* Fall back to the single connection if the server can't serve
+     ranges.  */
+  if (http_range_open (file, &ranges[0], &notify))
+    {
+      grub_dprintf ("http", "parallel read failed: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      data->no_ranges = 1;
+      return 0;
+    }
+
+  /* Whatever the file's connection delivers from now on is fetched by the
+     ranges instead.  */
+  http_conn_release (data);
+  net->eof = 1;
+  net->stall = 1;
+
+  for (i = 1; i < n; i++)
+    if (http_range_open (file, &ranges[i], &notify))
+      goto fail;
+
+  while (1)
+    {
+      pending = 0;
+      for (i = 0; i < n; i++)
+	{
+	  struct http_range *range = &ranges[i];
+
+	  if (range->pos == range->end)
+	    continue;
+	  http_range_pull (file, range, buf, base);
+	  if (range->pos == range->end)
+	    {
+	      http_range_close (range);
+	      continue;
+	    }
+	  if (range->net.eof)
+	    {
+	      /* The connection was lost.  Ask for the rest again.  */
+	      http_range_close (range);
+	      if (++range->tries > GRUB_NET_TRIES
+		  || http_range_open (file, range, &notify))
+		goto fail;
+	    }
+	  pending = 1;
+	}
+      if (!pending)
+	break;
+
+      notify = 0;
+      grub_net_poll_cards (GRUB_NET_INTERVAL
+			   + (try * GRUB_NET_INTERVAL_ADDITION), &notify);
+      if (notify)
+	try = 0;
+      else if (++try > GRUB_NET_TRIES)
+	{
+	  grub_error (GRUB_ERR_TIMEOUT, N_("timeout reading `%s'"), net->name);
+	  goto fail;
+	}
+    }
+
+  /* Take what the file's connection received before the ranges.  */
+  while (net->packs.first)
+    {
+      nb = net->packs.first->nb;
+      amount = nb->tail - nb->data;
+      if (amount > start - net->offset)
+	amount = start - net->offset;
+      grub_memcpy (buf + (net->offset - base), nb->data, amount);
+      net->offset += amount;
+      if (grub_file_progress_hook && amount)
+	grub_file_progress_hook (0, 0, amount, file);
+      grub_netbuff_free (nb);
+      grub_net_remove_packet (net->packs.first);
+    }
+
+  if (end < file->size)
+    {
+      err = http_seek (file, end);
+      if (err)
+	return -1;
+    }
+  else
+    net->offset = end;
+
+  return end - base;
+
+ fail:
+  /* The server may limit the connections per client or drop some of
+     them.  Give up on the ranges and let the file's own connection read
+     everything from BASE again.  */
+  grub_dprintf ("http", "parallel read failed: %s\n", grub_errmsg);
+  grub_errno = GRUB_ERR_NONE;
+  for (i = 0; i < n; i++)
+    http_range_close (&ranges[i]);
+  data->no_ranges = 1;
+  if (http_seek (file, base))
+    return -1;
+  return 0;
+}
+
 static struct grub_net_app_protocol grub_http_protocol = 
   {
     .name = "http",
     .open = http_open,
     .close = http_close,
     .seek = http_seek,
-    .packets_pulled = http_packets_pulled
+    .packets_pulled = http_packets_pulled,
+    .bulk_read = http_bulk_read
   };
 
 GRUB_MOD_INIT (http)
@@ -558,5 +1038,7 @@ GRUB_MOD_INIT (http)
 
 GRUB_MOD_FINI (http)
 {
+  while (idle_conns)
+    http_conn_destroy (idle_conns);
   grub_net_app_level_unregister (&grub_http_protocol);
 }
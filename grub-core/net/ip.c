@@ -92,29 +92,44 @@ struct reassemble
 
 static struct reassemble *reassembles;
 
+static inline grub_uint64_t
+chksum_add (grub_uint64_t sum, grub_uint64_t val)
+{
+  sum += val;
+  return sum + (sum < val);
+}
+
 grub_uint16_t
 grub_net_ip_chksum (void *ipv, grub_size_t len)
 {
-  grub_uint16_t *ip = (grub_uint16_t *) ipv;
-  grub_uint32_t sum = 0;
-
-  for (; len >= 2; len -= 2)
+  grub_uint8_t *ptr = ipv;
+  grub_uint64_t sum = 0, last = 0;
+
+  /* The one's complement sum is the same in either byte order but for a
+     final swap, so add the data in the native order 64 bits at a time
+     with the carries folded back in.  Stored natively, the result is in
+     network order.  */
+  for (; len >= 32; len -= 32, ptr += 32)
     {
-      sum += grub_be_to_cpu16 (grub_get_unaligned16 (ip++));
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      sum = chksum_add (sum, grub_get_unaligned64 (ptr));
+      sum = chksum_add (sum, grub_get_unaligned64 (ptr + 8));
+      sum = chksum_add (sum, grub_get_unaligned64 (ptr + 16));
+      sum = chksum_add (sum, grub_get_unaligned64 (ptr + 24));
     }
-  if (len)
-    {
-      sum += *((grub_uint8_t *) ip) << 8;
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
-    }
-
-  if (sum >= 0xFFFF)
-    sum -= 0xFFFF;
-
-  return grub_cpu_to_be16 ((~sum) & 0x0000FFFF);
+  for (; len >= 8; len -= 8, ptr += 8)
+    sum = chksum_add (sum, grub_get_unaligned64 (ptr));
+  grub_memcpy (&last, ptr, len);
+  sum = chksum_add (sum, last);
+
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  /* Of the two zeros, give the one whose complement isn't 0.  */
+  if (sum == 0xffff)
+    sum = 0;
+
+  return ~sum;
 }
 
 static int id = 0x2400;
@@ -241,7 +256,7 @@ handle_dgram (struct grub_net_buff *nb,
     if (proto == GRUB_NET_IP_UDP && grub_be_to_cpu16 (udph->dst) == 68)
       {
 	const struct grub_net_bootp_packet *bootp;
-	if (udph->chksum)
+	if (udph->chksum && !nb->checksum_valid)
 	  {
 	    grub_uint16_t chk, expected;
 	    chk = udph->chksum;
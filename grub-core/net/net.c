@@ -192,9 +192,32 @@ grub_net_card_unregister (struct grub_net_card *card)
 	card->driver->close (card);
       card->opened = 0;
     }
+  grub_netbuff_pool_destroy (card->rx_pool);
+  card->rx_pool = NULL;
   grub_list_remove (GRUB_AS_LIST (card));
 }
 
+/* Buffers preallocated for each card's received packets.  */
+#define GRUB_NET_RX_POOL_SIZE 128
+
+/* Get a buffer for a packet of up to LEN bytes received by CARD.  */
+struct grub_net_buff *
+grub_net_card_rx_alloc (struct grub_net_card *card, grub_size_t len)
+{
+  struct grub_net_buff *nb;
+
+  if (!card->rx_pool)
+    card->rx_pool = grub_netbuff_pool_new (card->mtu + 64 + 2,
+					   GRUB_NET_RX_POOL_SIZE);
+  if (card->rx_pool)
+    nb = grub_netbuff_pool_alloc (card->rx_pool, len);
+  else
+    nb = grub_netbuff_alloc (len);
+  if (!nb)
+    card->rx_alloc_failures++;
+  return nb;
+}
+
 static struct grub_net_slaac_mac_list *
 grub_net_ipv6_get_slaac (struct grub_net_card *card,
 			 const grub_net_link_level_address_t *hwaddr)
@@ -1231,6 +1254,16 @@ grub_cmd_listcards (struct grub_command *cmd __attribute__ ((unused)),
     char buf[GRUB_NET_MAX_STR_HWADDR_LEN];
     grub_net_hwaddr_to_str (&card->default_address, buf);
     grub_printf ("%s %s\n", card->name, buf);
+    grub_printf ("  rx: %llu packets, %llu bytes, %llu dropped,"
+		 " %llu allocation failures\n",
+		 (unsigned long long) card->rx_packets,
+		 (unsigned long long) card->rx_bytes,
+		 (unsigned long long) card->rx_dropped,
+		 (unsigned long long) card->rx_alloc_failures);
+    grub_printf ("  tx: %llu packets, %llu bytes, %llu errors\n",
+		 (unsigned long long) card->tx_packets,
+		 (unsigned long long) card->tx_bytes,
+		 (unsigned long long) card->tx_errors);
   }
   return GRUB_ERR_NONE;
 }
@@ -1467,10 +1500,15 @@ grub_net_fs_close (grub_file_t file)
   return GRUB_ERR_NONE;
 }
 
+/* Bounds of the number of packets taken from a card per poll.  */
+#define GRUB_NET_MIN_BATCH 32
+#define GRUB_NET_MAX_BATCH 1024
+
 static void
 receive_packets (struct grub_net_card *card, int *stop_condition)
 {
-  int received = 0;
+  unsigned received = 0;
+  int drained = 0;
   if (card->num_ifaces == 0)
     return;
   if (!card->opened)
@@ -1485,10 +1523,10 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
 	}
       card->opened = 1;
     }
-  while (received < 100)
+  if (!card->rx_batch)
+    card->rx_batch = GRUB_NET_MIN_BATCH;
+  while (received < card->rx_batch)
     {
-      /* Maybe should be better have a fixed number of packets for each card
-	 and just mark them as used and not used.  */ 
       struct grub_net_buff *nb;
 
       if (received > 10 && stop_condition && *stop_condition)
@@ -1498,17 +1536,32 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
       if (!nb)
 	{
 	  card->last_poll = grub_get_time_ms ();
+	  drained = 1;
 	  break;
 	}
       received++;
+      card->rx_packets++;
+      card->rx_bytes += nb->tail - nb->data;
       grub_net_recv_ethernet_packet (nb, card);
       if (grub_errno)
 	{
+	  card->rx_dropped++;
 	  grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
 			grub_errmsg);
 	  grub_errno = GRUB_ERR_NONE;
 	}
     }
+
+  /* Follow the arrival rate: take more packets per poll while the card
+     still has some at the end of a batch, fewer when it runs dry early.
+     TCP acknowledges what a batch brought once the batch is over.  */
+  if (received == card->rx_batch && card->rx_batch < GRUB_NET_MAX_BATCH)
+    card->rx_batch *= 2;
+  else if (drained && received < card->rx_batch / 4
+	   && card->rx_batch > GRUB_NET_MIN_BATCH)
+    card->rx_batch /= 2;
+
+  grub_net_tcp_flush_acks ();
   grub_print_error ();
 }
 
@@ -1578,6 +1631,30 @@ grub_net_poll_cards_idle_real (void)
   grub_net_tcp_retransmit ();
 }
 
+/* Copy the next in-order data NB of NET straight into the buffer of a
+   pending read, skipping the packet queue.  Returns whether all of NB was
+   taken.  */
+int
+grub_net_fill_reader (grub_net_t net, struct grub_net_buff *nb)
+{
+  grub_size_t amount;
+
+  if (!net->read_len || net->packs.first)
+    return 0;
+
+  amount = nb->tail - nb->data;
+  if (amount > net->read_len)
+    amount = net->read_len;
+  grub_memcpy (net->read_buf, nb->data, amount);
+  net->read_buf += amount;
+  net->read_len -= amount;
+  net->offset += amount;
+  nb->data += amount;
+  if (!net->read_len)
+    net->stall = 1;
+  return nb->data == nb->tail;
+}
+
 /*  Read from the packets list*/
 static grub_ssize_t
 grub_net_fs_read_real (grub_file_t file, char *buf, grub_size_t len)
@@ -1587,12 +1664,17 @@ grub_net_fs_read_real (grub_file_t file, char *buf, grub_size_t len)
   char *ptr = buf;
   grub_size_t amount, total = 0;
   int try = 0;
+  /* Poll briefly while data keeps coming, so that queued packets are
+     handed over before the queue stalls, and back off to the full retry
+     interval once the line goes quiet.  */
+  unsigned interval = GRUB_NET_MIN_INTERVAL;
 
   while (try <= GRUB_NET_TRIES)
     {
       while (net->packs.first)
 	{
 	  try = 0;
+	  interval = GRUB_NET_MIN_INTERVAL;
 	  nb = net->packs.first->nb;
 	  amount = nb->tail - nb->data;
 	  if (amount > len)
@@ -1627,12 +1709,43 @@ grub_net_fs_read_real (grub_file_t file, char *buf, grub_size_t len)
 
       if (!net->eof)
 	{
-	  try++;
-	  grub_net_poll_cards (GRUB_NET_INTERVAL +
-                               (try * GRUB_NET_INTERVAL_ADDITION), &net->stall);
+	  /* Let the protocol put in-order data straight into BUF.  */
+	  net->read_buf = ptr;
+	  net->read_len = buf ? len : 0;
+	  grub_net_poll_cards (interval + (try * GRUB_NET_INTERVAL_ADDITION),
+			       &net->stall);
+	  amount = buf ? len - net->read_len : 0;
+	  net->read_len = 0;
+	  if (amount)
+	    {
+	      try = 0;
+	      interval = GRUB_NET_MIN_INTERVAL;
+	      ptr += amount;
+	      len -= amount;
+	      total += amount;
+	      if (grub_file_progress_hook)
+		grub_file_progress_hook (0, 0, amount, file);
+	      if (!len)
+		{
+		  if (net->protocol->packets_pulled)
+		    net->protocol->packets_pulled (file);
+		  return total;
+		}
+	    }
+	  /* Only polls of the full interval count towards the timeout.  */
+	  else if (interval < GRUB_NET_INTERVAL)
+	    interval = grub_min (2 * interval, GRUB_NET_INTERVAL);
+	  else
+	    try++;
         }
       else
-	return total;
+	{
+	  /* The protocol couldn't tell the size up front; now it's known.
+	     Without it bufio would read the last block again and again.  */
+	  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+	    file->size = net->offset;
+	  return total;
+	}
     }
   grub_error (GRUB_ERR_TIMEOUT, N_("timeout reading `%s'"), net->name);
   return -1;
@@ -1649,6 +1762,11 @@ have_ahead (struct grub_file *file)
   return ret;
 }
 
+/* Forward seeks of up to this many bytes past the received data read
+   through the current connection rather than asking the protocol to
+   seek.  */
+#define GRUB_NET_SEEK_SKIP (256 * 1024)
+
 static grub_err_t 
 grub_net_seek_real (struct grub_file *file, grub_off_t offset)
 {
@@ -1657,7 +1775,8 @@ grub_net_seek_real (struct grub_file *file, grub_off_t offset)
 
   if (offset > file->device->net->offset)
     {
-      if (!file->device->net->protocol->seek || have_ahead (file) >= offset)
+      if (!file->device->net->protocol->seek
+	  || have_ahead (file) + GRUB_NET_SEEK_SKIP >= offset)
 	{
 	  grub_net_fs_read_real (file, NULL,
 				 offset - file->device->net->offset);
@@ -1693,14 +1812,30 @@ grub_net_seek_real (struct grub_file *file, grub_off_t offset)
 static grub_ssize_t
 grub_net_fs_read (grub_file_t file, char *buf, grub_size_t len)
 {
-  if (file->offset != file->device->net->offset)
+  grub_net_t net = file->device->net;
+  grub_ssize_t bulk = 0, ret;
+
+  if (file->offset != net->offset)
     {
       grub_err_t err;
       err = grub_net_seek_real (file, file->offset);
       if (err)
 	return err;
     }
-  return grub_net_fs_read_real (file, buf, len);
+  if (buf && net->protocol->bulk_read)
+    {
+      bulk = net->protocol->bulk_read (file, buf, len);
+      if (bulk < 0)
+	return -1;
+      if ((grub_size_t) bulk == len)
+	return bulk;
+      buf += bulk;
+      len -= bulk;
+    }
+  ret = grub_net_fs_read_real (file, buf, len);
+  if (ret < 0)
+    return -1;
+  return bulk + ret;
 }
 
 static struct grub_fs grub_net_fs =
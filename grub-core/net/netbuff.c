@@ -21,6 +21,16 @@
 #include <grub/mm.h>
 #include <grub/net/netbuff.h>
 
+/* A set of buffers of the same size that are recycled rather than freed,
+   to spare the heap the allocations of every received packet.  */
+struct grub_net_buff_pool
+{
+  struct grub_net_buff *free;
+  grub_size_t len;
+  unsigned in_use;
+  int dead;
+};
+
 grub_err_t
 grub_netbuff_put (struct grub_net_buff *nb, grub_size_t len)
 {
@@ -94,6 +104,8 @@ grub_netbuff_alloc (grub_size_t len)
 				 + len / sizeof (grub_properly_aligned_t));
   nb->head = nb->data = nb->tail = data;
   nb->end = (grub_uint8_t *) nb;
+  nb->pool = NULL;
+  nb->checksum_valid = 0;
   return nb;
 }
 
@@ -117,12 +129,95 @@ grub_netbuff_make_pkt (grub_size_t len)
   return NULL;
 }
 
+static void
+pool_release (struct grub_net_buff_pool *pool)
+{
+  struct grub_net_buff *nb, *next;
+
+  for (nb = pool->free; nb; nb = next)
+    {
+      next = nb->pool_next;
+      grub_free (nb->head);
+    }
+  grub_free (pool);
+}
+
 void
 grub_netbuff_free (struct grub_net_buff *nb)
 {
+  struct grub_net_buff_pool *pool;
+
   if (!nb)
     return;
-  grub_free (nb->head);
+  pool = nb->pool;
+  if (!pool)
+    {
+      grub_free (nb->head);
+      return;
+    }
+
+  nb->pool_next = pool->free;
+  pool->free = nb;
+  pool->in_use--;
+  if (pool->dead && !pool->in_use)
+    pool_release (pool);
+}
+
+/* Preallocate up to COUNT buffers of LEN bytes.  */
+struct grub_net_buff_pool *
+grub_netbuff_pool_new (grub_size_t len, unsigned count)
+{
+  struct grub_net_buff_pool *pool;
+  struct grub_net_buff *nb;
+  unsigned i;
+
+  pool = grub_zalloc (sizeof (*pool));
+  if (!pool)
+    return NULL;
+  pool->len = ALIGN_UP (len, NETBUFF_ALIGN);
+
+  for (i = 0; i < count; i++)
+    {
+      nb = grub_netbuff_alloc (len);
+      if (!nb)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  break;
+	}
+      nb->pool = pool;
+      nb->pool_next = pool->free;
+      pool->free = nb;
+    }
+  return pool;
+}
+
+/* Take a buffer from POOL, or from the heap if none of LEN bytes is
+   free.  */
+struct grub_net_buff *
+grub_netbuff_pool_alloc (struct grub_net_buff_pool *pool, grub_size_t len)
+{
+  struct grub_net_buff *nb;
+
+  if (len > pool->len || !pool->free)
+    return grub_netbuff_alloc (len);
+
+  nb = pool->free;
+  pool->free = nb->pool_next;
+  pool->in_use++;
+  nb->data = nb->tail = nb->head;
+  nb->checksum_valid = 0;
+  return nb;
+}
+
+/* Free POOL once all of its buffers are back.  */
+void
+grub_netbuff_pool_destroy (struct grub_net_buff_pool *pool)
+{
+  if (!pool)
+    return;
+  pool->dead = 1;
+  if (!pool->in_use)
+    pool_release (pool);
 }
 
 grub_err_t
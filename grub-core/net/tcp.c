@@ -22,12 +22,28 @@
 #include <grub/net/netbuff.h>
 #include <grub/time.h>
 #include <grub/priority_queue.h>
+#include <grub/env.h>
+#include <grub/mm.h>
 
 #define TCP_SYN_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_SYN_RETRANSMISSION_COUNT GRUB_NET_TRIES
 #define TCP_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_RETRANSMISSION_COUNT GRUB_NET_TRIES
 
+/* Receive window used unless overridden by $net_tcp_window.  */
+#define TCP_DEFAULT_WINDOW (4 << 20)
+#define TCP_MIN_WINDOW 8192
+/* Even with plenty of free heap, $net_tcp_window can't ask for more than
+   this.  */
+#define TCP_MAX_WINDOW (16 << 20)
+/* RFC 7323 caps the window scale shift at 14.  */
+#define TCP_MAX_WINDOW_SCALE 14
+/* MSS, two NOPs and SACK permitted, NOP and window scale.  */
+#define TCP_SYN_OPTIONS_SIZE 12
+/* Without timestamps four SACK blocks fit into the option space.  */
+#define TCP_MAX_SACK_BLOCKS 4
+#define TCP_SACK_OPTIONS_SIZE (4 + 8 * TCP_MAX_SACK_BLOCKS)
+
 struct unacked
 {
   struct unacked *next;
@@ -47,6 +63,23 @@ enum
     TCP_URG = 0x20,
   };
 
+enum
+  {
+    TCP_OPTION_EOL = 0,
+    TCP_OPTION_NOP = 1,
+    TCP_OPTION_MSS = 2,
+    TCP_OPTION_WINDOW_SCALE = 3,
+    TCP_OPTION_SACK_PERMITTED = 4,
+    TCP_OPTION_SACK = 5,
+  };
+
+/* Out-of-order data we hold, [start, end) in their sequence space.  */
+struct sack_block
+{
+  grub_uint32_t start;
+  grub_uint32_t end;
+};
+
 struct grub_net_tcp_socket
 {
   struct grub_net_tcp_socket *next;
@@ -65,7 +98,13 @@ struct grub_net_tcp_socket
   grub_uint32_t my_cur_seq;
   grub_uint32_t their_start_seq;
   grub_uint32_t their_cur_seq;
-  grub_uint16_t my_window;
+  grub_uint32_t my_window;
+  int my_window_scale;
+  /* Bytes received since the last acknowledgement.  */
+  grub_uint32_t ack_pending;
+  int sack_permitted;
+  int num_sack;
+  struct sack_block sack[TCP_MAX_SACK_BLOCKS];
   struct unacked *unack_first;
   struct unacked *unack_last;
   grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
@@ -163,6 +202,259 @@ tcp_socket_register (grub_net_tcp_socket_t sock)
 		  GRUB_AS_LIST (sock));
 }
 
+/* Sequence number comparison modulo 2^32.  */
+static inline int
+seq_lt (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) < 0;
+}
+
+/* Sequence space taken by the segment in NB: its payload plus FIN.  */
+static grub_uint32_t
+segment_length (struct grub_net_buff *nb)
+{
+  struct tcphdr *tcph = (struct tcphdr *) nb->data;
+  grub_uint32_t len;
+
+  len = nb->tail - nb->data - (grub_be_to_cpu16 (tcph->flags) >> 12) * 4;
+  if (grub_be_to_cpu16 (tcph->flags) & TCP_FIN)
+    len++;
+  return len;
+}
+
+/* Size of the receive window for a new connection.  Everything the peer
+   has in flight ends up queued in netbuffs, and parallel connections
+   each queue their own window, so the open connections together don't
+   promise more than a quarter of the free heap.  */
+static grub_uint32_t
+receive_window_size (void)
+{
+  const char *val;
+  grub_size_t window = TCP_DEFAULT_WINDOW;
+  grub_size_t limit;
+  grub_net_tcp_socket_t sock;
+  unsigned count = 1;
+
+  val = grub_env_get ("net_tcp_window");
+  if (val)
+    {
+      char *end;
+      window = grub_strtoul (val, &end, 0);
+      if (grub_errno || *end)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  window = TCP_DEFAULT_WINDOW;
+	}
+    }
+
+  FOR_TCP_SOCKETS (sock)
+    count++;
+  limit = grub_mm_free_size () / 4 / count;
+  if (window > limit)
+    window = limit;
+  if (window > TCP_MAX_WINDOW)
+    window = TCP_MAX_WINDOW;
+  if (window < TCP_MIN_WINDOW)
+    window = TCP_MIN_WINDOW;
+  return window;
+}
+
+static int
+window_scale (grub_uint32_t window)
+{
+  int scale = 0;
+
+  while (scale < TCP_MAX_WINDOW_SCALE && (window >> scale) > 0xffff)
+    scale++;
+  return scale;
+}
+
+/* Number of bytes the window field lets the peer send, before any
+   stall.  Without window scaling this is less than my_window.  */
+static grub_uint32_t
+advertised_window_size (grub_net_tcp_socket_t sock)
+{
+  grub_uint32_t max = (grub_uint32_t) 0xffff << sock->my_window_scale;
+
+  return sock->my_window < max ? sock->my_window : max;
+}
+
+/* Window field for non-SYN segments.  */
+static grub_uint16_t
+advertised_window (grub_net_tcp_socket_t sock)
+{
+  grub_uint32_t window;
+
+  if (sock->i_stall)
+    return 0;
+  window = sock->my_window >> sock->my_window_scale;
+  if (window > 0xffff)
+    window = 0xffff;
+  return grub_cpu_to_be16 (window);
+}
+
+/* Window field for SYN segments, which is never scaled.  */
+static grub_uint16_t
+syn_window (grub_net_tcp_socket_t sock)
+{
+  if (sock->my_window > 0xffff)
+    return grub_cpu_to_be16_compile_time (0xffff);
+  return grub_cpu_to_be16 (sock->my_window);
+}
+
+/* Append MSS, SACK permitted and window scale options to the SYN header
+   just put into NB and set its flags.  The latter two are only sent if
+   enabled for SOCK.  */
+static grub_err_t
+put_syn_options (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
+		 grub_uint16_t flags)
+{
+  struct tcphdr *tcph = (struct tcphdr *) nb->data;
+  grub_uint8_t *opt = nb->tail;
+  grub_size_t len = 4;
+  grub_size_t mss;
+  grub_err_t err;
+
+  if (sock->sack_permitted)
+    len += 4;
+  if (sock->my_window_scale)
+    len += 4;
+
+  if (sock->out_nla.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    mss = sock->inf->card->mtu - GRUB_NET_OUR_IPV4_HEADER_SIZE;
+  else
+    mss = sock->inf->card->mtu - GRUB_NET_OUR_IPV6_HEADER_SIZE;
+  mss -= sizeof (*tcph);
+
+  err = grub_netbuff_put (nb, len);
+  if (err)
+    return err;
+
+  *opt++ = TCP_OPTION_MSS;
+  *opt++ = 4;
+  *opt++ = mss >> 8;
+  *opt++ = mss & 0xff;
+  if (sock->sack_permitted)
+    {
+      *opt++ = TCP_OPTION_NOP;
+      *opt++ = TCP_OPTION_NOP;
+      *opt++ = TCP_OPTION_SACK_PERMITTED;
+      *opt++ = 2;
+    }
+  if (sock->my_window_scale)
+    {
+      *opt++ = TCP_OPTION_NOP;
+      *opt++ = TCP_OPTION_WINDOW_SCALE;
+      *opt++ = 3;
+      *opt++ = sock->my_window_scale;
+    }
+  tcph->flags = grub_cpu_to_be16 (((5 + len / 4) << 12) | flags);
+  return GRUB_ERR_NONE;
+}
+
+/* Append a SACK option describing the out-of-order data we hold to the
+   ACK header just put into NB.  Returns the option length in 32-bit
+   words.  */
+static int
+put_sack_option (grub_net_tcp_socket_t sock, struct grub_net_buff *nb)
+{
+  grub_uint8_t *opt = nb->tail;
+  int i;
+
+  if (!sock->sack_permitted || !sock->num_sack)
+    return 0;
+
+  if (grub_netbuff_put (nb, 4 + 8 * sock->num_sack))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  *opt++ = TCP_OPTION_NOP;
+  *opt++ = TCP_OPTION_NOP;
+  *opt++ = TCP_OPTION_SACK;
+  *opt++ = 2 + 8 * sock->num_sack;
+  for (i = 0; i < sock->num_sack; i++)
+    {
+      grub_set_unaligned32 (opt, grub_cpu_to_be32 (sock->sack[i].start));
+      grub_set_unaligned32 (opt + 4, grub_cpu_to_be32 (sock->sack[i].end));
+      opt += 8;
+    }
+  return 1 + 2 * sock->num_sack;
+}
+
+/* Look for option KIND of length LEN in the header of the segment in NB.  */
+static int
+has_option (struct grub_net_buff *nb, grub_uint8_t kind, grub_uint8_t len)
+{
+  struct tcphdr *tcph = (struct tcphdr *) nb->data;
+  grub_uint8_t *ptr = (grub_uint8_t *) (tcph + 1);
+  grub_uint8_t *end = nb->data + (grub_be_to_cpu16 (tcph->flags) >> 12) * 4;
+
+  while (ptr < end && *ptr != TCP_OPTION_EOL)
+    {
+      if (*ptr == TCP_OPTION_NOP)
+	{
+	  ptr++;
+	  continue;
+	}
+      if (ptr + 1 >= end || ptr[1] < 2 || ptr[1] > end - ptr)
+	break;
+      if (ptr[0] == kind && ptr[1] == len)
+	return 1;
+      ptr += ptr[1];
+    }
+  return 0;
+}
+
+/* Record that we hold [START, END).  The block containing the latest
+   segment is reported first (RFC 2018).  */
+static void
+sack_add (grub_net_tcp_socket_t sock, grub_uint32_t start, grub_uint32_t end)
+{
+  struct sack_block keep[TCP_MAX_SACK_BLOCKS - 1];
+  int i, n = 0;
+
+  for (i = 0; i < sock->num_sack; i++)
+    {
+      struct sack_block *b = &sock->sack[i];
+
+      if (seq_lt (end, b->start) || seq_lt (b->end, start))
+	{
+	  if (n < TCP_MAX_SACK_BLOCKS - 1)
+	    keep[n++] = *b;
+	  continue;
+	}
+      if (seq_lt (b->start, start))
+	start = b->start;
+      if (seq_lt (end, b->end))
+	end = b->end;
+    }
+
+  sock->sack[0].start = start;
+  sock->sack[0].end = end;
+  grub_memcpy (sock->sack + 1, keep, n * sizeof (keep[0]));
+  sock->num_sack = n + 1;
+}
+
+/* Forget blocks that are now covered by their_cur_seq.  */
+static void
+sack_trim (grub_net_tcp_socket_t sock)
+{
+  int i, n = 0;
+
+  for (i = 0; i < sock->num_sack; i++)
+    {
+      if (!seq_lt (sock->their_cur_seq, sock->sack[i].end))
+	continue;
+      sock->sack[n] = sock->sack[i];
+      if (seq_lt (sock->sack[n].start, sock->their_cur_seq))
+	sock->sack[n].start = sock->their_cur_seq;
+      n++;
+    }
+  sock->num_sack = n;
+}
+
 static void
 error (grub_net_tcp_socket_t sock)
 {
@@ -194,9 +486,9 @@ tcp_send (struct grub_net_buff *nb, grub_net_tcp_socket_t socket)
   tcph = (struct tcphdr *) nb->data;
 
   tcph->seqnr = grub_cpu_to_be32 (socket->my_cur_seq);
-  size = (nb->tail - nb->data - (grub_be_to_cpu16 (tcph->flags) >> 12) * 4);
-  if (grub_be_to_cpu16 (tcph->flags) & TCP_FIN)
-    size++;
+  if (tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
+    socket->ack_pending = 0;
+  size = segment_length (nb);
   socket->my_cur_seq += size;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
@@ -301,7 +593,8 @@ ack_real (grub_net_tcp_socket_t sock, int res)
   struct tcphdr *tcph_ack;
   grub_err_t err;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + 128);
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + TCP_SACK_OPTIONS_SIZE
+				+ 128);
   if (!nb_ack)
     return;
   err = grub_netbuff_reserve (nb_ack, 128);
@@ -331,9 +624,9 @@ ack_real (grub_net_tcp_socket_t sock, int res)
   else
     {
       tcph_ack->ack = grub_cpu_to_be32 (sock->their_cur_seq);
-      tcph_ack->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph_ack->window = !sock->i_stall ? grub_cpu_to_be16 (sock->my_window)
-	: 0;
+      tcph_ack->flags = grub_cpu_to_be16 (((5 + put_sack_option (sock, nb_ack))
+					   << 12) | TCP_ACK);
+      tcph_ack->window = advertised_window (sock);
     }
   tcph_ack->urgent = 0;
   tcph_ack->src = grub_cpu_to_be16 (sock->in_port);
@@ -390,11 +683,10 @@ grub_net_tcp_retransmit (void)
 	if ((tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
 	    && tcph->ack != grub_cpu_to_be32 (sock->their_cur_seq))
 	  {
-	    tcph->checksum = 0;
-	    tcph->checksum = grub_net_ip_transport_checksum (unack->nb,
-							     GRUB_NET_IP_TCP,
-							     &sock->inf->address,
-							     &sock->out_nla);
+	    grub_uint32_t ack = grub_cpu_to_be32 (sock->their_cur_seq);
+	    tcph->checksum = grub_net_ip_chksum_update32 (tcph->checksum,
+							  tcph->ack, ack);
+	    tcph->ack = ack;
 	  }
 
 	err = grub_net_send_ip_packet (sock->inf, &(sock->out_nla),
@@ -455,7 +747,6 @@ grub_net_ip_transport_checksum (struct grub_net_buff *nb,
   return grub_cpu_to_be16 (~c);
 }
 
-/* FIXME: overflow. */
 static int
 cmp (const void *a__, const void *b__)
 {
@@ -464,9 +755,9 @@ cmp (const void *a__, const void *b__)
   struct tcphdr *a = (struct tcphdr *) a_->data;
   struct tcphdr *b = (struct tcphdr *) b_->data;
   /* We want the first elements to be on top.  */
-  if (grub_be_to_cpu32 (a->seqnr) < grub_be_to_cpu32 (b->seqnr))
+  if (seq_lt (grub_be_to_cpu32 (a->seqnr), grub_be_to_cpu32 (b->seqnr)))
     return +1;
-  if (grub_be_to_cpu32 (a->seqnr) > grub_be_to_cpu32 (b->seqnr))
+  if (seq_lt (grub_be_to_cpu32 (b->seqnr), grub_be_to_cpu32 (a->seqnr)))
     return -1;
   return 0;
 }
@@ -514,7 +805,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
   if (err)
     return err;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph)
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph) + TCP_SYN_OPTIONS_SIZE
 			       + GRUB_NET_OUR_MAX_IP_HEADER_SIZE
 			       + GRUB_NET_MAX_LINK_HEADER_SIZE);
   if (!nb_ack)
@@ -528,6 +819,12 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
     }
 
   err = grub_netbuff_put (nb_ack, sizeof (*tcph));
+  if (err)
+    {
+      grub_netbuff_free (nb_ack);
+      return err;
+    }
+  err = put_syn_options (sock, nb_ack, TCP_SYN | TCP_ACK);
   if (err)
     {
       grub_netbuff_free (nb_ack);
@@ -535,8 +832,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
     }
   tcph = (void *) nb_ack->data;
   tcph->ack = grub_cpu_to_be32 (sock->their_cur_seq);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN | TCP_ACK);
-  tcph->window = grub_cpu_to_be16 (sock->my_window);
+  tcph->window = syn_window (sock);
   tcph->urgent = 0;
   sock->established = 1;
   tcp_socket_register (sock);
@@ -604,7 +900,7 @@ grub_net_tcp_open (char *server,
   socket->fin_hook = fin_hook;
   socket->hook_data = hook_data;
 
-  nb = grub_netbuff_alloc (sizeof (*tcph) + 128);
+  nb = grub_netbuff_alloc (sizeof (*tcph) + TCP_SYN_OPTIONS_SIZE + 128);
   if (!nb)
     {
       grub_free (socket);
@@ -619,7 +915,13 @@ grub_net_tcp_open (char *server,
       return NULL;
     }
 
+  socket->my_window = receive_window_size ();
+  socket->my_window_scale = window_scale (socket->my_window);
+  socket->sack_permitted = 1;
+
   err = grub_netbuff_put (nb, sizeof (*tcph));
+  if (!err)
+    err = put_syn_options (socket, nb, TCP_SYN);
   if (err)
     {
       grub_free (socket);
@@ -637,11 +939,9 @@ grub_net_tcp_open (char *server,
   tcph = (void *) nb->data;
   socket->my_start_seq = grub_get_time_ms ();
   socket->my_cur_seq = socket->my_start_seq + 1;
-  socket->my_window = 8192;
   tcph->seqnr = grub_cpu_to_be32 (socket->my_start_seq);
   tcph->ack = grub_cpu_to_be32_compile_time (0);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN);
-  tcph->window = grub_cpu_to_be16 (socket->my_window);
+  tcph->window = syn_window (socket);
   tcph->urgent = 0;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
@@ -727,8 +1027,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
       tcph = (struct tcphdr *) nb2->data;
       tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
       tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window)
-	: 0;
+      tcph->window = advertised_window (socket);
       tcph->urgent = 0;
       err = grub_netbuff_put (nb2, fraglen);
       if (err)
@@ -751,7 +1050,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
   tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
   tcph->flags = (grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK)
 		 | (push ? grub_cpu_to_be16_compile_time (TCP_PUSH) : 0));
-  tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window) : 0;
+  tcph->window = advertised_window (socket);
   tcph->urgent = 0;
   return tcp_send (nb, socket);
 }
@@ -763,6 +1062,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 {
   struct tcphdr *tcph;
   grub_net_tcp_socket_t sock;
+  grub_uint32_t seqnr, seglen;
   grub_err_t err;
 
   /* Ignore broadcast.  */
@@ -796,7 +1096,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  && inf == sock->inf
 	  && grub_net_addr_cmp (source, &sock->out_nla) == 0))
       continue;
-    if (tcph->checksum)
+    if (tcph->checksum && !nb->checksum_valid)
       {
 	grub_uint16_t chk, expected;
 	chk = tcph->checksum;
@@ -822,6 +1122,11 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
       {
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
+	/* Scaling and SACK are only in effect if both sides asked for
+	   them.  */
+	if (!has_option (nb, TCP_OPTION_WINDOW_SCALE, 3))
+	  sock->my_window_scale = 0;
+	sock->sack_permitted = has_option (nb, TCP_OPTION_SACK_PERMITTED, 2);
 	sock->established = 1;
       }
 
@@ -842,18 +1147,12 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	grub_uint32_t acked = grub_be_to_cpu32 (tcph->ack);
 	for (unack = sock->unack_first; unack; unack = next)
 	  {
-	    grub_uint32_t seqnr;
-	    struct tcphdr *unack_tcph;
 	    next = unack->next;
 	    seqnr = grub_be_to_cpu32 (((struct tcphdr *) unack->nb->data)
 				      ->seqnr);
-	    unack_tcph = (struct tcphdr *) unack->nb->data;
-	    seqnr += (unack->nb->tail - unack->nb->data
-		      - (grub_be_to_cpu16 (unack_tcph->flags) >> 12) * 4);
-	    if (grub_be_to_cpu16 (unack_tcph->flags) & TCP_FIN)
-	      seqnr++;
+	    seqnr += segment_length (unack->nb);
 
-	    if (seqnr > acked)
+	    if (seq_lt (acked, seqnr))
 	      break;
 	    grub_netbuff_free (unack->nb);
 	    grub_free (unack);
@@ -863,7 +1162,11 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  sock->unack_last = NULL;
       }
 
-    if (grub_be_to_cpu32 (tcph->seqnr) < sock->their_cur_seq)
+    seqnr = grub_be_to_cpu32 (tcph->seqnr);
+    seglen = segment_length (nb);
+    /* Nothing we don't have already.  */
+    if (!seq_lt (sock->their_cur_seq, seqnr + seglen)
+	&& (seglen || seq_lt (seqnr, sock->their_cur_seq)))
       {
 	ack (sock);
 	grub_netbuff_free (nb);
@@ -876,6 +1179,14 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	reset (sock);
       }
 
+    /* A pure ACK beyond a gap carries nothing to queue, and answering it
+       would only start an ACK ping-pong.  */
+    if (!seglen && seq_lt (sock->their_cur_seq, seqnr))
+      {
+	grub_netbuff_free (nb);
+	return GRUB_ERR_NONE;
+      }
+
     err = grub_priority_queue_push (sock->pq, &nb);
     if (err)
       {
@@ -883,27 +1194,23 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	return err;
       }
 
+    /* Out of order: send a duplicate ACK right away so that the sender
+       can retransmit the missing segment without waiting for a
+       timeout.  */
+    if (seq_lt (sock->their_cur_seq, seqnr))
+      {
+	sack_add (sock, seqnr, seqnr + seglen);
+	ack (sock);
+	return GRUB_ERR_NONE;
+      }
+
     {
       struct grub_net_buff **nb_top_p, *nb_top;
+      grub_uint32_t old_seq = sock->their_cur_seq;
+      int had_sack = (sock->num_sack != 0);
       int do_ack = 0;
       int just_closed = 0;
-      while (1)
-	{
-	  nb_top_p = grub_priority_queue_top (sock->pq);
-	  if (!nb_top_p)
-	    return GRUB_ERR_NONE;
-	  nb_top = *nb_top_p;
-	  tcph = (struct tcphdr *) nb_top->data;
-	  if (grub_be_to_cpu32 (tcph->seqnr) >= sock->their_cur_seq)
-	    break;
-	  grub_netbuff_free (nb_top);
-	  grub_priority_queue_pop (sock->pq);
-	}
-      if (grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
-	{
-	  ack (sock);
-	  return GRUB_ERR_NONE;
-	}
+
       while (1)
 	{
 	  nb_top_p = grub_priority_queue_top (sock->pq);
@@ -911,13 +1218,23 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	    break;
 	  nb_top = *nb_top_p;
 	  tcph = (struct tcphdr *) nb_top->data;
+	  seqnr = grub_be_to_cpu32 (tcph->seqnr);
 
-	  if (grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
+	  if (seq_lt (sock->their_cur_seq, seqnr))
 	    break;
 	  grub_priority_queue_pop (sock->pq);
 
+	  /* Retransmissions may duplicate or overlap what we have.  */
+	  seglen = segment_length (nb_top);
+	  if (!seq_lt (sock->their_cur_seq, seqnr + seglen))
+	    {
+	      grub_netbuff_free (nb_top);
+	      continue;
+	    }
+
 	  err = grub_netbuff_pull (nb_top, (grub_be_to_cpu16 (tcph->flags)
-					    >> 12) * sizeof (grub_uint32_t));
+					    >> 12) * sizeof (grub_uint32_t)
+				   + (sock->their_cur_seq - seqnr));
 	  if (err)
 	    {
 	      grub_netbuff_free (nb_top);
@@ -935,13 +1252,22 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  /* If there is data, puts packet in socket list. */
 	  if ((nb_top->tail - nb_top->data) > 0)
 	    {
+	      sock->ack_pending += nb_top->tail - nb_top->data;
 	      grub_net_put_packet (&sock->packs, nb_top);
-	      do_ack = 1;
 	    }
 	  else
 	    grub_netbuff_free (nb_top);
 	}
-      if (do_ack)
+      sack_trim (sock);
+
+      /* Filling a gap is acknowledged immediately as well.  */
+      if (had_sack && sock->their_cur_seq != old_seq)
+	do_ack = 1;
+
+      /* Received data is acknowledged once per receive batch, and within
+	 long batches whenever an eighth of the advertised window has come
+	 in.  */
+      if (do_ack || sock->ack_pending >= advertised_window_size (sock) / 8)
 	ack (sock);
       while (sock->packs.first)
 	{
@@ -979,7 +1305,10 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->my_cur_seq = sock->my_start_seq = grub_get_time_ms ();
-	sock->my_window = 8192;
+	sock->my_window = receive_window_size ();
+	sock->my_window_scale = (has_option (nb, TCP_OPTION_WINDOW_SCALE, 3)
+				 ? window_scale (sock->my_window) : 0);
+	sock->sack_permitted = has_option (nb, TCP_OPTION_SACK_PERMITTED, 2);
 
 	sock->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *),
 					    cmp);
@@ -1001,6 +1330,16 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
   return GRUB_ERR_NONE;
 }
 
+void
+grub_net_tcp_flush_acks (void)
+{
+  grub_net_tcp_socket_t sock;
+
+  FOR_TCP_SOCKETS (sock)
+    if (sock->ack_pending)
+      ack (sock);
+}
+
 void
 grub_net_tcp_stall (grub_net_tcp_socket_t sock)
 {
@@ -27,6 +27,7 @@
 #include <grub/file.h>
 #include <grub/priority_queue.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -42,6 +43,12 @@ enum
 enum
   {
     TFTP_DEFAULTSIZE_PACKET = 512,
+    TFTP_MIN_BLKSIZE = 8,
+    TFTP_MAX_BLKSIZE = 65464,
+    TFTP_DEFAULT_WINDOWSIZE = 16,
+    TFTP_MAX_WINDOWSIZE = 64,
+    /* Received blocks queued for reading before we stop acknowledging.  */
+    TFTP_MAX_QUEUED = 50
   };
 
 enum
@@ -72,7 +79,8 @@ enum
     TFTP_EBADOP = 4,                   /* illegal TFTP operation */
     TFTP_EBADID = 5,                   /* unknown transfer ID */
     TFTP_EEXISTS = 6,                  /* file already exists */
-    TFTP_ENOUSER = 7                  /* no such user */
+    TFTP_ENOUSER = 7,                  /* no such user */
+    TFTP_EOPTNEG = 8                   /* option negotiation refused */
   };
 
 struct tftphdr {
@@ -102,8 +110,12 @@ typedef struct tftp_data
   grub_uint64_t file_size;
   grub_uint64_t block;
   grub_uint32_t block_size;
+  grub_uint32_t window_size;
   grub_uint64_t ack_sent;
+  /* data->block + 1 when we last asked for a resend of a lost block.  */
+  grub_uint64_t gap_acked;
   int have_oack;
+  int options_refused;
   struct grub_error_saved save_err;
   grub_net_udp_socket_t sock;
   grub_priority_queue_t pq;
@@ -159,6 +171,13 @@ ack (tftp_data_t data, grub_uint64_t block)
   return GRUB_ERR_NONE;
 }
 
+/* Whether a full window has been received without acknowledging it.  */
+static int
+window_done (tftp_data_t data)
+{
+  return data->block - data->ack_sent >= data->window_size;
+}
+
 static grub_err_t
 tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
@@ -181,6 +200,7 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
     {
     case TFTP_OACK:
       data->block_size = TFTP_DEFAULTSIZE_PACKET;
+      data->window_size = 1;
       data->have_oack = 1; 
       for (ptr = nb->data + sizeof (tftph->opcode); ptr < nb->tail;)
 	{
@@ -190,10 +210,19 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  if (grub_memcmp (ptr, "blksize\0", sizeof ("blksize\0") - 1) == 0)
 	    data->block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
 					     - 1, 0, 0);
+	  if (grub_memcmp (ptr, "windowsize\0", sizeof ("windowsize\0") - 1)
+	      == 0)
+	    data->window_size = grub_strtoul ((char *) ptr
+					      + sizeof ("windowsize\0") - 1,
+					      0, 0);
 	  while (ptr < nb->tail && *ptr)
 	    ptr++;
 	  ptr++;
 	}
+      if (data->block_size < TFTP_MIN_BLKSIZE)
+	data->block_size = TFTP_DEFAULTSIZE_PACKET;
+      if (data->window_size == 0)
+	data->window_size = 1;
       data->block = 0;
       grub_netbuff_free (nb);
       err = ack (data, 0);
@@ -207,6 +236,9 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  return GRUB_ERR_NONE;
 	}
 
+      /* A server ignoring our options starts sending data right away.  */
+      data->have_oack = 1;
+
       err = grub_priority_queue_push (data->pq, &nb);
       if (err)
 	return err;
@@ -215,32 +247,43 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	struct grub_net_buff **nb_top_p, *nb_top;
 	while (1)
 	  {
+	    grub_uint16_t block;
+	    unsigned size;
+
 	    nb_top_p = grub_priority_queue_top (data->pq);
 	    if (!nb_top_p)
 	      return GRUB_ERR_NONE;
 	    nb_top = *nb_top_p;
 	    tftph = (struct tftphdr *) nb_top->data;
-	    if (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) >= 0)
-	      break;
-	    ack (data, grub_be_to_cpu16 (tftph->u.data.block));
-	    grub_netbuff_free (nb_top);
-	    grub_priority_queue_pop (data->pq);
-	  }
-	while (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) == 0)
-	  {
-	    unsigned size;
+	    block = grub_be_to_cpu16 (tftph->u.data.block);
 
-	    grub_priority_queue_pop (data->pq);
+	    if (cmp_block (block, data->block + 1) < 0)
+	      {
+		/* Getting the last acknowledged block again means that the
+		   ACK was lost and the server resent its window.  */
+		if (block == (grub_uint16_t) data->ack_sent)
+		  ack (data, data->ack_sent);
+		grub_netbuff_free (nb_top);
+		grub_priority_queue_pop (data->pq);
+		continue;
+	      }
 
-	    if (file->device->net->packs.count < 50)
-	      err = ack (data, data->block + 1);
-	    else
+	    if (cmp_block (block, data->block + 1) > 0)
 	      {
-		file->device->net->stall = 1;
-		err = 0;
+		/* A block of the window was lost.  Acknowledge what we have
+		   so that the server resends from there (RFC 7440), but
+		   only once for each gap.  */
+		if (data->window_size > 1
+		    && data->gap_acked != data->block + 1
+		    && file->device->net->packs.count < TFTP_MAX_QUEUED)
+		  {
+		    data->gap_acked = data->block + 1;
+		    return ack (data, data->block);
+		  }
+		return GRUB_ERR_NONE;
 	      }
-	    if (err)
-	      return err;
+
+	    grub_priority_queue_pop (data->pq);
 
 	    err = grub_netbuff_pull (nb_top, sizeof (tftph->opcode) +
 				     sizeof (tftph->u.data.block));
@@ -249,15 +292,6 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	    size = nb_top->tail - nb_top->data;
 
 	    data->block++;
-	    if (size < data->block_size)
-	      {
-		if (data->ack_sent < data->block)
-		  ack (data, data->block);
-		file->device->net->eof = 1;
-		file->device->net->stall = 1;
-		grub_net_udp_close (data->sock);
-		data->sock = NULL;
-	      }
 	    /* Prevent garbage in broken cards. Is it still necessary
 	       given that IP implementation has been fixed?
 	     */
@@ -272,14 +306,40 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	      grub_net_put_packet (&file->device->net->packs, nb_top);
 	    else
 	      grub_netbuff_free (nb_top);
+
+	    if (size < data->block_size)
+	      {
+		if (data->ack_sent < data->block)
+		  ack (data, data->block);
+		file->device->net->eof = 1;
+		file->device->net->stall = 1;
+		grub_net_udp_close (data->sock);
+		data->sock = NULL;
+		return GRUB_ERR_NONE;
+	      }
+
+	    if (!window_done (data))
+	      continue;
+	    if (file->device->net->packs.count < TFTP_MAX_QUEUED)
+	      {
+		err = ack (data, data->block);
+		if (err)
+		  return err;
+	      }
+	    else
+	      file->device->net->stall = 1;
 	  }
       }
-      return GRUB_ERR_NONE;
     case TFTP_ERROR:
       data->have_oack = 1;
+      if (grub_be_to_cpu16 (tftph->u.err.errcode) == TFTP_EOPTNEG)
+	data->options_refused = 1;
+      else
+	{
+	  grub_error (GRUB_ERR_IO, (char *) tftph->u.err.errmsg);
+	  grub_error_save (&data->save_err);
+	}
       grub_netbuff_free (nb);
-      grub_error (GRUB_ERR_IO, (char *) tftph->u.err.errmsg);
-      grub_error_save (&data->save_err);
       return GRUB_ERR_NONE;
     default:
       grub_netbuff_free (nb);
@@ -300,24 +360,53 @@ destroy_pq (tftp_data_t data)
   grub_priority_queue_destroy (data->pq);
 }
 
+static grub_uint32_t
+tftp_option (const char *name, grub_uint32_t def, grub_uint32_t min,
+	     grub_uint32_t max)
+{
+  const char *val;
+  grub_uint32_t ret = def;
+
+  val = grub_env_get (name);
+  if (val)
+    {
+      char *end;
+      ret = grub_strtoul (val, &end, 0);
+      if (grub_errno || *end)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  ret = def;
+	}
+    }
+  if (ret < min)
+    ret = min;
+  if (ret > max)
+    ret = max;
+  return ret;
+}
+
+static char *
+rrq_append (char *rrq, const char *str)
+{
+  grub_strcpy (rrq, str);
+  return rrq + grub_strlen (str) + 1;
+}
+
+/* Send the read request and wait for the server to answer it.  A
+   BLKSIZE of 0 sends a plain RFC 1350 request without any options.  */
 static grub_err_t
-tftp_open (struct grub_file *file, const char *filename)
+tftp_request (grub_file_t file, const char *filename,
+	      grub_net_network_level_address_t addr,
+	      grub_uint32_t blksize, grub_uint32_t windowsize)
 {
+  tftp_data_t data = file->data;
   struct tftphdr *tftph;
   char *rrq;
   int i;
-  int rrqlen;
-  int hdrlen;
   grub_uint8_t open_data[1500];
   struct grub_net_buff nb;
-  tftp_data_t data;
   grub_err_t err;
   grub_uint8_t *nbd;
-  grub_net_network_level_address_t addr;
-
-  data = grub_zalloc (sizeof (*data));
-  if (!data)
-    return grub_errno;
 
   nb.head = open_data;
   nb.end = open_data + sizeof (open_data);
@@ -326,49 +415,84 @@ tftp_open (struct grub_file *file, const char *filename)
   grub_netbuff_reserve (&nb, 1500);
   err = grub_netbuff_push (&nb, sizeof (*tftph));
   if (err)
-    {
-      grub_free (data);
-      return err;
-    }
+    return err;
 
   tftph = (struct tftphdr *) nb.data;
-
-  rrq = (char *) tftph->u.rrq;
-  rrqlen = 0;
-
   tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_RRQ);
-  grub_strcpy (rrq, filename);
-  rrqlen += grub_strlen (filename) + 1;
-  rrq += grub_strlen (filename) + 1;
 
-  grub_strcpy (rrq, "octet");
-  rrqlen += grub_strlen ("octet") + 1;
-  rrq += grub_strlen ("octet") + 1;
+  rrq = (char *) tftph->u.rrq;
+  rrq = rrq_append (rrq, filename);
+  rrq = rrq_append (rrq, "octet");
+  if (blksize)
+    {
+      char buf[sizeof ("65535")];
 
-  grub_strcpy (rrq, "blksize");
-  rrqlen += grub_strlen ("blksize") + 1;
-  rrq += grub_strlen ("blksize") + 1;
+      grub_snprintf (buf, sizeof (buf), "%u", blksize);
+      rrq = rrq_append (rrq, "blksize");
+      rrq = rrq_append (rrq, buf);
+      if (windowsize > 1)
+	{
+	  grub_snprintf (buf, sizeof (buf), "%u", windowsize);
+	  rrq = rrq_append (rrq, "windowsize");
+	  rrq = rrq_append (rrq, buf);
+	}
+      rrq = rrq_append (rrq, "tsize");
+      rrq = rrq_append (rrq, "0");
+    }
 
-  grub_strcpy (rrq, "1024");
-  rrqlen += grub_strlen ("1024") + 1;
-  rrq += grub_strlen ("1024") + 1;
+  err = grub_netbuff_unput (&nb, nb.tail - (grub_uint8_t *) rrq);
+  if (err)
+    return err;
 
-  grub_strcpy (rrq, "tsize");
-  rrqlen += grub_strlen ("tsize") + 1;
-  rrq += grub_strlen ("tsize") + 1;
+  if (data->sock)
+    grub_net_udp_close (data->sock);
+  data->block_size = TFTP_DEFAULTSIZE_PACKET;
+  data->window_size = 1;
+  data->have_oack = 0;
+  data->options_refused = 0;
+  /* Only known if the server answers with an OACK carrying tsize.  */
+  data->file_size = GRUB_FILE_SIZE_UNKNOWN;
 
-  grub_strcpy (rrq, "0");
-  rrqlen += grub_strlen ("0") + 1;
-  rrq += grub_strlen ("0") + 1;
-  hdrlen = sizeof (tftph->opcode) + rrqlen;
+  data->sock = grub_net_udp_open (addr,
+				  TFTP_SERVER_PORT, tftp_receive,
+				  file);
+  if (!data->sock)
+    return grub_errno;
 
-  err = grub_netbuff_unput (&nb, nb.tail - (nb.data + hdrlen));
-  if (err)
+  /* Receive OACK packet.  */
+  nbd = nb.data;
+  for (i = 0; i < GRUB_NET_TRIES; i++)
     {
-      grub_free (data);
-      return err;
+      nb.data = nbd;
+      err = grub_net_send_udp_packet (data->sock, &nb);
+      if (err)
+	return err;
+      grub_net_poll_cards (GRUB_NET_INTERVAL + (i * GRUB_NET_INTERVAL_ADDITION),
+                           &data->have_oack);
+      if (data->have_oack)
+	break;
     }
 
+  if (!data->have_oack)
+    return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"),
+		       filename);
+  grub_error_load (&data->save_err);
+  return grub_errno;
+}
+
+static grub_err_t
+tftp_open (struct grub_file *file, const char *filename)
+{
+  tftp_data_t data;
+  grub_err_t err;
+  grub_net_network_level_address_t addr, gateway;
+  struct grub_net_network_level_interface *inf;
+  grub_uint32_t max_blksize, blksize, windowsize, headers;
+
+  data = grub_zalloc (sizeof (*data));
+  if (!data)
+    return grub_errno;
+
   file->not_easily_seekable = 1;
   file->data = data;
 
@@ -380,6 +504,8 @@ tftp_open (struct grub_file *file, const char *filename)
     }
 
   err = grub_net_resolve_address (file->device->net->server, &addr);
+  if (!err)
+    err = grub_net_route_address (addr, &gateway, &inf);
   if (err)
     {
       destroy_pq (data);
@@ -387,45 +513,40 @@ tftp_open (struct grub_file *file, const char *filename)
       return err;
     }
 
-  data->sock = grub_net_udp_open (addr,
-				  TFTP_SERVER_PORT, tftp_receive,
-				  file);
-  if (!data->sock)
-    {
-      destroy_pq (data);
-      grub_free (data);
-      return grub_errno;
-    }
-
-  /* Receive OACK packet.  */
-  nbd = nb.data;
-  for (i = 0; i < GRUB_NET_TRIES; i++)
+  /* Largest block that still fits into one frame.  The MTU comes from
+     the firmware, so don't trust it to cover the headers.  */
+  headers = GRUB_NET_UDP_HEADER_SIZE + 4;
+  if (addr.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6)
+    headers += GRUB_NET_OUR_IPV6_HEADER_SIZE;
+  else
+    headers += GRUB_NET_OUR_IPV4_HEADER_SIZE;
+  if (inf->card->mtu > headers)
+    max_blksize = inf->card->mtu - headers;
+  else
+    max_blksize = TFTP_DEFAULTSIZE_PACKET;
+  if (max_blksize > TFTP_MAX_BLKSIZE)
+    max_blksize = TFTP_MAX_BLKSIZE;
+  if (max_blksize < TFTP_DEFAULTSIZE_PACKET)
+    max_blksize = TFTP_DEFAULTSIZE_PACKET;
+
+  blksize = tftp_option ("net_tftp_blksize", max_blksize,
+			 TFTP_MIN_BLKSIZE, max_blksize);
+  windowsize = tftp_option ("net_tftp_windowsize", TFTP_DEFAULT_WINDOWSIZE,
+			    1, TFTP_MAX_WINDOWSIZE);
+
+  err = tftp_request (file, filename, addr, blksize, windowsize);
+  if (!err && data->options_refused)
     {
-      nb.data = nbd;
-      err = grub_net_send_udp_packet (data->sock, &nb);
-      if (err)
-	{
-	  grub_net_udp_close (data->sock);
-	  destroy_pq (data);
-	  grub_free (data);
-	  return err;
-	}
-      grub_net_poll_cards (GRUB_NET_INTERVAL + (i * GRUB_NET_INTERVAL_ADDITION),
-                           &data->have_oack);
-      if (data->have_oack)
-	break;
+      grub_dprintf ("tftp", "server refused options, using plain TFTP\n");
+      err = tftp_request (file, filename, addr, 0, 1);
     }
-
-  if (!data->have_oack)
-    grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), filename);
-  else
-    grub_error_load (&data->save_err);
-  if (grub_errno)
+  if (err)
     {
-      grub_net_udp_close (data->sock);
+      if (data->sock)
+	grub_net_udp_close (data->sock);
       destroy_pq (data);
       grub_free (data);
-      return grub_errno;
+      return err;
     }
 
   file->size = data->file_size;
@@ -475,12 +596,13 @@ static grub_err_t
 tftp_packets_pulled (struct grub_file *file)
 {
   tftp_data_t data = file->data;
-  if (file->device->net->packs.count >= 50)
+  if (file->device->net->packs.count >= TFTP_MAX_QUEUED)
     return 0;
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data->ack_sent >= data->block)
+  /* Only a window end held back while the queue was full is still owed.  */
+  if (!data->sock || !window_done (data))
     return 0;
   return ack (data, data->block);
 }
@@ -168,7 +168,7 @@ grub_net_recv_udp_packet (struct grub_net_buff *nb,
 	&& (sock->status == GRUB_NET_SOCKET_START
 	    || grub_be_to_cpu16 (udph->src) == sock->out_port))
       {
-	if (udph->chksum)
+	if (udph->chksum && !nb->checksum_valid)
 	  {
 	    grub_uint16_t chk, expected;
 	    chk = udph->chksum;
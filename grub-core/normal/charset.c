@@ -261,130 +261,28 @@ grub_utf8_to_ucs4 (grub_uint32_t *dest, grub_size_t destsize,
   return p - dest;
 }
 
-static grub_uint8_t *join_types = NULL;
-
-static void
-unpack_join (void)
-{
-  unsigned i;
-  struct grub_unicode_compact_range *cur;
-
-  join_types = grub_zalloc (GRUB_UNICODE_MAX_CACHED_CHAR);
-  if (!join_types)
-    {
-      grub_errno = GRUB_ERR_NONE;
-      return;
-    }
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    for (i = cur->start; i < cur->start + (unsigned) cur->len
-	   && i < GRUB_UNICODE_MAX_CACHED_CHAR; i++)
-      join_types[i] = cur->join_type;
-}
-
-static grub_uint8_t *bidi_types = NULL;
-
-static void
-unpack_bidi (void)
-{
-  unsigned i;
-  struct grub_unicode_compact_range *cur;
-
-  bidi_types = grub_zalloc (GRUB_UNICODE_MAX_CACHED_CHAR);
-  if (!bidi_types)
-    {
-      grub_errno = GRUB_ERR_NONE;
-      return;
-    }
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    for (i = cur->start; i < cur->start + (unsigned) cur->len
-	   && i < GRUB_UNICODE_MAX_CACHED_CHAR; i++)
-      if (cur->bidi_mirror)
-	bidi_types[i] = cur->bidi_type | 0x80;
-      else
-	bidi_types[i] = cur->bidi_type | 0x00;
-}
-
 static inline enum grub_bidi_type
 get_bidi_type (grub_uint32_t c)
 {
-  struct grub_unicode_compact_range *cur;
-
-  if (!bidi_types)
-    unpack_bidi ();
-
-  if (bidi_types && c < GRUB_UNICODE_MAX_CACHED_CHAR)
-    return bidi_types[c] & 0x7f;
-
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    if (cur->start <= c && c < cur->start + (unsigned) cur->len)
-      return cur->bidi_type;
-
-  return GRUB_BIDI_TYPE_L;
+  return grub_unicode_get_property (c)->bidi_type;
 }
 
 static inline enum grub_join_type
 get_join_type (grub_uint32_t c)
 {
-  struct grub_unicode_compact_range *cur;
-
-  if (!join_types)
-    unpack_join ();
-
-  if (join_types && c < GRUB_UNICODE_MAX_CACHED_CHAR)
-    return join_types[c];
-
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    if (cur->start <= c && c < cur->start + (unsigned) cur->len)
-      return cur->join_type;
-
-  return GRUB_JOIN_TYPE_NONJOINING;
+  return grub_unicode_get_property (c)->join_type;
 }
 
 static inline int
 is_mirrored (grub_uint32_t c)
 {
-  struct grub_unicode_compact_range *cur;
-
-  if (!bidi_types)
-    unpack_bidi ();
-
-  if (bidi_types && c < GRUB_UNICODE_MAX_CACHED_CHAR)
-    return !!(bidi_types[c] & 0x80);
-
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    if (cur->start <= c && c < cur->start + (unsigned) cur->len)
-      return cur->bidi_mirror;
-
-  return 0;
+  return grub_unicode_get_property (c)->bidi_mirror;
 }
 
 enum grub_comb_type
 grub_unicode_get_comb_type (grub_uint32_t c)
 {
-  static grub_uint8_t *comb_types = NULL;
-  struct grub_unicode_compact_range *cur;
-
-  if (!comb_types)
-    {
-      unsigned i;
-      comb_types = grub_zalloc (GRUB_UNICODE_MAX_CACHED_CHAR);
-      if (comb_types)
-	for (cur = grub_unicode_compact; cur->len; cur++)
-	  for (i = cur->start; i < cur->start + (unsigned) cur->len
-		 && i < GRUB_UNICODE_MAX_CACHED_CHAR; i++)
-	    comb_types[i] = cur->comb_type;
-      else
-	grub_errno = GRUB_ERR_NONE;
-    }
-
-  if (comb_types && c < GRUB_UNICODE_MAX_CACHED_CHAR)
-    return comb_types[c];
-
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    if (cur->start <= c && c < cur->start + (unsigned) cur->len)
-      return cur->comb_type;
-
-  return GRUB_UNICODE_COMB_NONE;
+  return grub_unicode_get_property (c)->comb_type;
 }
 
 #if HAVE_FONT_SOURCE
@@ -560,7 +458,7 @@ bidi_line_wrap (struct grub_unicode_glyph *visual_out,
 		grub_size_t maxwidth, grub_size_t startwidth,
 		grub_uint32_t contchar,
 		struct grub_term_pos *pos, int primitive_wrap,
-		grub_size_t log_end)
+		grub_size_t log_end, int ascii_only)
 {
   struct grub_unicode_glyph *outptr = visual_out;
   unsigned line_start = 0;
@@ -642,116 +540,121 @@ bidi_line_wrap (struct grub_unicode_glyph *visual_out,
 	  else
 	    line_width = last_width;
 
-	  {
-	    unsigned i;
-	    for (i = line_start; i < kk; i++)
+	  /* Lines of printable ASCII need no reordering, mirroring or
+	     joining.  */
+	  if (!ascii_only)
+	    {
 	      {
-		if (visual[i].bidi_level > max_level)
-		  max_level = visual[i].bidi_level;
-		if (visual[i].bidi_level < min_odd_level && (visual[i].bidi_level & 1))
-		  min_odd_level = visual[i].bidi_level;
+		unsigned i;
+		for (i = line_start; i < kk; i++)
+		  {
+		    if (visual[i].bidi_level > max_level)
+		      max_level = visual[i].bidi_level;
+		    if (visual[i].bidi_level < min_odd_level && (visual[i].bidi_level & 1))
+		      min_odd_level = visual[i].bidi_level;
+		  }
 	      }
-	  }
 
-	  {
-	    unsigned j;	  
-	    /* FIXME: can be optimized.  */
-	    for (j = max_level; j > min_odd_level - 1; j--)
 	      {
-		unsigned in = line_start;
-		unsigned i;
-		for (i = line_start; i < kk; i++)
+		unsigned j;
+		/* FIXME: can be optimized.  */
+		for (j = max_level; j > min_odd_level - 1; j--)
 		  {
-		    if (i != line_start && visual[i].bidi_level >= j
-			&& visual[i-1].bidi_level < j)
-		      in = i;
-		    if (visual[i].bidi_level >= j && (i + 1 == kk
-						 || visual[i+1].bidi_level < j))
-		      revert (visual, pos, in, i);
+		    unsigned in = line_start;
+		    unsigned i;
+		    for (i = line_start; i < kk; i++)
+		      {
+			if (i != line_start && visual[i].bidi_level >= j
+			    && visual[i-1].bidi_level < j)
+			  in = i;
+			if (visual[i].bidi_level >= j && (i + 1 == kk
+						     || visual[i+1].bidi_level < j))
+			  revert (visual, pos, in, i);
+		      }
 		  }
 	      }
-	  }
-	  
-	  {
-	    unsigned i;
-	    for (i = line_start; i < kk; i++)
+
 	      {
-		if (is_mirrored (visual[i].base) && visual[i].bidi_level)
-		  visual[i].attributes |= GRUB_UNICODE_GLYPH_ATTRIBUTE_MIRROR;
-		if ((visual[i].attributes & GRUB_UNICODE_GLYPH_ATTRIBUTES_JOIN)
-		    && visual[i].bidi_level)
+		unsigned i;
+		for (i = line_start; i < kk; i++)
 		  {
-		    int left, right;
-		    left = visual[i].attributes
-		      & (GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED 
-			 | GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED_EXPLICIT);
-		    right = visual[i].attributes
-		      & (GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED 
-			 | GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED_EXPLICIT);
-		    visual[i].attributes &= ~GRUB_UNICODE_GLYPH_ATTRIBUTES_JOIN;
-		    left <<= GRUB_UNICODE_GLYPH_ATTRIBUTES_JOIN_LEFT_TO_RIGHT_SHIFT;
-		    right >>= GRUB_UNICODE_GLYPH_ATTRIBUTES_JOIN_LEFT_TO_RIGHT_SHIFT;
-		    visual[i].attributes |= (left | right);
+		    if (is_mirrored (visual[i].base) && visual[i].bidi_level)
+		      visual[i].attributes |= GRUB_UNICODE_GLYPH_ATTRIBUTE_MIRROR;
+		    if ((visual[i].attributes & GRUB_UNICODE_GLYPH_ATTRIBUTES_JOIN)
+			&& visual[i].bidi_level)
+		      {
+			int left, right;
+			left = visual[i].attributes
+			  & (GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED
+			     | GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED_EXPLICIT);
+			right = visual[i].attributes
+			  & (GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED
+			     | GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED_EXPLICIT);
+			visual[i].attributes &= ~GRUB_UNICODE_GLYPH_ATTRIBUTES_JOIN;
+			left <<= GRUB_UNICODE_GLYPH_ATTRIBUTES_JOIN_LEFT_TO_RIGHT_SHIFT;
+			right >>= GRUB_UNICODE_GLYPH_ATTRIBUTES_JOIN_LEFT_TO_RIGHT_SHIFT;
+			visual[i].attributes |= (left | right);
+		      }
 		  }
 	      }
-	  }
 
-	  {
-	    int left_join = 0;
-	    unsigned i;
-	    for (i = line_start; i < kk; i++)
 	      {
-		enum grub_join_type join_type = get_join_type (visual[i].base);
-		if (!(visual[i].attributes
-		      & GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED_EXPLICIT)
-		    && (join_type == GRUB_JOIN_TYPE_LEFT
-			|| join_type == GRUB_JOIN_TYPE_DUAL))
+		int left_join = 0;
+		unsigned i;
+		for (i = line_start; i < kk; i++)
 		  {
-		    if (left_join)
-		      visual[i].attributes
-			|= GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED;
-		    else
-		      visual[i].attributes
-			&= ~GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED;
+		    enum grub_join_type join_type = get_join_type (visual[i].base);
+		    if (!(visual[i].attributes
+			  & GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED_EXPLICIT)
+			&& (join_type == GRUB_JOIN_TYPE_LEFT
+			    || join_type == GRUB_JOIN_TYPE_DUAL))
+		      {
+			if (left_join)
+			  visual[i].attributes
+			    |= GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED;
+			else
+			  visual[i].attributes
+			    &= ~GRUB_UNICODE_GLYPH_ATTRIBUTE_LEFT_JOINED;
+		      }
+		    if (join_type == GRUB_JOIN_TYPE_NONJOINING
+			|| join_type == GRUB_JOIN_TYPE_LEFT)
+		      left_join = 0;
+		    if (join_type == GRUB_JOIN_TYPE_RIGHT
+			|| join_type == GRUB_JOIN_TYPE_DUAL
+			|| join_type == GRUB_JOIN_TYPE_CAUSING)
+		      left_join = 1;
 		  }
-		if (join_type == GRUB_JOIN_TYPE_NONJOINING
-		    || join_type == GRUB_JOIN_TYPE_LEFT)
-		  left_join = 0;
-		if (join_type == GRUB_JOIN_TYPE_RIGHT
-		    || join_type == GRUB_JOIN_TYPE_DUAL
-		    || join_type == GRUB_JOIN_TYPE_CAUSING)
-		  left_join = 1;
 	      }
-	  }
 
-	  {
-	    int right_join = 0;
-	    signed i;
-	    for (i = kk - 1; i >= 0 && (unsigned) i + 1 > line_start;
-		 i--)
 	      {
-		enum grub_join_type join_type = get_join_type (visual[i].base);
-		if (!(visual[i].attributes
-		      & GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED_EXPLICIT)
-		    && (join_type == GRUB_JOIN_TYPE_RIGHT
-			|| join_type == GRUB_JOIN_TYPE_DUAL))
+		int right_join = 0;
+		signed i;
+		for (i = kk - 1; i >= 0 && (unsigned) i + 1 > line_start;
+		     i--)
 		  {
-		    if (right_join)
-		      visual[i].attributes
-			|= GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED;
-		    else
-		      visual[i].attributes
-			&= ~GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED;
+		    enum grub_join_type join_type = get_join_type (visual[i].base);
+		    if (!(visual[i].attributes
+			  & GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED_EXPLICIT)
+			&& (join_type == GRUB_JOIN_TYPE_RIGHT
+			    || join_type == GRUB_JOIN_TYPE_DUAL))
+		      {
+			if (right_join)
+			  visual[i].attributes
+			    |= GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED;
+			else
+			  visual[i].attributes
+			    &= ~GRUB_UNICODE_GLYPH_ATTRIBUTE_RIGHT_JOINED;
+		      }
+		    if (join_type == GRUB_JOIN_TYPE_NONJOINING
+			|| join_type == GRUB_JOIN_TYPE_RIGHT)
+		      right_join = 0;
+		    if (join_type == GRUB_JOIN_TYPE_LEFT
+			|| join_type == GRUB_JOIN_TYPE_DUAL
+			|| join_type == GRUB_JOIN_TYPE_CAUSING)
+		      right_join = 1;
 		  }
-		if (join_type == GRUB_JOIN_TYPE_NONJOINING
-		    || join_type == GRUB_JOIN_TYPE_RIGHT)
-		  right_join = 0;
-		if (join_type == GRUB_JOIN_TYPE_LEFT
-		    || join_type == GRUB_JOIN_TYPE_DUAL
-		    || join_type == GRUB_JOIN_TYPE_CAUSING)
-		  right_join = 1;
 	      }
-	  }		
+	    }
 
 	  grub_memcpy (outptr, &visual[line_start],
 		       (kk - line_start) * sizeof (visual[0]));
@@ -811,6 +714,7 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
   struct grub_unicode_glyph *visual;
   unsigned cur_level;
   int bidi_needed = 0;
+  int ascii_only = 1;
 
 #define push_stack(new_override, new_level)		\
   {							\
@@ -846,6 +750,29 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
   if (!visual)
     return -1;
 
+  /* Printable ASCII has neither combining characters nor strong
+     right-to-left types, so every character makes one glyph at level 0.  */
+  for (i = 0; i < logical_len; i++)
+    if (logical[i] < 0x20 || logical[i] >= 0x7f)
+      {
+	ascii_only = 0;
+	break;
+      }
+
+  if (ascii_only)
+    {
+      grub_memset (visual, 0, sizeof (visual[0]) * logical_len);
+      for (i = 0; i < logical_len; i++)
+	{
+	  visual[i].base = logical[i];
+	  visual[i].estimated_width = 1;
+	  visual[i].orig_pos = i;
+	  visual[i].bidi_type = get_bidi_type (logical[i]);
+	}
+      visual_len = logical_len;
+      goto wrap;
+    }
+
   for (i = 0; i < logical_len; i++)
     {
       type = get_bidi_type (logical[i]);
@@ -1134,11 +1061,12 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
 	visual[i].bidi_level = 0;
     }
 
+ wrap:
   {
     grub_ssize_t ret;
     ret = bidi_line_wrap (visual_out, visual, visual_len,
 			  getcharwidth, getcharwidth_arg, maxwidth, startwidth, contchar,
-			  pos, primitive_wrap, log_end);
+			  pos, primitive_wrap, log_end, ascii_only);
     grub_free (visual);
     return ret;
   }
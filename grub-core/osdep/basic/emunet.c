@@ -31,7 +31,8 @@ grub_emunet_send (const void *packet __attribute__ ((unused)),
 
 grub_ssize_t
 grub_emunet_receive (void *packet __attribute__ ((unused)),
-		     grub_size_t sz __attribute__ ((unused)))
+		     grub_size_t sz __attribute__ ((unused)),
+		     int *checksum_valid __attribute__ ((unused)))
 {
   return -1;
 }
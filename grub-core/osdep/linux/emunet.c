@@ -24,42 +24,107 @@
 #include <linux/if.h>
 #include <linux/if_tun.h>
 #include <unistd.h>
+#include <linux/virtio_net.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include <grub/emu/net.h>
 
 static int fd;
+/* Loss injection for testing: drop every DROP_EVERY-th received packet,
+   as set by $GRUB_EMUNET_DROP.  */
+static unsigned long drop_every;
+static unsigned long received;
+/* Whether packets carry a virtio-net header.  The host then leaves the
+   checksums of its own packets to us and flags them, so they need no
+   verification.  */
+static int vnet_hdr;
 
 grub_ssize_t
 grub_emunet_send (const void *packet, grub_size_t sz)
 {
-  return write (fd, packet, sz);
+  struct virtio_net_hdr hdr;
+  struct iovec iov[2];
+  grub_ssize_t ret;
+
+  if (!vnet_hdr)
+    return write (fd, packet, sz);
+
+  memset (&hdr, 0, sizeof (hdr));
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof (hdr);
+  iov[1].iov_base = (void *) packet;
+  iov[1].iov_len = sz;
+  ret = writev (fd, iov, 2);
+  if (ret < 0)
+    return ret;
+  return ret - sizeof (hdr);
 }
 
 grub_ssize_t
-grub_emunet_receive (void *packet, grub_size_t sz)
+grub_emunet_receive (void *packet, grub_size_t sz, int *checksum_valid)
 {
-  return read (fd, packet, sz);
+  struct virtio_net_hdr hdr;
+  struct iovec iov[2];
+  grub_ssize_t ret;
+
+  *checksum_valid = 0;
+  if (!vnet_hdr)
+    {
+      do
+	ret = read (fd, packet, sz);
+      while (ret >= 0 && drop_every && ++received % drop_every == 0);
+      return ret;
+    }
+
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof (hdr);
+  iov[1].iov_base = packet;
+  iov[1].iov_len = sz;
+  do
+    ret = readv (fd, iov, 2);
+  while (ret >= 0 && drop_every && ++received % drop_every == 0);
+  if (ret < (grub_ssize_t) sizeof (hdr))
+    return -1;
+
+  if (hdr.flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM | VIRTIO_NET_HDR_F_DATA_VALID))
+    *checksum_valid = 1;
+  return ret - sizeof (hdr);
 }
 
 int
 grub_emunet_create (grub_size_t *mtu)
 {
   struct ifreq ifr;
+  const char *drop;
+
   *mtu = 1500;
+  drop = getenv ("GRUB_EMUNET_DROP");
+  if (drop)
+    drop_every = strtoul (drop, NULL, 0);
   fd = open ("/dev/net/tun", O_RDWR | O_NONBLOCK);
   if (fd < 0)
     return -1;
   memset (&ifr, 0, sizeof (ifr));
-  ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+  vnet_hdr = 1;
   if (ioctl (fd, TUNSETIFF, &ifr) < 0)
     {
-      close (fd);
-      fd = -1;
-      return -1;
+      ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+      vnet_hdr = 0;
+      if (ioctl (fd, TUNSETIFF, &ifr) < 0)
+	{
+	  close (fd);
+	  fd = -1;
+	  return -1;
+	}
     }
+  /* Let the host skip checksumming what it sends us.  */
+  if (vnet_hdr)
+    ioctl (fd, TUNSETOFFLOAD, TUN_F_CSUM);
   return 0;
 }
 
@@ -96,6 +96,11 @@ struct grub_virtual_screen
      of entries.  */
   struct grub_colored_char *text_buffer;
 
+  /* Scrolling rotates the rows of the text buffer and of the text layer
+     instead of moving them: text row Y is stored in row
+     (Y + first_row) % rows of both.  */
+  unsigned int first_row;
+
   int total_scroll;
 
   int functional;
@@ -121,6 +126,43 @@ static void destroy_window (void);
 
 static struct grub_video_render_target *text_layer;
 
+/* Number of glyphs kept in the glyph cache.  */
+#define GLYPH_CACHE_SLOTS	512
+/* Slots per row of the glyph atlas.  */
+#define GLYPH_CACHE_COLUMNS	32
+#define GLYPH_CACHE_HASH_SIZE	256
+
+struct glyph_cache_entry
+{
+  struct glyph_cache_entry *hash_next;
+  struct glyph_cache_entry *lru_prev;
+  struct glyph_cache_entry *lru_next;
+
+  /* Glyph this slot was rendered from, or NULL if the slot is unused.  */
+  struct grub_font_glyph *glyph;
+  grub_uint32_t code;
+  grub_video_color_t fg_color;
+  grub_video_color_t bg_color;
+
+  /* Position of the slot in the atlas.  */
+  unsigned int x;
+  unsigned int y;
+};
+
+/* Character cells already rendered in the pixel format of the text layer,
+   so that repainting a character is a plain rectangle copy instead of
+   expanding its 1-bit glyph again.  Slots are recycled in LRU order.  */
+static struct
+{
+  struct grub_video_render_target *atlas;
+  unsigned int slot_width;
+  struct glyph_cache_entry *entries;
+  struct glyph_cache_entry *hash[GLYPH_CACHE_HASH_SIZE];
+  /* Most recently used slot first.  */
+  struct glyph_cache_entry *lru_first;
+  struct glyph_cache_entry *lru_last;
+} glyph_cache;
+
 struct grub_gfxterm_background grub_gfxterm_background;
 
 static struct grub_dirty_region dirty_region;
@@ -177,9 +219,164 @@ clear_char (struct grub_colored_char *c)
   c->bg_color = virtual_screen.bg_color;
 }
 
+static inline struct grub_colored_char *
+text_buffer_row (unsigned int cy)
+{
+  return (virtual_screen.text_buffer
+	  + ((cy + virtual_screen.first_row) % virtual_screen.rows)
+	  * virtual_screen.columns);
+}
+
+/* Get the Y coordinate of text row CY in the text layer.  Rows which are
+   still to be scrolled in by real_scroll have no place there yet.  */
+static inline unsigned int
+text_layer_y (unsigned int cy)
+{
+  return (((cy + virtual_screen.first_row) % virtual_screen.rows)
+	  * virtual_screen.normal_char_height);
+}
+
+static void
+glyph_cache_free (void)
+{
+  grub_video_delete_render_target (glyph_cache.atlas);
+  grub_free (glyph_cache.entries);
+  grub_memset (&glyph_cache, 0, sizeof (glyph_cache));
+}
+
+/* Allocate the glyph cache for the current font.  Failing is not fatal,
+   characters are then drawn directly.  */
+static void
+glyph_cache_setup (void)
+{
+  unsigned int i;
+
+  /* Room for characters spanning two cells.  */
+  glyph_cache.slot_width = 2 * virtual_screen.normal_char_width;
+  glyph_cache.entries = grub_zalloc (GLYPH_CACHE_SLOTS
+				     * sizeof (glyph_cache.entries[0]));
+  if (!glyph_cache.entries
+      || grub_video_create_render_target (&glyph_cache.atlas,
+					  GLYPH_CACHE_COLUMNS
+					  * glyph_cache.slot_width,
+					  GLYPH_CACHE_SLOTS
+					  / GLYPH_CACHE_COLUMNS
+					  * virtual_screen.normal_char_height,
+					  GRUB_VIDEO_MODE_TYPE_INDEX_COLOR
+					  | GRUB_VIDEO_MODE_TYPE_ALPHA))
+    {
+      glyph_cache_free ();
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  for (i = 0; i < GLYPH_CACHE_SLOTS; i++)
+    {
+      struct glyph_cache_entry *e = &glyph_cache.entries[i];
+
+      e->x = (i % GLYPH_CACHE_COLUMNS) * glyph_cache.slot_width;
+      e->y = (i / GLYPH_CACHE_COLUMNS) * virtual_screen.normal_char_height;
+      e->lru_prev = i ? e - 1 : 0;
+      e->lru_next = i + 1 < GLYPH_CACHE_SLOTS ? e + 1 : 0;
+    }
+  glyph_cache.lru_first = &glyph_cache.entries[0];
+  glyph_cache.lru_last = &glyph_cache.entries[GLYPH_CACHE_SLOTS - 1];
+}
+
+static inline unsigned int
+glyph_cache_hash (grub_uint32_t code, grub_video_color_t fg_color,
+		  grub_video_color_t bg_color)
+{
+  return (code ^ (fg_color << 3) ^ (bg_color << 5)
+	  ^ (code >> 8)) % GLYPH_CACHE_HASH_SIZE;
+}
+
+static void
+glyph_cache_touch (struct glyph_cache_entry *e)
+{
+  if (e == glyph_cache.lru_first)
+    return;
+
+  e->lru_prev->lru_next = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    glyph_cache.lru_last = e->lru_prev;
+
+  e->lru_prev = 0;
+  e->lru_next = glyph_cache.lru_first;
+  glyph_cache.lru_first->lru_prev = e;
+  glyph_cache.lru_first = e;
+}
+
+/* Return the atlas slot holding character P drawn with GLYPH, rendering
+   it first if needed.  Returns NULL for characters which can't be cached:
+   combined or modified glyphs and glyphs reaching out of their cell.
+   Expects the text layer to be the active render target.  */
+static struct glyph_cache_entry *
+glyph_cache_get (struct grub_colored_char *p, struct grub_font_glyph *glyph,
+		 unsigned int width, int ascent)
+{
+  struct glyph_cache_entry *e, **prev;
+  unsigned int hash;
+
+  if (!glyph_cache.atlas || p->code.ncomb || p->code.attributes
+      || p->code.variant || width > glyph_cache.slot_width
+      || glyph->offset_x < 0
+      || glyph->offset_x + glyph->width > (int) width
+      || ascent - glyph->offset_y - glyph->height < 0
+      || ascent - glyph->offset_y
+      > (int) virtual_screen.normal_char_height)
+    return 0;
+
+  hash = glyph_cache_hash (p->code.base, p->fg_color, p->bg_color);
+  for (e = glyph_cache.hash[hash]; e; e = e->hash_next)
+    if (e->code == p->code.base && e->fg_color == p->fg_color
+	&& e->bg_color == p->bg_color)
+      break;
+
+  if (!e)
+    {
+      /* Recycle the least recently used slot.  */
+      e = glyph_cache.lru_last;
+      if (e->glyph)
+	{
+	  prev = &glyph_cache.hash[glyph_cache_hash (e->code, e->fg_color,
+						     e->bg_color)];
+	  while (*prev != e)
+	    prev = &(*prev)->hash_next;
+	  *prev = e->hash_next;
+	}
+      e->code = p->code.base;
+      e->fg_color = p->fg_color;
+      e->bg_color = p->bg_color;
+      e->glyph = 0;
+      e->hash_next = glyph_cache.hash[hash];
+      glyph_cache.hash[hash] = e;
+    }
+
+  /* A font loaded later may provide a better fallback for this code.  */
+  if (e->glyph != glyph)
+    {
+      grub_video_set_active_render_target (glyph_cache.atlas);
+      grub_video_set_viewport (e->x, e->y, glyph_cache.slot_width,
+			       virtual_screen.normal_char_height);
+      grub_video_fill_rect (p->bg_color, 0, 0, glyph_cache.slot_width,
+			    virtual_screen.normal_char_height);
+      grub_font_draw_glyph (glyph, p->fg_color, 0, ascent);
+      grub_video_set_active_render_target (text_layer);
+      e->glyph = glyph;
+    }
+
+  glyph_cache_touch (e);
+  return e;
+}
+
 static void
 grub_virtual_screen_free (void)
 {
+  glyph_cache_free ();
+
   virtual_screen.functional = 0;
 
   /* If virtual screen has been allocated, free it.  */
@@ -226,6 +423,7 @@ grub_virtual_screen_setup (unsigned int x, unsigned int y,
   virtual_screen.cursor_x = 0;
   virtual_screen.cursor_y = 0;
   virtual_screen.cursor_state = 1;
+  virtual_screen.first_row = 0;
   virtual_screen.total_scroll = 0;
 
   /* Calculate size of text buffer.  */
@@ -259,6 +457,8 @@ grub_virtual_screen_setup (unsigned int x, unsigned int y,
 
   set_term_color (virtual_screen.term_color);
 
+  glyph_cache_setup ();
+
   grub_video_set_active_render_target (render_target);
 
   virtual_screen.bg_color_display =
@@ -421,6 +621,45 @@ grub_gfxterm_term_fini (struct grub_term_output *term __attribute__ ((unused)))
   return GRUB_ERR_NONE;
 }
 
+/* Blit the part of the text layer shown at X, Y of the window, undoing
+   the rotation of its rows.  As long as a scroll is pending, the window
+   still shows the rows from before it.  */
+static void
+blit_text_layer (enum grub_video_blit_operators oper, int x, int y,
+		 int width, int height)
+{
+  int text_height = virtual_screen.rows * virtual_screen.normal_char_height;
+  int shift = 0;
+
+  if (virtual_screen.rows)
+    shift = ((virtual_screen.first_row + virtual_screen.rows
+	      - virtual_screen.total_scroll % virtual_screen.rows)
+	     % virtual_screen.rows) * virtual_screen.normal_char_height;
+
+  while (height > 0)
+    {
+      int ty = y - (int) virtual_screen.offset_y;
+      int sy = ty;
+      int h = height;
+
+      /* Split at the borders of the text rows and at the wrap point.  */
+      if (ty < 0)
+	h = grub_min (h, -ty);
+      else if (ty < text_height)
+	{
+	  sy = (ty + shift) % text_height;
+	  h = grub_min (h, text_height - ty);
+	  h = grub_min (h, text_height - sy);
+	}
+
+      grub_video_blit_render_target (text_layer, oper, x, y,
+				     x - virtual_screen.offset_x, sy,
+				     width, h);
+      y += h;
+      height -= h;
+    }
+}
+
 static void
 redraw_screen_rect (unsigned int x, unsigned int y,
                     unsigned int width, unsigned int height)
@@ -494,16 +733,10 @@ redraw_screen_rect (unsigned int x, unsigned int y,
 
   if (grub_gfxterm_background.blend_text_bg)
     /* Render text layer as blended.  */
-    grub_video_blit_render_target (text_layer, GRUB_VIDEO_BLIT_BLEND, x, y,
-                                   x - virtual_screen.offset_x,
-                                   y - virtual_screen.offset_y,
-                                   width, height);
+    blit_text_layer (GRUB_VIDEO_BLIT_BLEND, x, y, width, height);
   else
     /* Render text layer as replaced (to get texts background color).  */
-    grub_video_blit_render_target (text_layer, GRUB_VIDEO_BLIT_REPLACE, x, y,
-                                   x - virtual_screen.offset_x,
-                                   y - virtual_screen.offset_y,
-                                   width, height);
+    blit_text_layer (GRUB_VIDEO_BLIT_REPLACE, x, y, width, height);
 
   /* Restore saved viewport.  */
   grub_video_set_viewport (saved_view.x, saved_view.y,
@@ -608,6 +841,7 @@ paint_char (unsigned cx, unsigned cy)
 {
   struct grub_colored_char *p;
   struct grub_font_glyph *glyph;
+  struct glyph_cache_entry *cached;
   grub_video_color_t color;
   grub_video_color_t bgcolor;
   unsigned int x;
@@ -620,8 +854,7 @@ paint_char (unsigned cx, unsigned cy)
     return;
 
   /* Find out active character.  */
-  p = (virtual_screen.text_buffer
-       + cx + (cy * virtual_screen.columns));
+  p = text_buffer_row (cy) + cx;
 
   if (!p->code.base)
     return;
@@ -642,17 +875,27 @@ paint_char (unsigned cx, unsigned cy)
   bgcolor = p->bg_color;
 
   x = cx * virtual_screen.normal_char_width;
-  y = (cy + virtual_screen.total_scroll) * virtual_screen.normal_char_height;
+  y = text_layer_y (cy);
 
   /* Render glyph to text layer.  */
   grub_video_set_active_render_target (text_layer);
-  grub_video_fill_rect (bgcolor, x, y, width, height);
-  grub_font_draw_glyph (glyph, color, x, y + ascent);
+  cached = glyph_cache_get (p, glyph, width, ascent);
+  if (cached)
+    grub_video_blit_render_target (glyph_cache.atlas, GRUB_VIDEO_BLIT_REPLACE,
+				   x, y, cached->x, cached->y, width, height);
+  else
+    {
+      grub_video_fill_rect (bgcolor, x, y, width, height);
+      grub_font_draw_glyph (glyph, color, x, y + ascent);
+    }
   grub_video_set_active_render_target (render_target);
 
   /* Mark character to be drawn.  */
-  dirty_region_add (virtual_screen.offset_x + x, virtual_screen.offset_y + y,
-                    width, height);
+  dirty_region_add (virtual_screen.offset_x + x,
+		    virtual_screen.offset_y
+		    + (cy + virtual_screen.total_scroll)
+		    * virtual_screen.normal_char_height,
+		    width, height);
 }
 
 static inline void
@@ -683,19 +926,20 @@ draw_cursor (int show)
   x = virtual_screen.cursor_x * virtual_screen.normal_char_width;
   width = virtual_screen.normal_char_width;
   color = virtual_screen.fg_color;
-  y = ((virtual_screen.cursor_y + virtual_screen.total_scroll)
-       * virtual_screen.normal_char_height
-       + grub_font_get_ascent (virtual_screen.font));
+  y = grub_font_get_ascent (virtual_screen.font);
   height = 2;
   
   /* Render cursor to text layer.  */
   grub_video_set_active_render_target (text_layer);
-  grub_video_fill_rect (color, x, y, width, height);
+  grub_video_fill_rect (color, x, text_layer_y (virtual_screen.cursor_y) + y,
+			width, height);
   grub_video_set_active_render_target (render_target);
   
   /* Mark cursor to be redrawn.  */
   dirty_region_add (virtual_screen.offset_x + x,
-		    virtual_screen.offset_y + y,
+		    virtual_screen.offset_y
+		    + (virtual_screen.cursor_y + virtual_screen.total_scroll)
+		    * virtual_screen.normal_char_height + y,
 		    width, height);
 }
 
@@ -711,12 +955,6 @@ real_scroll (void)
   /* If we have bitmap, re-draw screen, otherwise scroll physical screen too.  */
   if (grub_gfxterm_background.bitmap)
     {
-      /* Scroll physical screen.  */
-      grub_video_set_active_render_target (text_layer);
-      color = virtual_screen.bg_color;
-      grub_video_scroll (color, 0, -virtual_screen.normal_char_height
-			 * virtual_screen.total_scroll);
-
       /* Mark virtual screen to be redrawn.  */
       dirty_region_add_virtualscreen ();
     }
@@ -735,27 +973,22 @@ real_scroll (void)
 
       while (i--)
 	{
-	  /* Save viewport and set it to our window.  */
+	  /* Bring the rows which are moved up to date.  */
+	  dirty_region_redraw ();
+
+	  /* Save viewport and set it to the text rows.  */
 	  grub_video_get_viewport ((unsigned *) &saved_view.x, 
 				   (unsigned *) &saved_view.y, 
 				   (unsigned *) &saved_view.width, 
 				   (unsigned *) &saved_view.height);
 
-	  grub_video_set_viewport (window.x, window.y, window.width,
-				   window.height);
-
-	  /* Clear new border area.  */
-	  grub_video_fill_rect (color,
-				virtual_screen.offset_x,
-				virtual_screen.offset_y,
-				virtual_screen.width,
-				virtual_screen.normal_char_height
-				* virtual_screen.total_scroll);
-
-	  grub_video_set_active_render_target (render_target);
-	  dirty_region_redraw ();
+	  grub_video_set_viewport (window.x + virtual_screen.offset_x,
+				   window.y + virtual_screen.offset_y,
+				   virtual_screen.width,
+				   virtual_screen.rows
+				   * virtual_screen.normal_char_height);
 
-	  /* Scroll physical screen.  */
+	  /* Scroll physical screen, all pending scrolls in one move.  */
 	  grub_video_scroll (color, 0, -virtual_screen.normal_char_height
 			     * virtual_screen.total_scroll);
 
@@ -767,15 +1000,6 @@ real_scroll (void)
 	    grub_video_swap_buffers ();
 	}
       dirty_region_reset ();
-
-      /* Scroll physical screen.  */
-      grub_video_set_active_render_target (text_layer);
-      color = virtual_screen.bg_color;
-      grub_video_scroll (color, 0, -virtual_screen.normal_char_height
-			 * virtual_screen.total_scroll);
-
-      grub_video_set_active_render_target (render_target);
-
     }
 
   was_scroll = virtual_screen.total_scroll;
@@ -784,6 +1008,15 @@ real_scroll (void)
   if (was_scroll > virtual_screen.rows)
     was_scroll = virtual_screen.rows;
 
+  /* The rows of the text layer which were scrolled out are reused for the
+     new ones.  */
+  grub_video_set_active_render_target (text_layer);
+  color = virtual_screen.bg_color;
+  for (i = virtual_screen.rows - was_scroll; i < virtual_screen.rows; i++)
+    grub_video_fill_rect (color, 0, text_layer_y (i), virtual_screen.width,
+			  virtual_screen.normal_char_height);
+  grub_video_set_active_render_target (render_target);
+
   /* Draw shadow part.  */
   for (i = virtual_screen.rows - was_scroll;
        i < virtual_screen.rows; i++)
@@ -798,25 +1031,15 @@ real_scroll (void)
 static void
 scroll_up (void)
 {
+  struct grub_colored_char *row = text_buffer_row (0);
   unsigned int i;
 
-  /* Clear first line in text buffer.  */
+  /* Clear first line in text buffer, it becomes the last one.  */
   for (i = 0; i < virtual_screen.columns; i++)
-    grub_unicode_destroy_glyph (&virtual_screen.text_buffer[i].code);
-  
-  /* Scroll text buffer with one line to up.  */
-  grub_memmove (virtual_screen.text_buffer,
-                virtual_screen.text_buffer + virtual_screen.columns,
-                sizeof (*virtual_screen.text_buffer)
-                * virtual_screen.columns
-                * (virtual_screen.rows - 1));
-
-  /* Clear last line in text buffer.  */
-  for (i = virtual_screen.columns * (virtual_screen.rows - 1);
-       i < virtual_screen.columns * virtual_screen.rows;
-       i++)
-    clear_char (&(virtual_screen.text_buffer[i]));
+    clear_char (&row[i]);
 
+  virtual_screen.first_row = ((virtual_screen.first_row + 1)
+			      % virtual_screen.rows);
   virtual_screen.total_scroll++;
 }
 
@@ -875,9 +1098,7 @@ grub_gfxterm_putchar (struct grub_term_output *term,
 	}
 
       /* Find position on virtual screen, and fill information.  */
-      p = (virtual_screen.text_buffer +
-           virtual_screen.cursor_x +
-           virtual_screen.cursor_y * virtual_screen.columns);
+      p = text_buffer_row (virtual_screen.cursor_y) + virtual_screen.cursor_x;
       grub_unicode_destroy_glyph (&p->code);
       grub_unicode_set_glyph (&p->code, c);
       grub_errno = GRUB_ERR_NONE;
@@ -889,9 +1110,8 @@ grub_gfxterm_putchar (struct grub_term_output *term,
         {
           unsigned i;
 
-          for (i = 1; i < char_width && p + i < 
-		 virtual_screen.text_buffer + virtual_screen.columns
-		 * virtual_screen.rows; i++)
+          for (i = 1; i < char_width
+		 && virtual_screen.cursor_x + i < virtual_screen.columns; i++)
 	      {
 		grub_unicode_destroy_glyph (&p[i].code);
 		p[i].code.base = 0;
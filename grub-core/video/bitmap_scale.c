@@ -32,6 +32,8 @@ static grub_err_t scale_nn (struct grub_video_bitmap *dst,
                             struct grub_video_bitmap *src);
 static grub_err_t scale_bilinear (struct grub_video_bitmap *dst,
                                   struct grub_video_bitmap *src);
+static grub_err_t scale_area (struct grub_video_bitmap *dst,
+                              struct grub_video_bitmap *src);
 
 static grub_err_t
 verify_source_bitmap (struct grub_video_bitmap *src)
@@ -60,14 +62,27 @@ grub_video_bitmap_scale (struct grub_video_bitmap *dst,
                          struct grub_video_bitmap *src,
                          enum grub_video_bitmap_scale_method scale_method)
 {
+  int downscale = (dst->mode_info.width <= src->mode_info.width
+                   && dst->mode_info.height <= src->mode_info.height);
+
   switch (scale_method)
     {
     case GRUB_VIDEO_BITMAP_SCALE_METHOD_FASTEST:
     case GRUB_VIDEO_BITMAP_SCALE_METHOD_NEAREST:
       return scale_nn (dst, src);
     case GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST:
+      /* Bilinear interpolation skips source pixels when shrinking.  */
+      if (downscale
+          && (dst->mode_info.width < src->mode_info.width
+              || dst->mode_info.height < src->mode_info.height))
+        return scale_area (dst, src);
+      return scale_bilinear (dst, src);
     case GRUB_VIDEO_BITMAP_SCALE_METHOD_BILINEAR:
       return scale_bilinear (dst, src);
+    case GRUB_VIDEO_BITMAP_SCALE_METHOD_AREA:
+      if (downscale)
+        return scale_area (dst, src);
+      return scale_bilinear (dst, src);
     default:
       return grub_error (GRUB_ERR_BUG, "Invalid scale_method value");
     }
@@ -412,6 +427,12 @@ scale_nn (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
    dimensions of DST.  This function uses the bilinear interpolation algorithm
    to interpolate the pixels.
 
+   The interpolation is done in two passes: source rows are first
+   interpolated horizontally into 8.8 fixed-point rows, which are then
+   blended vertically.  Every source row is interpolated horizontally at
+   most once, and the source positions of the columns are computed only
+   once per bitmap.
+
    Supports only direct color modes which have components separated
    into bytes (e.g., RGBA 8:8:8:8 or BGR 8:8:8 true color).
    But because of this simplifying assumption, the implementation is
@@ -434,82 +455,216 @@ scale_bilinear (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
   /* bytes_per_pixel is the same for both src and dst. */
   int bytes_per_pixel = dst->mode_info.bytes_per_pixel;
   unsigned dy, syf, sy, ystep, yfrac, yover;
-  unsigned sxf, sx, xstep, xfrac, xover;
-  grub_uint8_t *dptr, *dline_end, *sline;
+  unsigned dx, sxf, xstep, xfrac, xover;
+  unsigned row_len = dw * bytes_per_pixel;
+  /* Number of leading columns which have a right neighbour to interpolate
+     with.  The remaining ones use nearest neighbor.  */
+  unsigned interp_len;
+  /* Byte offset of the left source pixel and horizontal .8 fraction of
+     every destination column.  */
+  unsigned *xoff;
+  grub_uint8_t *xweight;
+  /* Horizontally interpolated source rows ROW_Y[0] and ROW_Y[1].  */
+  grub_uint16_t *rows[2];
+  unsigned row_y[2] = { sh, sh };
+  grub_uint8_t *dptr, *sline;
+  unsigned i;
+
+  xoff = grub_malloc (dw * sizeof (xoff[0]));
+  xweight = grub_malloc (dw);
+  rows[0] = grub_malloc (2 * row_len * sizeof (rows[0][0]));
+  if (!xoff || !xweight || !rows[0])
+    {
+      grub_free (xoff);
+      grub_free (xweight);
+      grub_free (rows[0]);
+      return grub_errno;
+    }
+  rows[1] = rows[0] + row_len;
 
   xstep = (sw << 8) / dw;
   xover = (sw << 8) % dw;
   ystep = (sh << 8) / dh;
   yover = (sh << 8) % dh;
 
+  interp_len = 0;
+  for (dx = 0, sxf = 0, xfrac = 0; dx < dw; dx++, sxf += xstep, xfrac += xover)
+    {
+      if (xfrac >= dw)
+	{
+	  xfrac -= dw;
+	  sxf++;
+	}
+      xoff[dx] = (sxf >> 8) * bytes_per_pixel;
+      xweight[dx] = sxf & 0xff;
+      if ((sxf >> 8) < sw - 1)
+	interp_len = (dx + 1) * bytes_per_pixel;
+    }
+
   for (dy = 0, syf = 0, yfrac = 0; dy < dh; dy++, syf += ystep, yfrac += yover)
     {
+      unsigned v;
+      grub_uint16_t *h0, *h1;
+
       if (yfrac >= dh)
 	{
 	  yfrac -= dh;
 	  syf++;
 	}
       sy = syf >> 8;
+      v = syf & 0xff;
       dptr = ddata + dy * dstride;
-      dline_end = dptr + dw * bytes_per_pixel;
       sline = sdata + sy * sstride;
-      for (sxf = 0, xfrac = 0; dptr < dline_end; sxf += xstep, xfrac += xover, dptr += bytes_per_pixel)
-        {
-          grub_uint8_t *sptr;
-          int comp;
 
-	  if (xfrac >= dw)
+      if (sy < sh - 1)
+	{
+	  unsigned k;
+
+	  /* Make sure rows SY and SY + 1 are interpolated, reusing the
+	     rows of the previous destination row when possible.  */
+	  for (k = 0; k < 2; k++)
 	    {
-	      xfrac -= dw;
-	      sxf++;
+	      unsigned y = sy + k;
+	      int slot;
+	      grub_uint16_t *h;
+	      grub_uint8_t *s;
+
+	      if (row_y[0] == y || row_y[1] == y)
+		continue;
+	      /* Replace the row which isn't needed anymore.  */
+	      slot = (row_y[0] == sy || row_y[0] == sy + 1) ? 1 : 0;
+	      row_y[slot] = y;
+	      h = rows[slot];
+	      s = sline + k * sstride;
+	      for (dx = 0, i = 0; i < interp_len; dx++)
+		{
+		  grub_uint8_t *sptr = s + xoff[dx];
+		  unsigned u = xweight[dx];
+		  int comp;
+
+		  for (comp = 0; comp < bytes_per_pixel; comp++, i++)
+		    h[i] = ((256 - u) * sptr[comp]
+			    + u * sptr[comp + bytes_per_pixel]);
+		}
 	    }
+	  h0 = rows[row_y[0] == sy ? 0 : 1];
+	  h1 = rows[row_y[0] == sy ? 1 : 0];
+
+	  if (v == 0)
+	    for (i = 0; i < interp_len; i++)
+	      dptr[i] = h0[i] >> 8;
+	  else
+	    for (i = 0; i < interp_len; i++)
+	      dptr[i] = ((256 - v) * h0[i] + v * h1[i]) >> 16;
+	}
+      else
+	i = 0;
 
-          /* Get the address of the pixels in src and dst. */
-	  sx = sxf >> 8;
-	  sptr = sline + sx * bytes_per_pixel;
+      /* Fall back to nearest neighbor interpolation at the right and
+	 bottom edges.  */
+      for (dx = i / bytes_per_pixel; i < row_len; dx++)
+	{
+	  grub_uint8_t *sptr = sline + xoff[dx];
+	  int comp;
 
-          /* If we have enough space to do so, use bilinear interpolation.
-             Otherwise, fall back to nearest neighbor for this pixel. */
-          if (sx < sw - 1 && sy < sh - 1)
-            {
-              /* Do bilinear interpolation. */
-
-              /* Fixed-point .8 numbers representing the fraction of the
-                 distance in the x (u) and y (v) direction within the
-                 box of 4 pixels in the source. */
-              unsigned u = sxf & 0xff;
-              unsigned v = syf & 0xff;
-
-              for (comp = 0; comp < bytes_per_pixel; comp++)
-                {
-                  /* Get the component's values for the
-                     four source corner pixels. */
-                  unsigned f00 = sptr[comp];
-                  unsigned f10 = sptr[comp + bytes_per_pixel];
-                  unsigned f01 = sptr[comp + sstride];
-                  unsigned f11 = sptr[comp + sstride + bytes_per_pixel];
-
-                  /* Count coeffecients. */
-                  unsigned c00 = (256 - u) * (256 - v);
-                  unsigned c10 = u * (256 - v);
-                  unsigned c01 = (256 - u) * v;
-                  unsigned c11 = u * v;
-
-                  /* Interpolate. */
-                  unsigned fxy = c00 * f00 + c01 * f01 + c10 * f10 + c11 * f11;
-                  fxy = fxy >> 16;
-
-                  dptr[comp] = fxy;
-                }
-            }
-          else
-            {
-              /* Fall back to nearest neighbor interpolation. */
-              /* Copy the pixel color value. */
-              for (comp = 0; comp < bytes_per_pixel; comp++)
-                dptr[comp] = sptr[comp];
-            }
-        }
+	  for (comp = 0; comp < bytes_per_pixel; comp++, i++)
+	    dptr[i] = sptr[comp];
+	}
+    }
+
+  grub_free (xoff);
+  grub_free (xweight);
+  grub_free (rows[0]);
+  return GRUB_ERR_NONE;
+}
+
+/* Area averaging image scaling algorithm.
+
+   Copy the bitmap SRC to the bitmap DST, shrinking the bitmap to fit the
+   dimensions of DST.  Every destination pixel is the average of the box of
+   source pixels it covers, so no source pixel is skipped.  DST must not be
+   larger than SRC in either dimension.
+
+   Supports only direct color modes which have components separated
+   into bytes (e.g., RGBA 8:8:8:8 or BGR 8:8:8 true color).
+   But because of this simplifying assumption, the implementation is
+   greatly simplified.  */
+static grub_err_t
+scale_area (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
+{
+  grub_err_t err = verify_bitmaps(dst, src);
+  if (err != GRUB_ERR_NONE)
+    return err;
+
+  grub_uint8_t *ddata = dst->data;
+  grub_uint8_t *sdata = src->data;
+  unsigned dw = dst->mode_info.width;
+  unsigned dh = dst->mode_info.height;
+  unsigned sw = src->mode_info.width;
+  unsigned sh = src->mode_info.height;
+  int dstride = dst->mode_info.pitch;
+  int sstride = src->mode_info.pitch;
+  /* bytes_per_pixel is the same for both src and dst. */
+  int bytes_per_pixel = dst->mode_info.bytes_per_pixel;
+  /* First source column of every destination column, and the end of the
+     last one.  */
+  unsigned *xstart;
+  /* Component sums of the current destination row.  */
+  grub_uint32_t *sum;
+  unsigned dx, dy, sx, sy, sy0, sy1, i;
+  grub_uint8_t *dptr, *sline;
+
+  if (dw > sw || dh > sh)
+    return grub_error (GRUB_ERR_BUG, "area scaling can only shrink");
+
+  xstart = grub_malloc ((dw + 1) * sizeof (xstart[0]));
+  sum = grub_malloc (dw * bytes_per_pixel * sizeof (sum[0]));
+  if (!xstart || !sum)
+    {
+      grub_free (xstart);
+      grub_free (sum);
+      return grub_errno;
+    }
+
+  for (dx = 0; dx <= dw; dx++)
+    xstart[dx] = grub_divmod64 ((grub_uint64_t) dx * sw, dw, 0);
+
+  for (dy = 0; dy < dh; dy++)
+    {
+      sy0 = grub_divmod64 ((grub_uint64_t) dy * sh, dh, 0);
+      sy1 = grub_divmod64 ((grub_uint64_t) (dy + 1) * sh, dh, 0);
+
+      grub_memset (sum, 0, dw * bytes_per_pixel * sizeof (sum[0]));
+      for (sy = sy0; sy < sy1; sy++)
+	{
+	  grub_uint8_t *sptr;
+
+	  sline = sdata + sy * sstride;
+	  for (dx = 0, i = 0; dx < dw; dx++, i += bytes_per_pixel)
+	    {
+	      sptr = sline + xstart[dx] * bytes_per_pixel;
+	      for (sx = xstart[dx]; sx < xstart[dx + 1]; sx++)
+		{
+		  int comp;
+
+		  for (comp = 0; comp < bytes_per_pixel; comp++)
+		    sum[i + comp] += *sptr++;
+		}
+	    }
+	}
+
+      dptr = ddata + dy * dstride;
+      for (dx = 0, i = 0; dx < dw; dx++)
+	{
+	  unsigned count = (xstart[dx + 1] - xstart[dx]) * (sy1 - sy0);
+	  int comp;
+
+	  for (comp = 0; comp < bytes_per_pixel; comp++, i++)
+	    dptr[i] = (sum[i] + count / 2) / count;
+	}
     }
+
+  grub_free (xstart);
+  grub_free (sum);
   return GRUB_ERR_NONE;
 }
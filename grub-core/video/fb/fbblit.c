@@ -769,8 +769,8 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
 {
   int i;
   int j;
-  grub_uint8_t *srcptr;
-  grub_uint8_t *dstptr;
+  grub_uint32_t *srcptr;
+  grub_uint32_t *dstptr;
   unsigned int srcrowskip;
   unsigned int dstrowskip;
 
@@ -784,31 +784,19 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
 
   for (j = 0; j < height; j++)
     {
+      /* Whole words are read and written, which is much cheaper than
+	 byte accesses on uncached video memory.  */
       for (i = 0; i < width; i++)
         {
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-          grub_uint8_t a = *srcptr++;
-#endif
-          grub_uint8_t r = *srcptr++;
-          grub_uint8_t g = *srcptr++;
-          grub_uint8_t b = *srcptr++;
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          grub_uint8_t a = *srcptr++;
-#endif
+          grub_uint32_t color = *srcptr++;
 
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-          *dstptr++ = a;
-#endif
-          *dstptr++ = b;
-          *dstptr++ = g;
-          *dstptr++ = r;
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          *dstptr++ = a;
-#endif
+          *dstptr++ = ((color & 0xff00ff00)
+		       | ((color & 0xff) << 16)
+		       | ((color >> 16) & 0xff));
         }
 
-      srcptr += srcrowskip;
-      dstptr += dstrowskip;
+      GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
+      GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
     }
 }
 
@@ -1159,6 +1147,22 @@ alpha_dilute (grub_uint8_t bg, grub_uint8_t fg, grub_uint8_t alpha)
   return h;
 }
 
+/* Same as alpha_dilute applied to the channels at bits 0, 8 and 16 of BG
+   and FG, but two channels share one multiplication.  Bits 24-31 of the
+   result are 0.  */
+static inline grub_uint32_t
+alpha_dilute_pixel (grub_uint32_t bg, grub_uint32_t fg, unsigned int alpha)
+{
+  grub_uint32_t rb, g;
+
+  rb = (fg & 0xff00ff) * alpha + (bg & 0xff00ff) * (255 ^ alpha);
+  g = (fg & 0xff00) * alpha + (bg & 0xff00) * (255 ^ alpha);
+  /* Optimised division by 255 of every 16-bit lane.  */
+  rb = ((rb + 0x10001 + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+  g = ((g + 0x100 + ((g >> 8) & 0xff00)) >> 8) & 0xff00;
+  return rb | g;
+}
+
 /* Generic blending blitter.  Works for every supported format.  */
 static void
 grub_video_fbblit_blend (struct grub_video_fbblit_info *dst,
@@ -1245,13 +1249,7 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
       for (i = 0; i < width; i++)
         {
           grub_uint32_t color;
-          unsigned int sr;
-          unsigned int sg;
-          unsigned int sb;
           unsigned int a;
-          unsigned int dr;
-          unsigned int dg;
-          unsigned int db;
 
           color = *srcptr++;
 
@@ -1264,31 +1262,14 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
               continue;
             }
 
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
-
-          if (a == 255)
-            {
-              /* Opaque pixel shortcut.  */
-              dr = sr;
-              dg = sg;
-              db = sb;
-            }
-          else
-            {
-              /* General pixel color blending.  */
-              color = *dstptr;
-
-              dr = (color >> 16) & 0xFF;
-              dr = alpha_dilute (dr, sr, a);
-              dg = (color >> 8) & 0xFF;
-              dg = alpha_dilute (dg, sg, a);
-              db = (color >> 0) & 0xFF;
-              db = alpha_dilute (db, sb, a);
-            }
+          /* Swap red and blue.  */
+          color = ((color & 0xff00ff00)
+		   | ((color & 0xff) << 16)
+		   | ((color >> 16) & 0xff));
 
-          color = (a << 24) | (dr << 16) | (dg << 8) | db;
+          /* Opaque pixels are copied as they are.  */
+          if (a != 255)
+            color = alpha_dilute_pixel (*dstptr, color, a) | (a << 24);
 
           *dstptr++ = color;
         }
@@ -1405,13 +1386,7 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
   int j;
   grub_uint32_t *srcptr;
   grub_uint32_t *dstptr;
-  unsigned int sr;
-  unsigned int sg;
-  unsigned int sb;
   unsigned int a;
-  unsigned int dr;
-  unsigned int dg;
-  unsigned int db;
   grub_size_t srcrowskip;
   grub_size_t dstrowskip;
 
@@ -1441,23 +1416,8 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
               continue;
             }
 
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
-
-          color = *dstptr;
-
-          dr = (color >> 0) & 0xFF;
-          dg = (color >> 8) & 0xFF;
-          db = (color >> 16) & 0xFF;
-
-          dr = alpha_dilute (dr, sr, a);
-          dg = alpha_dilute (dg, sg, a);
-          db = alpha_dilute (db, sb, a);
-
-          color = (a << 24) | (db << 16) | (dg << 8) | dr;
-
-          *dstptr++ = color;
+          *dstptr = alpha_dilute_pixel (*dstptr, color, a) | (a << 24);
+          dstptr++;
         }
       GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
       GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
@@ -1555,6 +1515,112 @@ grub_video_fbblit_blend_RGB888_RGBA8888 (struct grub_video_fbblit_info *dst,
     }
 }
 
+/* Optimized replacing blitter for RGBA8888 to RGB565 and BGR565.  */
+static void
+grub_video_fbblit_replace_XXX565_RGBA8888 (struct grub_video_fbblit_info *dst,
+					   struct grub_video_fbblit_info *src,
+					   int x, int y,
+					   int width, int height,
+					   int offset_x, int offset_y)
+{
+  int i;
+  int j;
+  grub_uint32_t *srcptr;
+  grub_uint16_t *dstptr;
+  unsigned int srcrowskip;
+  unsigned int dstrowskip;
+  unsigned int rpos = dst->mode_info->red_field_pos;
+  unsigned int bpos = dst->mode_info->blue_field_pos;
+
+  /* Calculate the number of bytes to advance from the end of one line
+     to the beginning of the next line.  */
+  srcrowskip = src->mode_info->pitch - src->mode_info->bytes_per_pixel * width;
+  dstrowskip = dst->mode_info->pitch - dst->mode_info->bytes_per_pixel * width;
+
+  srcptr = grub_video_fb_get_video_ptr (src, offset_x, offset_y);
+  dstptr = grub_video_fb_get_video_ptr (dst, x, y);
+
+  for (j = 0; j < height; j++)
+    {
+      for (i = 0; i < width; i++)
+        {
+          grub_uint32_t color = *srcptr++;
+
+          *dstptr++ = ((((color >> 3) & 0x1f) << rpos)
+		       | (((color >> 10) & 0x3f) << 5)
+		       | (((color >> 19) & 0x1f) << bpos));
+        }
+
+      GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
+      GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
+    }
+}
+
+/* Optimized blending blitter for RGBA8888 to RGB565 and BGR565.  */
+static void
+grub_video_fbblit_blend_XXX565_RGBA8888 (struct grub_video_fbblit_info *dst,
+					 struct grub_video_fbblit_info *src,
+					 int x, int y,
+					 int width, int height,
+					 int offset_x, int offset_y)
+{
+  int i;
+  int j;
+  grub_uint32_t *srcptr;
+  grub_uint16_t *dstptr;
+  unsigned int srcrowskip;
+  unsigned int dstrowskip;
+  unsigned int rpos = dst->mode_info->red_field_pos;
+  unsigned int bpos = dst->mode_info->blue_field_pos;
+
+  /* Calculate the number of bytes to advance from the end of one line
+     to the beginning of the next line.  */
+  srcrowskip = src->mode_info->pitch - src->mode_info->bytes_per_pixel * width;
+  dstrowskip = dst->mode_info->pitch - dst->mode_info->bytes_per_pixel * width;
+
+  srcptr = grub_video_fb_get_video_ptr (src, offset_x, offset_y);
+  dstptr = grub_video_fb_get_video_ptr (dst, x, y);
+
+  for (j = 0; j < height; j++)
+    {
+      for (i = 0; i < width; i++)
+        {
+          grub_uint32_t color;
+          unsigned int a;
+
+          color = *srcptr++;
+
+          a = color >> 24;
+
+          if (a == 0)
+            {
+              /* Skip transparent source pixels.  */
+              dstptr++;
+              continue;
+            }
+
+          if (a != 255)
+            {
+              grub_uint32_t d = *dstptr;
+
+              /* Widen the target pixel the way
+                 grub_video_fb_unmap_color_int does.  */
+              d = ((((d >> rpos) & 0x1f) << 3) | 0x7
+                   | ((((d >> 5) & 0x3f) << 2) | 0x3) << 8
+                   | ((((d >> bpos) & 0x1f) << 3) | 0x7) << 16);
+              color = alpha_dilute_pixel (d, color, a);
+            }
+
+          *dstptr++ = ((((color >> 3) & 0x1f) << rpos)
+		       | (((color >> 10) & 0x3f) << 5)
+		       | (((color >> 19) & 0x1f) << bpos));
+        }
+
+      GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
+      GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
+    }
+}
+
 /* Optimized blending blitter for RGBA8888 to indexed color.  */
 static void
 grub_video_fbblit_blend_index_RGBA8888 (struct grub_video_fbblit_info *dst,
@@ -1969,6 +2035,12 @@ grub_video_fb_dispatch_blit (struct grub_video_fbblit_info *target,
 							      x, y, width, height,
 							      offset_x, offset_y);
 	      return;
+	    case GRUB_VIDEO_BLIT_FORMAT_BGR_565:
+	    case GRUB_VIDEO_BLIT_FORMAT_RGB_565:
+	      grub_video_fbblit_replace_XXX565_RGBA8888 (target, source,
+							 x, y, width, height,
+							 offset_x, offset_y);
+	      return;
 	    default:
 	      break;
 	    }
@@ -2031,6 +2103,15 @@ grub_video_fb_dispatch_blit (struct grub_video_fbblit_info *target,
 	    }
 	  break;
 	case GRUB_VIDEO_BLIT_FORMAT_INDEXCOLOR_ALPHA:
+	  /* Render targets sharing the format hold the same indices.  */
+	  if (target->mode_info->blit_format
+	      == GRUB_VIDEO_BLIT_FORMAT_INDEXCOLOR_ALPHA)
+	    {
+	      grub_video_fbblit_replace_directN (target, source,
+						 x, y, width, height,
+						 offset_x, offset_y);
+	      return;
+	    }
 	  switch (target->mode_info->bytes_per_pixel)
 	    {
 	    case 4:
@@ -2125,6 +2206,12 @@ grub_video_fb_dispatch_blit (struct grub_video_fbblit_info *target,
 							    x, y, width, height,
 							    offset_x, offset_y);
 	      return;
+	    case GRUB_VIDEO_BLIT_FORMAT_BGR_565:
+	    case GRUB_VIDEO_BLIT_FORMAT_RGB_565:
+	      grub_video_fbblit_blend_XXX565_RGBA8888 (target, source,
+						       x, y, width, height,
+						       offset_x, offset_y);
+	      return;
 	    default:
 	      break;
 	    }
@@ -31,10 +31,24 @@ GRUB_MOD_LICENSE ("GPLv3+");
 typedef grub_err_t (*grub_video_fb_doublebuf_update_screen_t) (void);
 typedef volatile void *framebuf_t;
 
+/* Up to this many separate rectangles are tracked between two buffer
+   swaps.  Beyond that the pair that is cheapest to merge is merged.  */
+#define DIRTY_MAX_RECTS 8
+/* Rectangles are merged as soon as their bounding box covers at most
+   this many pixels that neither of them does.  */
+#define DIRTY_MERGE_SLACK 4096
+
+/* The lower bounds are inclusive, the upper ones exclusive.  */
+struct dirty_rect
+{
+  int x1, y1;
+  int x2, y2;
+};
+
 struct dirty
 {
-  int first_line;
-  int last_line;
+  int count;
+  struct dirty_rect rects[DIRTY_MAX_RECTS];
 };
 
 static struct
@@ -829,15 +843,123 @@ grub_video_fb_unmap_color_int (struct grub_video_fbblit_info * source,
     }
 }
 
+static inline grub_int64_t
+rect_area (const struct dirty_rect *r)
+{
+  return (grub_int64_t) (r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static void
+rect_union (struct dirty_rect *out, const struct dirty_rect *a,
+	    const struct dirty_rect *b)
+{
+  out->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+  out->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+  out->x2 = a->x2 > b->x2 ? a->x2 : b->x2;
+  out->y2 = a->y2 > b->y2 ? a->y2 : b->y2;
+}
+
+/* Number of pixels that would be copied needlessly if A and B were
+   merged.  Negative if they overlap.  */
+static grub_int64_t
+merge_cost (const struct dirty_rect *a, const struct dirty_rect *b)
+{
+  struct dirty_rect u;
+
+  rect_union (&u, a, b);
+  return rect_area (&u) - rect_area (a) - rect_area (b);
+}
+
+static void
+dirty_add (struct dirty *d, struct dirty_rect r)
+{
+  int i, best;
+
+  if (r.x1 >= r.x2 || r.y1 >= r.y2)
+    return;
+
+ again:
+  for (i = 0; i < d->count; i++)
+    if (merge_cost (&d->rects[i], &r) <= DIRTY_MERGE_SLACK)
+      break;
+
+  if (i == d->count && d->count < DIRTY_MAX_RECTS)
+    {
+      d->rects[d->count++] = r;
+      return;
+    }
+
+  if (i == d->count)
+    for (i = 0, best = 1; best < d->count; best++)
+      if (merge_cost (&d->rects[best], &r) < merge_cost (&d->rects[i], &r))
+	i = best;
+
+  /* The merged rectangle may now touch others as well.  */
+  rect_union (&r, &r, &d->rects[i]);
+  d->rects[i] = d->rects[--d->count];
+  goto again;
+}
+
 static void
-dirty (int y, int height)
+dirty (int x, int y, int width, int height)
 {
-  if (framebuffer.render_target != framebuffer.back_target)
+  struct dirty_rect r = { x, y, x + width, y + height };
+
+  if (framebuffer.render_target != framebuffer.back_target
+      || !framebuffer.update_screen)
     return;
-  if (framebuffer.current_dirty.first_line > y)
-    framebuffer.current_dirty.first_line = y;
-  if (framebuffer.current_dirty.last_line < y + height)
-    framebuffer.current_dirty.last_line = y + height;
+  dirty_add (&framebuffer.current_dirty, r);
+}
+
+/* Video memory is usually uncached and write-combined, so write it
+   sequentially in whole words rather than bytes as grub_memcpy does.  */
+static void
+copy_to_video (volatile void *dst, const void *src, grub_size_t len)
+{
+  volatile grub_uint8_t *d = dst;
+  const grub_uint8_t *s = src;
+
+  while (len && ((grub_addr_t) d & (sizeof (grub_addr_t) - 1)))
+    {
+      *d++ = *s++;
+      len--;
+    }
+  if (!((grub_addr_t) s & (sizeof (grub_addr_t) - 1)))
+    for (; len >= sizeof (grub_addr_t); len -= sizeof (grub_addr_t))
+      {
+	*(volatile grub_addr_t *) d = *(const grub_addr_t *) s;
+	d += sizeof (grub_addr_t);
+	s += sizeof (grub_addr_t);
+      }
+  while (len--)
+    *d++ = *s++;
+}
+
+static void
+dirty_copy (const struct dirty *d, framebuf_t page)
+{
+  struct grub_video_mode_info *mode_info
+    = &framebuffer.back_target->mode_info;
+  const grub_uint8_t *back = framebuffer.back_target->data;
+  int i, y;
+
+  for (i = 0; i < d->count; i++)
+    {
+      const struct dirty_rect *r = &d->rects[i];
+      grub_size_t offset = r->y1 * mode_info->pitch
+	+ r->x1 * mode_info->bytes_per_pixel;
+      grub_size_t len = (r->x2 - r->x1) * mode_info->bytes_per_pixel;
+
+      /* Full-width rectangles are contiguous.  */
+      if (r->x1 == 0 && r->x2 == (int) mode_info->width)
+	{
+	  copy_to_video ((volatile char *) page + offset, back + offset,
+			 mode_info->pitch * (r->y2 - r->y1));
+	  continue;
+	}
+      for (y = r->y1; y < r->y2; y++, offset += mode_info->pitch)
+	copy_to_video ((volatile char *) page + offset, back + offset, len);
+    }
 }
 
 grub_err_t
@@ -895,7 +1017,7 @@ grub_video_fb_fill_rect (grub_video_color_t color, int x, int y,
   x += area_x;
   y += area_y;
 
-  dirty (y, height);
+  dirty (x, y, width, height);
 
   /* Use fbblit_info to encapsulate rendering.  */
   target.mode_info = &framebuffer.render_target->mode_info;
@@ -1008,7 +1130,7 @@ grub_video_fb_blit_source (struct grub_video_fbblit_info *source,
   target.data = framebuffer.render_target->data;
 
   /* Do actual blitting.  */
-  dirty (y, height);
+  dirty (x, y, width, height);
   grub_video_fb_dispatch_blit (&target, source, oper, x, y, width, height,
                                offset_x, offset_y);
 
@@ -1060,7 +1182,9 @@ grub_video_fb_scroll (grub_video_color_t color, int dx, int dy)
   width = framebuffer.render_target->viewport.width - grub_abs (dx);
   height = framebuffer.render_target->viewport.height - grub_abs (dy);
 
-  dirty (framebuffer.render_target->viewport.y,
+  dirty (framebuffer.render_target->viewport.x,
+	 framebuffer.render_target->viewport.y,
+	 framebuffer.render_target->viewport.width,
 	 framebuffer.render_target->viewport.height);
 
   if (dx < 0)
@@ -1415,20 +1539,8 @@ grub_video_fb_get_active_render_target (struct grub_video_fbrender_target **targ
 static grub_err_t
 doublebuf_blit_update_screen (void)
 {
-  if (framebuffer.current_dirty.first_line
-      <= framebuffer.current_dirty.last_line)
-    grub_memcpy ((char *) framebuffer.pages[0]
-		 + framebuffer.current_dirty.first_line
-		 * framebuffer.back_target->mode_info.pitch,
-		 (char *) framebuffer.back_target->data
-		 + framebuffer.current_dirty.first_line
-		 * framebuffer.back_target->mode_info.pitch,
-		 framebuffer.back_target->mode_info.pitch
-		 * (framebuffer.current_dirty.last_line
-		    - framebuffer.current_dirty.first_line));
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  dirty_copy (&framebuffer.current_dirty, framebuffer.pages[0]);
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1461,8 +1573,7 @@ grub_video_fb_doublebuf_blit_init (struct grub_video_fbrender_target **back,
   framebuffer.pages[0] = framebuf;
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
-  framebuffer.current_dirty.first_line = mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1472,26 +1583,17 @@ doublebuf_pageflipping_update_screen (void)
 {
   int new_displayed_page;
   grub_err_t err;
-  int first_line, last_line;
-
-  first_line = framebuffer.current_dirty.first_line;
-  last_line = framebuffer.current_dirty.last_line;
-  if (first_line > framebuffer.previous_dirty.first_line)
-    first_line = framebuffer.previous_dirty.first_line;
-  if (last_line < framebuffer.previous_dirty.last_line)
-    last_line = framebuffer.previous_dirty.last_line;
-
-  if (first_line <= last_line)
-    grub_memcpy ((char *) framebuffer.pages[framebuffer.render_page]
-		 + first_line * framebuffer.back_target->mode_info.pitch,
-		 (char *) framebuffer.back_target->data
-		 + first_line * framebuffer.back_target->mode_info.pitch,
-		 framebuffer.back_target->mode_info.pitch
-		 * (last_line - first_line));
+  struct dirty update;
+  int i;
+
+  /* The page we draw on last received the changes made two swaps ago.  */
+  update = framebuffer.current_dirty;
+  for (i = 0; i < framebuffer.previous_dirty.count; i++)
+    dirty_add (&update, framebuffer.previous_dirty.rects[i]);
+
+  dirty_copy (&update, framebuffer.pages[framebuffer.render_page]);
   framebuffer.previous_dirty = framebuffer.current_dirty;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   /* Swap the page numbers in the framebuffer struct.  */
   new_displayed_page = framebuffer.render_page;
@@ -1544,12 +1646,8 @@ doublebuf_pageflipping_init (struct grub_video_mode_info *mode_info,
   framebuffer.pages[0] = page0_ptr;
   framebuffer.pages[1] = page1_ptr;
 
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
-  framebuffer.previous_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.previous_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
+  framebuffer.previous_dirty.count = 0;
 
   /* Set the framebuffer memory data pointer and display the right page.  */
   err = set_page_in (framebuffer.displayed_page);
@@ -1635,9 +1733,7 @@ grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
   framebuffer.set_page = 0;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   mode_info->mode_type &= ~GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED;
 
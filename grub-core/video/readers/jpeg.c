@@ -23,6 +23,7 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/bufio.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -57,6 +58,31 @@ enum
 
 #define JPEG_UNIT_SIZE		8
 
+/* Huffman codes of up to this many bits are decoded with one table
+   lookup.  */
+#define JPEG_HUFF_LOOKAHEAD	9
+
+/* Fraction bits of the AAN multipliers.  */
+#define JPEG_AAN_BITS		13
+#define AAN_CONST(x)		((int) ((x) * (1L << JPEG_AAN_BITS) + 0.5))
+
+/* Fraction bits of the dequantized coefficients, and those kept between
+   the two passes of the IDCT.  */
+#define JPEG_COEF_BITS		8
+#define JPEG_PASS1_BITS		5
+
+#define JPEG_SCAN_BUF_SIZE	4096
+
+/* Minimum run time of jpegtest, in ms.  */
+#define JPEG_BENCH_TIME		1000
+
+/* AAN scale factors cos (k * pi / 16) * sqrt (2), with 14 fraction bits
+   (1 for k = 0).  The IDCT leaves these out and they are folded into the
+   quantization tables instead.  */
+static const grub_uint16_t jpeg_aan_scales[8] = {
+  16384, 22725, 21407, 19266, 16384, 12873, 8867, 4520
+};
+
 static const grub_uint8_t jpeg_zigzag_order[64] = {
   0, 1, 8, 16, 9, 2, 3, 10,
   17, 24, 32, 25, 18, 11, 4, 5,
@@ -78,7 +104,6 @@ struct grub_jpeg_data
 {
   grub_file_t file;
   struct grub_video_bitmap **bitmap;
-  grub_uint8_t *bitmap_ptr;
 
   unsigned image_width;
   unsigned image_height;
@@ -86,8 +111,12 @@ struct grub_jpeg_data
   grub_uint8_t *huff_value[4];
   int huff_offset[4][16];
   int huff_maxval[4][16];
+  /* Indexed by the next JPEG_HUFF_LOOKAHEAD bits of the stream: code
+     length << 8 | value, or 0 if the code is longer.  */
+  grub_uint16_t huff_lookup[4][1 << JPEG_HUFF_LOOKAHEAD];
 
-  grub_uint8_t quan_table[2][64];
+  /* Dequantization factors in zigzag order, scaled for the IDCT.  */
+  int quan_table[2][64];
   int comp_index[3][3];
 
   jpeg_data_unit_t ydu[4];
@@ -96,13 +125,23 @@ struct grub_jpeg_data
 
   unsigned log_vs, log_hs;
   int dri;
-  unsigned r1;
+  /* Next MCU row and column to decode.  */
+  unsigned r1, c1;
 
   int dc_value[3];
 
   int color_components;
 
-  int bit_mask, bit_save;
+  /* Entropy-coded data read ahead from the file.  */
+  grub_uint8_t scan_buf[JPEG_SCAN_BUF_SIZE];
+  unsigned scan_pos, scan_len;
+
+  /* Bit buffer, the next bit of the stream in the MSB.  */
+  grub_uint32_t bit_buf;
+  int bit_cnt;
+  /* Set when the next byte is a marker or past the end of the file.
+     BIT_PAD counts the zero bits appended to BIT_BUF since then.  */
+  int at_marker, bit_pad;
 };
 
 static grub_uint8_t
@@ -127,43 +166,98 @@ grub_jpeg_get_word (struct grub_jpeg_data *data)
   return grub_be_to_cpu16 (r);
 }
 
-static int
-grub_jpeg_get_bit (struct grub_jpeg_data *data)
+static void
+grub_jpeg_fill_scan_buf (struct grub_jpeg_data *data)
+{
+  unsigned n = data->scan_len - data->scan_pos;
+  grub_ssize_t r;
+
+  grub_memmove (data->scan_buf, data->scan_buf + data->scan_pos, n);
+  r = grub_file_read (data->file, data->scan_buf + n,
+		      sizeof (data->scan_buf) - n);
+  data->scan_pos = 0;
+  data->scan_len = n + (r > 0 ? r : 0);
+}
+
+/* Return the bytes read ahead of the bit buffer to the file, so that it
+   is positioned at the marker ending the entropy-coded segment.  */
+static void
+grub_jpeg_unread_scan_buf (struct grub_jpeg_data *data)
 {
-  int ret;
+  grub_file_seek (data->file, data->file->offset
+		  - (data->scan_len - data->scan_pos));
+  data->scan_pos = data->scan_len = 0;
+}
 
-  if (data->bit_mask == 0)
+static void
+grub_jpeg_fill_bits (struct grub_jpeg_data *data)
+{
+  while (data->bit_cnt <= 24)
     {
-      data->bit_save = grub_jpeg_get_byte (data);
-      if (data->bit_save == JPEG_ESC_CHAR)
+      grub_uint32_t r = 0;
+
+      if (!data->at_marker)
 	{
-	  if (grub_jpeg_get_byte (data) != 0)
+	  if (data->scan_len - data->scan_pos < 2)
+	    grub_jpeg_fill_scan_buf (data);
+
+	  if (data->scan_pos == data->scan_len)
+	    data->at_marker = 1;
+	  else
 	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			  "jpeg: invalid 0xFF in data stream");
-	      return 0;
+	      r = data->scan_buf[data->scan_pos];
+	      if (r != JPEG_ESC_CHAR)
+		data->scan_pos++;
+	      else if (data->scan_pos + 1 < data->scan_len
+		       && data->scan_buf[data->scan_pos + 1] == 0)
+		data->scan_pos += 2;
+	      else
+		{
+		  data->at_marker = 1;
+		  r = 0;
+		}
 	    }
 	}
-      data->bit_mask = 0x80;
+
+      if (data->at_marker)
+	data->bit_pad += 8;
+
+      data->bit_buf |= r << (24 - data->bit_cnt);
+      data->bit_cnt += 8;
     }
+}
+
+static int
+grub_jpeg_get_bits (struct grub_jpeg_data *data, int num)
+{
+  int r;
 
-  ret = ((data->bit_save & data->bit_mask) != 0);
-  data->bit_mask >>= 1;
-  return ret;
+  if (data->bit_cnt < num)
+    grub_jpeg_fill_bits (data);
+
+  r = data->bit_buf >> (32 - num);
+  data->bit_buf <<= num;
+  data->bit_cnt -= num;
+
+  return r;
 }
 
 static int
 grub_jpeg_get_number (struct grub_jpeg_data *data, int num)
 {
-  int value, i, msb;
+  int value;
 
   if (num == 0)
     return 0;
 
-  msb = value = grub_jpeg_get_bit (data);
-  for (i = 1; i < num; i++)
-    value = (value << 1) + (grub_jpeg_get_bit (data) != 0);
-  if (!msb)
+  if (num > 16)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid coefficient size");
+      return 0;
+    }
+
+  value = grub_jpeg_get_bits (data, num);
+  if (!(value >> (num - 1)))
     value += 1 - (1 << num);
 
   return value;
@@ -172,17 +266,28 @@ grub_jpeg_get_number (struct grub_jpeg_data *data, int num)
 static int
 grub_jpeg_get_huff_code (struct grub_jpeg_data *data, int id)
 {
-  int code;
-  unsigned i;
+  unsigned entry, code, i;
+
+  if (data->bit_cnt < 16)
+    grub_jpeg_fill_bits (data);
 
-  code = 0;
-  for (i = 0; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
+  entry = data->huff_lookup[id][data->bit_buf >> (32 - JPEG_HUFF_LOOKAHEAD)];
+  if (entry)
     {
-      code <<= 1;
-      if (grub_jpeg_get_bit (data))
-	code++;
-      if (code < data->huff_maxval[id][i])
-	return data->huff_value[id][code + data->huff_offset[id][i]];
+      data->bit_buf <<= entry >> 8;
+      data->bit_cnt -= entry >> 8;
+      return entry & 0xff;
+    }
+
+  for (i = JPEG_HUFF_LOOKAHEAD; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
+    {
+      code = data->bit_buf >> (31 - i);
+      if (code < (unsigned) data->huff_maxval[id][i])
+	{
+	  data->bit_buf <<= i + 1;
+	  data->bit_cnt -= i + 1;
+	  return data->huff_value[id][code + data->huff_offset[id][i]];
+	}
     }
   grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: huffman decode fails");
   return 0;
@@ -194,7 +299,7 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
   int id, ac, n, base, ofs;
   grub_uint32_t next_marker;
   grub_uint8_t count[16];
-  unsigned i;
+  unsigned i, j, k, code;
 
   next_marker = data->file->offset;
   next_marker += grub_jpeg_get_word (data);
@@ -217,6 +322,7 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
 	n += count[i];
 
       id += ac * 2;
+      grub_free (data->huff_value[id]);
       data->huff_value[id] = grub_malloc (n);
       if (grub_errno)
 	return grub_errno;
@@ -236,6 +342,26 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
 
 	  base <<= 1;
 	}
+
+      /* Enter the short codes into the lookup table, every code once for
+	 each value of the bits following it.  */
+      grub_memset (data->huff_lookup[id], 0, sizeof (data->huff_lookup[id]));
+      code = 0;
+      k = 0;
+      for (i = 0; i < ARRAY_SIZE (count); i++, code <<= 1)
+	for (j = 0; j < count[i]; j++, k++, code++)
+	  {
+	    unsigned shift = JPEG_HUFF_LOOKAHEAD - i - 1, p;
+
+	    if (code >= (1U << (i + 1)))
+	      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+				 "jpeg: invalid huffman table");
+	    if (i >= JPEG_HUFF_LOOKAHEAD)
+	      continue;
+
+	    for (p = code << shift; p < (code + 1) << shift; p++)
+	      data->huff_lookup[id][p] = ((i + 1) << 8) | data->huff_value[id][k];
+	  }
     }
 
   if (data->file->offset != next_marker)
@@ -249,12 +375,13 @@ grub_jpeg_decode_quan_table (struct grub_jpeg_data *data)
 {
   int id;
   grub_uint32_t next_marker;
+  grub_uint8_t quan[64];
+  unsigned i;
 
   next_marker = data->file->offset;
   next_marker += grub_jpeg_get_word (data);
 
-  while (data->file->offset + sizeof (data->quan_table[id]) + 1
-	 <= next_marker)
+  while (data->file->offset + sizeof (quan) + 1 <= next_marker)
     {
       id = grub_jpeg_get_byte (data);
       if (id >= 0x10)		/* Upper 4-bit is precision.  */
@@ -265,11 +392,21 @@ grub_jpeg_decode_quan_table (struct grub_jpeg_data *data)
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: too many quantization tables");
 
-      if (grub_file_read (data->file, &data->quan_table[id],
-			  sizeof (data->quan_table[id]))
-	  != sizeof (data->quan_table[id]))
+      if (grub_file_read (data->file, quan, sizeof (quan)) != sizeof (quan))
 	return grub_errno;
 
+      /* Scale by the AAN factors of the row and column, keeping
+	 JPEG_COEF_BITS fraction bits.  */
+      for (i = 0; i < ARRAY_SIZE (quan); i++)
+	{
+	  unsigned n = jpeg_zigzag_order[i];
+	  unsigned scale = (jpeg_aan_scales[n / 8] * jpeg_aan_scales[n % 8]
+			    + (1 << 13)) >> 14;
+
+	  data->quan_table[id][i] = (quan[i] * scale
+				     + (1 << (13 - JPEG_COEF_BITS)))
+	    >> (14 - JPEG_COEF_BITS);
+	}
     }
 
   if (data->file->offset != next_marker)
@@ -348,24 +485,80 @@ grub_jpeg_decode_dri (struct grub_jpeg_data *data)
   return grub_errno;
 }
 
+/* Multiply by a constant with JPEG_AAN_BITS fraction bits.  The product
+   doesn't always fit in 32 bits.  */
+#define AAN_MULTIPLY(v, c)						\
+  ((int) (((grub_int64_t) (v) * AAN_CONST (c)) >> JPEG_AAN_BITS))
+
+/* One pass of the AAN IDCT over eight values STEP apart.  The input is
+   scaled by the AAN factors, the output by 8.  */
+#define AAN_IDCT_PASS(p, step, out_shift)				\
+  do									\
+    {									\
+      int t0, t1, t2, t3, t4, t5, t6, t7;				\
+      int t10, t11, t12, t13, z5, z10, z11, z12, z13;			\
+									\
+      /* Even part.  */							\
+      t10 = p[(step) * 0] + p[(step) * 4];				\
+      t11 = p[(step) * 0] - p[(step) * 4];				\
+      t13 = p[(step) * 2] + p[(step) * 6];				\
+      t12 = AAN_MULTIPLY (p[(step) * 2] - p[(step) * 6], 1.414213562)	\
+	- t13;								\
+									\
+      t0 = t10 + t13;							\
+      t3 = t10 - t13;							\
+      t1 = t11 + t12;							\
+      t2 = t11 - t12;							\
+									\
+      /* Odd part.  */							\
+      z13 = p[(step) * 5] + p[(step) * 3];				\
+      z10 = p[(step) * 5] - p[(step) * 3];				\
+      z11 = p[(step) * 1] + p[(step) * 7];				\
+      z12 = p[(step) * 1] - p[(step) * 7];				\
+									\
+      t7 = z11 + z13;							\
+      t11 = AAN_MULTIPLY (z11 - z13, 1.414213562);			\
+      z5 = AAN_MULTIPLY (z10 + z12, 1.847759065);			\
+      t10 = AAN_MULTIPLY (z12, 1.082392200) - z5;			\
+      t12 = z5 - AAN_MULTIPLY (z10, 2.613125930);			\
+									\
+      t6 = t12 - t7;							\
+      t5 = t11 - t6;							\
+      t4 = t10 + t5;							\
+									\
+      p[(step) * 0] = (t0 + t7) >> (out_shift);				\
+      p[(step) * 7] = (t0 - t7) >> (out_shift);				\
+      p[(step) * 1] = (t1 + t6) >> (out_shift);				\
+      p[(step) * 6] = (t1 - t6) >> (out_shift);				\
+      p[(step) * 2] = (t2 + t5) >> (out_shift);				\
+      p[(step) * 5] = (t2 - t5) >> (out_shift);				\
+      p[(step) * 4] = (t3 + t4) >> (out_shift);				\
+      p[(step) * 3] = (t3 - t4) >> (out_shift);				\
+    }									\
+  while (0)
+
+/* Fixed-point IDCT after Arai, Agui and Nakajima, with five
+   multiplications per pass.  DU holds coefficients dequantized by
+   quan_table, and receives samples clamped to 0..255.  */
 static void
 grub_jpeg_idct_transform (jpeg_data_unit_t du)
 {
   int *pd;
   int i;
-  int t0, t1, t2, t3, t4, t5, t6, t7;
-  int v0, v1, v2, v3, v4;
 
   pd = du;
   for (i = 0; i < JPEG_UNIT_SIZE; i++, pd++)
     {
+      /* Round through the DC term, which reaches every output of the
+	 column.  */
+      pd[0] += 1 << (JPEG_COEF_BITS - JPEG_PASS1_BITS - 1);
+
       if ((pd[JPEG_UNIT_SIZE * 1] | pd[JPEG_UNIT_SIZE * 2] |
 	   pd[JPEG_UNIT_SIZE * 3] | pd[JPEG_UNIT_SIZE * 4] |
 	   pd[JPEG_UNIT_SIZE * 5] | pd[JPEG_UNIT_SIZE * 6] |
 	   pd[JPEG_UNIT_SIZE * 7]) == 0)
 	{
-	  pd[JPEG_UNIT_SIZE * 0] <<= SHIFT_BITS;
-
+	  pd[0] >>= JPEG_COEF_BITS - JPEG_PASS1_BITS;
 	  pd[JPEG_UNIT_SIZE * 1] = pd[JPEG_UNIT_SIZE * 2]
 	    = pd[JPEG_UNIT_SIZE * 3] = pd[JPEG_UNIT_SIZE * 4]
 	    = pd[JPEG_UNIT_SIZE * 5] = pd[JPEG_UNIT_SIZE * 6]
@@ -374,113 +567,28 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
 	  continue;
 	}
 
-      t0 = pd[JPEG_UNIT_SIZE * 0];
-      t1 = pd[JPEG_UNIT_SIZE * 2];
-      t2 = pd[JPEG_UNIT_SIZE * 4];
-      t3 = pd[JPEG_UNIT_SIZE * 6];
-
-      v4 = (t1 + t3) * CONST (0.541196100);
-
-      v0 = ((t0 + t2) << SHIFT_BITS);
-      v1 = ((t0 - t2) << SHIFT_BITS);
-      v2 = v4 - t3 * CONST (1.847759065);
-      v3 = v4 + t1 * CONST (0.765366865);
-
-      t0 = v0 + v3;
-      t3 = v0 - v3;
-      t1 = v1 + v2;
-      t2 = v1 - v2;
-
-      t4 = pd[JPEG_UNIT_SIZE * 7];
-      t5 = pd[JPEG_UNIT_SIZE * 5];
-      t6 = pd[JPEG_UNIT_SIZE * 3];
-      t7 = pd[JPEG_UNIT_SIZE * 1];
-
-      v0 = t4 + t7;
-      v1 = t5 + t6;
-      v2 = t4 + t6;
-      v3 = t5 + t7;
-
-      v4 = (v2 + v3) * CONST (1.175875602);
-
-      v0 *= CONST (0.899976223);
-      v1 *= CONST (2.562915447);
-      v2 = v2 * CONST (1.961570560) - v4;
-      v3 = v3 * CONST (0.390180644) - v4;
-
-      t4 = t4 * CONST (0.298631336) - v0 - v2;
-      t5 = t5 * CONST (2.053119869) - v1 - v3;
-      t6 = t6 * CONST (3.072711026) - v1 - v2;
-      t7 = t7 * CONST (1.501321110) - v0 - v3;
-
-      pd[JPEG_UNIT_SIZE * 0] = t0 + t7;
-      pd[JPEG_UNIT_SIZE * 7] = t0 - t7;
-      pd[JPEG_UNIT_SIZE * 1] = t1 + t6;
-      pd[JPEG_UNIT_SIZE * 6] = t1 - t6;
-      pd[JPEG_UNIT_SIZE * 2] = t2 + t5;
-      pd[JPEG_UNIT_SIZE * 5] = t2 - t5;
-      pd[JPEG_UNIT_SIZE * 3] = t3 + t4;
-      pd[JPEG_UNIT_SIZE * 4] = t3 - t4;
+      AAN_IDCT_PASS (pd, JPEG_UNIT_SIZE, JPEG_COEF_BITS - JPEG_PASS1_BITS);
     }
 
   pd = du;
   for (i = 0; i < JPEG_UNIT_SIZE; i++, pd += JPEG_UNIT_SIZE)
     {
+      /* The DC term reaches every output of the row: level shift by 128
+	 and round there.  */
+      pd[0] += (128 << (JPEG_PASS1_BITS + 3)) + (1 << (JPEG_PASS1_BITS + 2));
+
       if ((pd[1] | pd[2] | pd[3] | pd[4] | pd[5] | pd[6] | pd[7]) == 0)
 	{
-	  pd[0] >>= (SHIFT_BITS + 3);
+	  pd[0] >>= JPEG_PASS1_BITS + 3;
 	  pd[1] = pd[2] = pd[3] = pd[4] = pd[5] = pd[6] = pd[7] = pd[0];
 	  continue;
 	}
 
-      v4 = (pd[2] + pd[6]) * CONST (0.541196100);
-
-      v0 = (pd[0] + pd[4]) << SHIFT_BITS;
-      v1 = (pd[0] - pd[4]) << SHIFT_BITS;
-      v2 = v4 - pd[6] * CONST (1.847759065);
-      v3 = v4 + pd[2] * CONST (0.765366865);
-
-      t0 = v0 + v3;
-      t3 = v0 - v3;
-      t1 = v1 + v2;
-      t2 = v1 - v2;
-
-      t4 = pd[7];
-      t5 = pd[5];
-      t6 = pd[3];
-      t7 = pd[1];
-
-      v0 = t4 + t7;
-      v1 = t5 + t6;
-      v2 = t4 + t6;
-      v3 = t5 + t7;
-
-      v4 = (v2 + v3) * CONST (1.175875602);
-
-      v0 *= CONST (0.899976223);
-      v1 *= CONST (2.562915447);
-      v2 = v2 * CONST (1.961570560) - v4;
-      v3 = v3 * CONST (0.390180644) - v4;
-
-      t4 = t4 * CONST (0.298631336) - v0 - v2;
-      t5 = t5 * CONST (2.053119869) - v1 - v3;
-      t6 = t6 * CONST (3.072711026) - v1 - v2;
-      t7 = t7 * CONST (1.501321110) - v0 - v3;
-
-      pd[0] = (t0 + t7) >> (SHIFT_BITS * 2 + 3);
-      pd[7] = (t0 - t7) >> (SHIFT_BITS * 2 + 3);
-      pd[1] = (t1 + t6) >> (SHIFT_BITS * 2 + 3);
-      pd[6] = (t1 - t6) >> (SHIFT_BITS * 2 + 3);
-      pd[2] = (t2 + t5) >> (SHIFT_BITS * 2 + 3);
-      pd[5] = (t2 - t5) >> (SHIFT_BITS * 2 + 3);
-      pd[3] = (t3 + t4) >> (SHIFT_BITS * 2 + 3);
-      pd[4] = (t3 - t4) >> (SHIFT_BITS * 2 + 3);
+      AAN_IDCT_PASS (pd, 1, JPEG_PASS1_BITS + 3);
     }
 
   for (i = 0; i < JPEG_UNIT_SIZE * JPEG_UNIT_SIZE; i++)
     {
-      du[i] += 128;
-
       if (du[i] < 0)
 	du[i] = 0;
       if (du[i] > 255)
@@ -503,7 +611,7 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
   data->dc_value[id] +=
     grub_jpeg_get_number (data, grub_jpeg_get_huff_code (data, h1));
 
-  du[0] = data->dc_value[id] * (int) data->quan_table[qt][0];
+  du[0] = data->dc_value[id] * data->quan_table[qt][0];
   pos = 1;
   while (pos < ARRAY_SIZE (data->quan_table[qt]))
     {
@@ -516,57 +624,86 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
       val = grub_jpeg_get_number (data, num & 0xF);
       num >>= 4;
       pos += num;
-      du[jpeg_zigzag_order[pos]] = val * (int) data->quan_table[qt][pos];
+      if (pos >= ARRAY_SIZE (data->quan_table[qt]))
+	break;
+      du[jpeg_zigzag_order[pos]] = val * data->quan_table[qt][pos];
       pos++;
     }
 
+  /* Running into a marker means that the data ended early.  */
+  if (data->bit_cnt < data->bit_pad)
+    grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid 0xFF in data stream");
+
   grub_jpeg_idct_transform (du);
 }
 
-static void
-grub_jpeg_ycrcb_to_rgb (int yy, int cr, int cb, grub_uint8_t * rgb)
+static grub_uint8_t
+grub_jpeg_clamp (int v)
 {
-  int dd;
-
-  cr -= 128;
-  cb -= 128;
+  if ((unsigned) v > 255)
+    v = v < 0 ? 0 : 255;
+  return v;
+}
 
-  /* Red  */
-  dd = yy + ((cr * CONST (1.402)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
 #ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[2] = dd;
+#define R3 2
+#define G3 1
+#define B3 0
 #else
-  *(rgb++) = dd;
+#define R3 0
+#define G3 1
+#define B3 2
 #endif
 
-  /* Green  */
-  dd = yy - ((cb * CONST (0.34414) + cr * CONST (0.71414)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[1] = dd;
-#else
-  *(rgb++) = dd;
-#endif
+/* Convert the decoded MCU to RGB, NR2 rows of NC2 pixels at PTR.  */
+static void
+grub_jpeg_convert_mcu (struct grub_jpeg_data *data, grub_uint8_t *ptr,
+		       unsigned nr2, unsigned nc2)
+{
+  int cr_r[64], crcb_g[64], cb_b[64];
+  unsigned r2, c2, i;
+  unsigned pitch = data->image_width * 3;
 
-  /* Blue  */
-  dd = yy + ((cb * CONST (1.772)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[0] = dd;
-  rgb += 3;
-#else
-  *(rgb++) = dd;
-#endif
+  /* The chroma terms are shared by up to four pixels.  */
+  if (data->color_components >= 3)
+    for (i = 0; i < 64; i++)
+      {
+	int cr = data->crdu[i] - 128;
+	int cb = data->cbdu[i] - 128;
+
+	cr_r[i] = (cr * CONST (1.402)) >> SHIFT_BITS;
+	crcb_g[i] = (cb * CONST (0.34414) + cr * CONST (0.71414)) >> SHIFT_BITS;
+	cb_b[i] = (cb * CONST (1.772)) >> SHIFT_BITS;
+      }
+
+  for (r2 = 0; r2 < nr2; r2++, ptr += pitch)
+    {
+      unsigned crow = (r2 >> data->log_vs) * 8;
+      grub_uint8_t *p = ptr;
+
+      for (c2 = 0; c2 < nc2; c2 += 8)
+	{
+	  const int *yrow = &data->ydu[(r2 / 8) * 2 + c2 / 8][(r2 % 8) * 8];
+	  unsigned n = nc2 - c2 < 8 ? nc2 - c2 : 8;
+
+	  if (data->color_components < 3)
+	    {
+	      for (i = 0; i < n; i++, p += 3)
+		p[0] = p[1] = p[2] = yrow[i];
+	      continue;
+	    }
+
+	  for (i = 0; i < n; i++, p += 3)
+	    {
+	      unsigned i0 = crow + ((c2 + i) >> data->log_hs);
+	      int yy = yrow[i];
+
+	      p[R3] = grub_jpeg_clamp (yy + cr_r[i0]);
+	      p[G3] = grub_jpeg_clamp (yy - crcb_g[i0]);
+	      p[B3] = grub_jpeg_clamp (yy + cb_b[i0]);
+	    }
+	}
+    }
 }
 
 static grub_err_t
@@ -609,14 +746,14 @@ grub_jpeg_decode_sos (struct grub_jpeg_data *data)
 				GRUB_VIDEO_BLIT_FORMAT_RGB_888))
     return grub_errno;
 
-  data->bitmap_ptr = (*data->bitmap)->data;
+  data->r1 = data->c1 = 0;
   return GRUB_ERR_NONE;
 }
 
 static grub_err_t
 grub_jpeg_decode_data (struct grub_jpeg_data *data)
 {
-  unsigned c1, vb, hb, nr1, nc1;
+  unsigned vb, hb, nr1, nc1;
   int rst = data->dri;
 
   vb = 8 << data->log_vs;
@@ -624,55 +761,40 @@ grub_jpeg_decode_data (struct grub_jpeg_data *data)
   nr1 = (data->image_height + vb - 1) >> (3 + data->log_vs);
   nc1 = (data->image_width + hb - 1)  >> (3 + data->log_hs);
 
-  for (; data->r1 < nr1 && (!data->dri || rst);
-       data->r1++, data->bitmap_ptr += (vb * data->image_width - hb * nc1) * 3)
-    for (c1 = 0;  c1 < nc1 && (!data->dri || rst);
-	c1++, rst--, data->bitmap_ptr += hb * 3)
-      {
-	unsigned r2, c2, nr2, nc2;
-	grub_uint8_t *ptr2;
+  /* A restart interval may end in the middle of a row of MCUs.  */
+  while (data->r1 < nr1 && (!data->dri || rst))
+    {
+      unsigned r2, c2, nr2, nc2;
 
-	for (r2 = 0; r2 < (1U << data->log_vs); r2++)
-	  for (c2 = 0; c2 < (1U << data->log_hs); c2++)
-	    grub_jpeg_decode_du (data, 0, data->ydu[r2 * 2 + c2]);
+      for (r2 = 0; r2 < (1U << data->log_vs); r2++)
+	for (c2 = 0; c2 < (1U << data->log_hs); c2++)
+	  grub_jpeg_decode_du (data, 0, data->ydu[r2 * 2 + c2]);
 
-	if (data->color_components >= 3)
-	  {
-	    grub_jpeg_decode_du (data, 1, data->cbdu);
-	    grub_jpeg_decode_du (data, 2, data->crdu);
-	  }
+      if (data->color_components >= 3)
+	{
+	  grub_jpeg_decode_du (data, 1, data->cbdu);
+	  grub_jpeg_decode_du (data, 2, data->crdu);
+	}
 
-	if (grub_errno)
-	  return grub_errno;
+      if (grub_errno)
+	break;
 
-	nr2 = (data->r1 == nr1 - 1) ? (data->image_height - data->r1 * vb) : vb;
-	nc2 = (c1 == nc1 - 1) ? (data->image_width - c1 * hb) : hb;
+      nr2 = (data->r1 == nr1 - 1) ? (data->image_height - data->r1 * vb) : vb;
+      nc2 = (data->c1 == nc1 - 1) ? (data->image_width - data->c1 * hb) : hb;
 
-	ptr2 = data->bitmap_ptr;
-	for (r2 = 0; r2 < nr2; r2++, ptr2 += (data->image_width - nc2) * 3)
-	  for (c2 = 0; c2 < nc2; c2++, ptr2 += 3)
-	    {
-	      unsigned i0;
-	      int yy;
+      grub_jpeg_convert_mcu (data, (grub_uint8_t *) (*data->bitmap)->data
+			     + (data->r1 * vb * data->image_width
+				+ data->c1 * hb) * 3, nr2, nc2);
 
-	      i0 = (r2 >> data->log_vs) * 8 + (c2 >> data->log_hs);
-	      yy = data->ydu[(r2 / 8) * 2 + (c2 / 8)][(r2 % 8) * 8 + (c2 % 8)];
+      rst--;
+      if (++data->c1 == nc1)
+	{
+	  data->c1 = 0;
+	  data->r1++;
+	}
+    }
 
-	      if (data->color_components >= 3)
-		{
-		  int cr, cb;
-		  cr = data->crdu[i0];
-		  cb = data->cbdu[i0];
-		  grub_jpeg_ycrcb_to_rgb (yy, cr, cb, ptr2);
-		}
-	      else
-		{
-		  ptr2[0] = yy;
-		  ptr2[1] = yy;
-		  ptr2[2] = yy;
-		}
-	    }
-      }
+  grub_jpeg_unread_scan_buf (data);
 
   return grub_errno;
 }
@@ -680,7 +802,10 @@ grub_jpeg_decode_data (struct grub_jpeg_data *data)
 static void
 grub_jpeg_reset (struct grub_jpeg_data *data)
 {
-  data->bit_mask = 0x0;
+  data->bit_buf = 0;
+  data->bit_cnt = 0;
+  data->bit_pad = 0;
+  data->at_marker = 0;
 
   data->dc_value[0] = 0;
   data->dc_value[1] = 0;
@@ -806,15 +931,34 @@ grub_cmd_jpegtest (grub_command_t cmdd __attribute__ ((unused)),
 		   int argc, char **args)
 {
   struct grub_video_bitmap *bitmap = 0;
+  grub_uint64_t start, elapsed, rate;
+  unsigned int width, height, decodes = 0;
 
   if (argc != 1)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
 
-  grub_video_reader_jpeg (&bitmap, args[0]);
-  if (grub_errno != GRUB_ERR_NONE)
-    return grub_errno;
+  /* Decode repeatedly so that file I/O and timer granularity average out.  */
+  start = grub_get_time_ms ();
+  do
+    {
+      grub_video_reader_jpeg (&bitmap, args[0]);
+      if (grub_errno != GRUB_ERR_NONE)
+	return grub_errno;
 
-  grub_video_bitmap_destroy (bitmap);
+      width = bitmap->mode_info.width;
+      height = bitmap->mode_info.height;
+      grub_video_bitmap_destroy (bitmap);
+      decodes++;
+      elapsed = grub_get_time_ms () - start;
+    }
+  while (elapsed < JPEG_BENCH_TIME);
+
+  /* In units of 0.01 Mpixel/s.  */
+  rate = grub_divmod64 ((grub_uint64_t) decodes * width * height,
+			elapsed * 10, 0);
+  grub_printf ("%ux%u: %u decodes in %u ms, %u.%02u Mpixel/s\n",
+	       width, height, decodes, (unsigned) elapsed,
+	       (unsigned) (rate / 100), (unsigned) (rate % 100));
 
   return GRUB_ERR_NONE;
 }
@@ -35,7 +35,9 @@ enum grub_video_bitmap_scale_method
   /* Nearest neighbor interpolation.  */
   GRUB_VIDEO_BITMAP_SCALE_METHOD_NEAREST,
   /* Bilinear interpolation.  */
-  GRUB_VIDEO_BITMAP_SCALE_METHOD_BILINEAR
+  GRUB_VIDEO_BITMAP_SCALE_METHOD_BILINEAR,
+  /* Average of the covered source pixels, for shrinking.  */
+  GRUB_VIDEO_BITMAP_SCALE_METHOD_AREA
 };
 
 typedef enum grub_video_bitmap_selection_method
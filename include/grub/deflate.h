@@ -27,4 +27,19 @@ grub_ssize_t
 grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 			 char *outbuf, grub_size_t outsize);
 
+/* Decompress a zlib stream held in memory piece by piece, without
+   restarting from the beginning for every call.  INBUF must stay valid
+   until the stream is closed.  */
+struct grub_gzio;
+
+struct grub_gzio *
+grub_zlib_stream_open (char *inbuf, grub_size_t insize);
+
+grub_ssize_t
+grub_zlib_stream_read (struct grub_gzio *gzio, char *outbuf,
+		       grub_size_t outsize);
+
+void
+grub_zlib_stream_close (struct grub_gzio *gzio);
+
 #endif
@@ -26,7 +26,8 @@ grub_ssize_t
 EXPORT_FUNC(grub_emunet_send) (const void *packet, grub_size_t sz);
 
 grub_ssize_t
-EXPORT_FUNC(grub_emunet_receive) (void *packet, grub_size_t sz);
+EXPORT_FUNC(grub_emunet_receive) (void *packet, grub_size_t sz,
+				  int *checksum_valid);
 
 int
 EXPORT_FUNC(grub_emunet_create) (grub_size_t *mtu);
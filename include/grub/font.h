@@ -43,8 +43,8 @@ struct grub_font
   short descent;
   short leading;
   grub_uint32_t num_chars;
-  struct char_index_entry *char_index;
-  grub_uint16_t *bmp_idx;
+  /* Character index pages and glyph cache, loaded on demand.  */
+  struct font_index *index;
 };
 
 /* Font type used to access font functions.  */
@@ -108,6 +108,12 @@ struct grub_gfxmenu_view
 
   grub_gui_container_t canvas;
 
+  /* The desktop with the leading STATIC_LAYERS components of the canvas,
+     which never change while the menu is shown, already drawn on it.  */
+  struct grub_video_render_target *background;
+  int background_valid;
+  int static_layers;
+
   int double_repaint;
 
   int selected;
@@ -69,8 +69,14 @@ struct grub_gui_list_ops
                          grub_gfxmenu_view_t view);
   void (*refresh_list) (void *self,
                         grub_gfxmenu_view_t view);
+  /* Store in DAMAGE the parts of the list which changed since they were
+     last painted and return their number.  DAMAGE must have room for
+     GRUB_GUI_LIST_MAX_DAMAGE rectangles.  */
+  int (*get_damage) (void *self, grub_video_rect_t *damage);
 };
 
+#define GRUB_GUI_LIST_MAX_DAMAGE 2
+
 struct grub_gui_progress_ops
 {
   void (*set_state) (void *self, int visible, int start, int current, int end);
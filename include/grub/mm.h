@@ -36,6 +36,8 @@ void *EXPORT_FUNC(grub_realloc) (void *ptr, grub_size_t size);
 #ifndef GRUB_MACHINE_EMU
 void *EXPORT_FUNC(grub_memalign) (grub_size_t align, grub_size_t size);
 #endif
+/* Total size of the free heap blocks, which may be fragmented.  */
+grub_size_t EXPORT_FUNC(grub_mm_free_size) (void);
 
 void grub_mm_check_real (const char *file, int line);
 #define grub_mm_check() grub_mm_check_real (GRUB_FILE, __LINE__);
@@ -132,6 +132,20 @@ struct grub_net_card
   grub_size_t rcvbufsize;
   grub_size_t txbufsize;
   int txbusy;
+  /* Buffers for received packets.  */
+  struct grub_net_buff_pool *rx_pool;
+  /* Most packets taken from the card per poll.  */
+  unsigned rx_batch;
+  /* Statistics.  */
+  grub_uint64_t rx_packets;
+  grub_uint64_t rx_bytes;
+  /* Received packets that were thrown away.  */
+  grub_uint64_t rx_dropped;
+  /* Times no buffer could be had for a received packet.  */
+  grub_uint64_t rx_alloc_failures;
+  grub_uint64_t tx_packets;
+  grub_uint64_t tx_bytes;
+  grub_uint64_t tx_errors;
   union
   {
 #ifdef GRUB_MACHINE_EFI
@@ -264,6 +278,11 @@ struct grub_net_app_protocol
   grub_err_t (*seek) (struct grub_file *file, grub_off_t off);
   grub_err_t (*close) (struct grub_file *file);
   grub_err_t (*packets_pulled) (struct grub_file *file);
+  /* Read up to LEN bytes at the current offset straight into BUF,
+     bypassing the packet queue.  Returns the amount read, possibly 0;
+     the rest is read from the queue as usual.  */
+  grub_ssize_t (*bulk_read) (struct grub_file *file, char *buf,
+			     grub_size_t len);
 };
 
 typedef struct grub_net
@@ -276,10 +295,16 @@ typedef struct grub_net
   grub_fs_t fs;
   int eof;
   int stall;
+  /* Where a pending read wants its data, and how much more it wants.  */
+  char *read_buf;
+  grub_size_t read_len;
 } *grub_net_t;
 
 extern grub_net_t (*EXPORT_VAR (grub_net_open)) (const char *name);
 
+int
+grub_net_fill_reader (grub_net_t net, struct grub_net_buff *nb);
+
 struct grub_net_network_level_interface
 {
   struct grub_net_network_level_interface *next;
@@ -375,6 +400,9 @@ grub_net_card_register (struct grub_net_card *card)
 void
 grub_net_card_unregister (struct grub_net_card *card);
 
+struct grub_net_buff *
+grub_net_card_rx_alloc (struct grub_net_card *card, grub_size_t len);
+
 #define FOR_NET_CARDS(var) for (var = grub_net_cards; var; var = var->next)
 #define FOR_NET_CARDS_SAFE(var, next) for (var = grub_net_cards, next = (var ? var->next : 0); var; var = next, next = (var ? var->next : 0))
 
@@ -530,6 +558,9 @@ grub_net_network_level_interface_unregister (struct grub_net_network_level_inter
 void
 grub_net_tcp_retransmit (void);
 
+void
+grub_net_tcp_flush_acks (void);
+
 void
 grub_net_link_layer_add_address (struct grub_net_card *card,
 				 const grub_net_network_level_address_t *nl,
@@ -559,6 +590,8 @@ extern char *grub_net_default_server;
 
 #define GRUB_NET_TRIES 40
 #define GRUB_NET_INTERVAL 400
+/* Shortest poll of a read while data keeps arriving.  */
+#define GRUB_NET_MIN_INTERVAL 25
 #define GRUB_NET_INTERVAL_ADDITION 20
 
 #endif /* ! GRUB_NET_HEADER */
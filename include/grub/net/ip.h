@@ -44,6 +44,29 @@ grub_net_ipv6_get_id (const grub_net_link_level_address_t *addr)
 
 grub_uint16_t grub_net_ip_chksum(void *ipv, grub_size_t len);
 
+/* Update checksum CHK for a 16-bit word of the data changing from OLD_VAL
+   to NEW_VAL, all as stored in the packet (RFC 1624).  */
+static inline grub_uint16_t
+grub_net_ip_chksum_update16 (grub_uint16_t chk, grub_uint16_t old_val,
+			     grub_uint16_t new_val)
+{
+  grub_uint32_t sum;
+
+  sum = (grub_uint16_t) ~chk + (grub_uint16_t) ~old_val + new_val;
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+static inline grub_uint16_t
+grub_net_ip_chksum_update32 (grub_uint16_t chk, grub_uint32_t old_val,
+			     grub_uint32_t new_val)
+{
+  chk = grub_net_ip_chksum_update16 (chk, old_val >> 16, new_val >> 16);
+  return grub_net_ip_chksum_update16 (chk, old_val & 0xffff,
+				      new_val & 0xffff);
+}
+
 grub_err_t
 grub_net_recv_ip_packets (struct grub_net_buff *nb,
 			  struct grub_net_card *card,
@@ -16,8 +16,16 @@ struct grub_net_buff
   grub_uint8_t *tail;
   /* Pointer to the end of the buffer.  */
   grub_uint8_t *end;
+  /* Pool the buffer returns to when freed, if any.  */
+  struct grub_net_buff_pool *pool;
+  /* Next free buffer in the pool.  */
+  struct grub_net_buff *pool_next;
+  /* The card has already verified the transport checksum.  */
+  int checksum_valid;
 };
 
+struct grub_net_buff_pool;
+
 grub_err_t grub_netbuff_put (struct grub_net_buff *net_buff, grub_size_t len);
 grub_err_t grub_netbuff_unput (struct grub_net_buff *net_buff, grub_size_t len);
 grub_err_t grub_netbuff_push (struct grub_net_buff *net_buff, grub_size_t len);
@@ -27,5 +35,10 @@ grub_err_t grub_netbuff_clear (struct grub_net_buff *net_buff);
 struct grub_net_buff * grub_netbuff_alloc (grub_size_t len);
 struct grub_net_buff * grub_netbuff_make_pkt (grub_size_t len);
 void grub_netbuff_free (struct grub_net_buff *net_buff);
+struct grub_net_buff_pool *grub_netbuff_pool_new (grub_size_t len,
+						  unsigned count);
+struct grub_net_buff *grub_netbuff_pool_alloc (struct grub_net_buff_pool *pool,
+					       grub_size_t len);
+void grub_netbuff_pool_destroy (struct grub_net_buff_pool *pool);
 
 #endif
@@ -29,15 +29,13 @@ struct grub_unicode_bidi_pair
   grub_uint32_t replace;
 };
 
-struct grub_unicode_compact_range
+struct grub_unicode_property
 {
-  unsigned start:21;
-  unsigned len:9;
   unsigned bidi_type:5;
-  unsigned comb_type:8;
   unsigned bidi_mirror:1;
   unsigned join_type:3;
-} GRUB_PACKED;
+  unsigned comb_type:8;
+};
 
 /* Old-style Arabic shaping. Used for "visual UTF-8" and
    in grub-mkfont to find variant glyphs in absence of GPOS tables.  */
@@ -236,10 +234,32 @@ enum
     GRUB_UNICODE_LAST_VALID                = 0x10ffff
   };
 
-extern struct grub_unicode_compact_range grub_unicode_compact[];
 extern struct grub_unicode_bidi_pair grub_unicode_bidi_pairs[];
 
-#define GRUB_UNICODE_MAX_CACHED_CHAR 0x20000
+/* Properties of the code points, generated by util/import_unicode.py as a
+   two-level table: the block of a code point selects a row of
+   grub_unicode_property_index, which holds indexes into
+   grub_unicode_properties.  */
+#define GRUB_UNICODE_PROPERTY_BLOCK_SHIFT 8
+extern const struct grub_unicode_property grub_unicode_properties[];
+extern const grub_uint8_t grub_unicode_property_blocks[];
+extern const grub_uint8_t grub_unicode_property_index[];
+
+static inline const struct grub_unicode_property *
+grub_unicode_get_property (grub_uint32_t c)
+{
+  unsigned block;
+
+  if (c > GRUB_UNICODE_LAST_VALID)
+    return &grub_unicode_properties[0];
+
+  block = grub_unicode_property_blocks[c >> GRUB_UNICODE_PROPERTY_BLOCK_SHIFT];
+  return &grub_unicode_properties[grub_unicode_property_index
+				  [(block << GRUB_UNICODE_PROPERTY_BLOCK_SHIFT)
+				   | (c & ((1 << GRUB_UNICODE_PROPERTY_BLOCK_SHIFT)
+					   - 1))]];
+}
+
 /*  Unicode mandates an arbitrary limit.  */
 #define GRUB_BIDI_MAX_EXPLICIT_LEVEL 61
 
@@ -51,13 +51,13 @@ infile = open (sys.argv[1], "r")
 outfile = open (sys.argv[4], "w")
 outfile.write ("#include <grub/unicode.h>\n")
 outfile.write ("\n")
-outfile.write ("struct grub_unicode_compact_range grub_unicode_compact[] = {\n")
 
-begincode = -2
-lastcode = -2
-lastbiditype = "X"
-lastmirrortype = False
-lastcombtype = -1
+# Must match GRUB_UNICODE_PROPERTY_BLOCK_SHIFT in include/grub/unicode.h.
+blockshift = 8
+# Code points which are L, not combining and not mirrored keep the
+# default properties, whatever their joining type.
+defaultprop = ("L", 0, False, "NONJOINING")
+properties = {}
 arabicsubst = {}
 for line in infile:
     sp = line.split (";")
@@ -124,34 +124,55 @@ for line in infile:
         arabicsubst[arabname][form] = curcode;
         if form == 0:
             arabicsubst[arabname]['join'] = curjoin
-    if lastcode + 1 != curcode or curbiditype != lastbiditype \
-            or curcombtype != lastcombtype or curmirrortype != lastmirrortype \
-            or curjoin != lastjoin:
-        if begincode != -2 and (lastbiditype != "L" or lastcombtype != 0 or \
-                                    lastmirrortype):
-            outfile.write (("{0x%x, 0x%x, GRUB_BIDI_TYPE_%s, %d, %d, GRUB_JOIN_TYPE_%s},\n" \
-                                % (begincode, lastcode - begincode + 1, \
-                                       lastbiditype, \
-                                       lastcombtype, lastmirrortype, \
-                                       lastjoin)))
-            if lastcode - begincode + 1 >= 0x200:
-                print ("Too long range")
-                raise
-        begincode = curcode
-    lastcode = curcode
-    lastjoin = curjoin
-    lastbiditype = curbiditype
-    lastcombtype = curcombtype
-    lastmirrortype = curmirrortype
-if lastbiditype != "L" or lastcombtype != 0 or lastmirrortype:
-    outfile.write (("{0x%x, 0x%x, GRUB_BIDI_TYPE_%s, %d, %d, GRUB_JOIN_TYPE_%s},\n" \
-                        % (begincode, lastcode, lastbiditype, lastcombtype, \
-                               lastmirrortype, lastjoin)))
-outfile.write ("{0, 0, 0, 0, 0, 0},\n")
+    if curbiditype != "L" or curcombtype != 0 or curmirrortype:
+        properties[curcode] = (curbiditype, curcombtype, curmirrortype, \
+                               curjoin)
 
+infile.close ()
+
+# Two-level table: grub_unicode_property_blocks maps every block of
+# 1 << blockshift code points to one of the distinct blocks in
+# grub_unicode_property_index, which holds an index into
+# grub_unicode_properties for each code point.
+proplist = [defaultprop]
+propindex = {defaultprop: 0}
+for code in sorted (properties):
+    if properties[code] not in propindex:
+        propindex[properties[code]] = len (proplist)
+        proplist.append (properties[code])
+
+blocklist = []
+blockindex = {}
+stage1 = []
+for block in range ((0x10ffff >> blockshift) + 1):
+    cur = tuple (propindex[properties.get ((block << blockshift) + i, \
+                                           defaultprop)] \
+                 for i in range (1 << blockshift))
+    if cur not in blockindex:
+        blockindex[cur] = len (blocklist)
+        blocklist.append (cur)
+    stage1.append (blockindex[cur])
+
+if len (proplist) > 256 or len (blocklist) > 256:
+    print ("Too many distinct properties or blocks")
+    raise
+
+outfile.write ("const struct grub_unicode_property grub_unicode_properties[] = {\n")
+for prop in proplist:
+    outfile.write ("{GRUB_BIDI_TYPE_%s, %d, GRUB_JOIN_TYPE_%s, %d},\n" \
+                       % (prop[0], prop[2], prop[3], prop[1]))
 outfile.write ("};\n")
 
-infile.close ()
+outfile.write ("const grub_uint8_t grub_unicode_property_blocks[] = {\n")
+for i in range (0, len (stage1), 16):
+    outfile.write ("".join ("%d, " % x for x in stage1[i:i + 16]) + "\n")
+outfile.write ("};\n")
+
+outfile.write ("const grub_uint8_t grub_unicode_property_index[] = {\n")
+for block in blocklist:
+    for i in range (0, len (block), 16):
+        outfile.write ("".join ("%d, " % x for x in block[i:i + 16]) + "\n")
+outfile.write ("};\n")
 
 infile = open (sys.argv[2], "r")
 